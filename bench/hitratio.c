@@ -0,0 +1,211 @@
+/* Trace driven hit ratio benchmark of the maxmemory policies.
+ *
+ * A trace of key ids is generated once: Zipf distributed accesses over a
+ * fixed keyspace, optionally interleaved with scans of keys never seen
+ * before and never accessed again. The trace is then replayed against a
+ * handle for every policy, like a cache in front of a slower store would
+ * do: a GET, and on a miss a SET of the key followed by
+ * RcFreeMemoryIfNeeded(). Scan keys always miss, so they are counted.
+ *
+ * Usage: rediscache-hitratio [options], see usage() below. Without scan
+ * options three traces are run: Zipf only, and with a scan of 100k keys
+ * every 400k accesses and of 300k keys every 1M accesses. */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../redis.h"
+
+typedef struct benchConfig {
+    unsigned long keys;         /* Keyspace of the Zipf accesses */
+    unsigned long ops;          /* Zipf accesses in the trace */
+    double zipf;                /* Zipf exponent */
+    unsigned long long maxmemory;
+    unsigned long scan_len;     /* Keys of every scan, 0 no scans */
+    unsigned long scan_every;   /* Zipf accesses between two scans */
+    int samples;
+    int pool;
+    unsigned int value_len;
+    uint64_t seed;
+} benchConfig;
+
+static const struct {
+    const char *name;
+    int policy;
+} policies[] = {
+    {"lru", MAXMEMORY_ALLKEYS_LRU},
+    {"lfu", MAXMEMORY_ALLKEYS_LFU},
+    {"tinylfu", MAXMEMORY_ALLKEYS_TINYLFU},
+};
+#define POLICIES_NUM (sizeof(policies)/sizeof(policies[0]))
+
+/* xorshift64*, so that the trace only depends on the seed. */
+static uint64_t benchRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+/* Return a trace of key ids: ids below cfg->keys are Zipf accesses, the
+ * ones above are scan keys, each used once. '*len' is set to its length. */
+static uint32_t *generateTrace(benchConfig *cfg, unsigned long *len) {
+    unsigned long scans = cfg->scan_len ? cfg->ops/cfg->scan_every : 0;
+    unsigned long i, j, n = 0, scan_id = cfg->keys;
+    uint64_t state = cfg->seed;
+    double *cdf = malloc(sizeof(double)*cfg->keys), sum = 0;
+    uint32_t *trace = malloc(sizeof(uint32_t)*(cfg->ops + scans*cfg->scan_len));
+
+    for (i = 0; i < cfg->keys; i++) {
+        sum += 1.0/pow((double)(i+1),cfg->zipf);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < cfg->ops; i++) {
+        double r = (double)(benchRandom(&state) >> 11)/(double)(1ULL << 53)*sum;
+        unsigned long lo = 0, hi = cfg->keys - 1;
+
+        while (lo < hi) {
+            unsigned long mid = (lo + hi)/2;
+            if (cdf[mid] < r) lo = mid + 1; else hi = mid;
+        }
+        trace[n++] = lo;
+        if (cfg->scan_len && (i+1) % cfg->scan_every == 0) {
+            for (j = 0; j < cfg->scan_len; j++) trace[n++] = scan_id++;
+        }
+    }
+    free(cdf);
+    *len = n;
+    return trace;
+}
+
+/* Replay 'trace' against a new handle with 'policy', returning the hit
+ * ratio. */
+static double replayTrace(benchConfig *cfg, int policy, uint32_t *trace,
+                          unsigned long len) {
+    redisCache cache = RcCreateCacheHandle();
+    db_config dbcfg;
+    unsigned long i, hits = 0;
+    char keybuf[32], *value = malloc(cfg->value_len);
+
+    memset(&dbcfg,0,sizeof(dbcfg));
+    dbcfg.maxmemory = cfg->maxmemory;
+    dbcfg.maxmemory_policy = policy;
+    dbcfg.maxmemory_samples = cfg->samples;
+    dbcfg.maxmemory_eviction_pool = cfg->pool;
+    RcSetHandleConfig(cache,&dbcfg);
+    memset(value,'v',cfg->value_len);
+
+    for (i = 0; i < len; i++) {
+        int keylen = snprintf(keybuf,sizeof(keybuf),"key:%u",trace[i]);
+        robj *key = createStringObject(keybuf,keylen), *val;
+
+        if (RcGet(cache,key,&val) == C_OK) {
+            hits++;
+            decrRefCount(val);
+        } else {
+            val = createStringObject(value,cfg->value_len);
+            RcSet(cache,key,val,NULL);
+            decrRefCount(val);
+            RcFreeMemoryIfNeeded(cache);
+        }
+        decrRefCount(key);
+    }
+    RcDestroyCacheHandle(cache);
+    free(value);
+    return (double)hits/len;
+}
+
+static void runTrace(benchConfig *cfg) {
+    unsigned long len;
+    uint32_t *trace = generateTrace(cfg,&len);
+    char label[64];
+    size_t p;
+
+    if (cfg->scan_len)
+        snprintf(label,sizeof(label),"+ %lu scan / %lu ops",
+                 cfg->scan_len, cfg->scan_every);
+    else
+        snprintf(label,sizeof(label),"zipf only");
+    printf("  %-28s", label);
+    fflush(stdout);
+    for (p = 0; p < POLICIES_NUM; p++) {
+        printf("%-8.3f", replayTrace(cfg,policies[p].policy,trace,len));
+        fflush(stdout);
+    }
+    printf("\n");
+    free(trace);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --keys <n>           Zipf keyspace (default 1000000)\n"
+        "  --ops <n>            Zipf accesses (default 4000000)\n"
+        "  --zipf <s>           Zipf exponent (default 0.9)\n"
+        "  --maxmemory <mb>     Handle maxmemory in MB (default 12)\n"
+        "  --scan <n> <ops>     A scan of n new keys every ops accesses\n"
+        "  --samples <n>        maxmemory_samples (default 5)\n"
+        "  --pool <n>           maxmemory_eviction_pool (default 16)\n"
+        "  --value-len <n>      Value length in bytes (default 16)\n"
+        "  --seed <n>           Trace seed (default 1)\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    benchConfig cfg = {1000000, 4000000, 0.9, 12ULL*1024*1024, 0, 0, 5, 16, 16, 1};
+    int i, scan_set = 0;
+
+    for (i = 1; i < argc; i++) {
+        int more = argc - i - 1;
+
+        if (!strcmp(argv[i],"--keys") && more >= 1) {
+            cfg.keys = strtoul(argv[++i],NULL,10);
+        } else if (!strcmp(argv[i],"--ops") && more >= 1) {
+            cfg.ops = strtoul(argv[++i],NULL,10);
+        } else if (!strcmp(argv[i],"--zipf") && more >= 1) {
+            cfg.zipf = strtod(argv[++i],NULL);
+        } else if (!strcmp(argv[i],"--maxmemory") && more >= 1) {
+            cfg.maxmemory = strtoull(argv[++i],NULL,10)*1024*1024;
+        } else if (!strcmp(argv[i],"--scan") && more >= 2) {
+            cfg.scan_len = strtoul(argv[++i],NULL,10);
+            cfg.scan_every = strtoul(argv[++i],NULL,10);
+            scan_set = 1;
+        } else if (!strcmp(argv[i],"--samples") && more >= 1) {
+            cfg.samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"--pool") && more >= 1) {
+            cfg.pool = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"--value-len") && more >= 1) {
+            cfg.value_len = atoi(argv[++i]);
+        } else if (!strcmp(argv[i],"--seed") && more >= 1) {
+            cfg.seed = strtoull(argv[++i],NULL,10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (cfg.keys == 0 || cfg.ops == 0 || cfg.seed == 0 ||
+        (cfg.scan_len && cfg.scan_every == 0)) usage(argv[0]);
+
+    printf("%lu keys Zipf %.2f, %lluMB maxmemory, %lu ops, samples %d, "
+           "pool %d\n\n", cfg.keys, cfg.zipf, cfg.maxmemory/1024/1024,
+           cfg.ops, cfg.samples, cfg.pool);
+    printf("  %-28s", "");
+    for (i = 0; i < (int)POLICIES_NUM; i++) printf("%-8s", policies[i].name);
+    printf("\n");
+
+    if (scan_set) {
+        runTrace(&cfg);
+    } else {
+        runTrace(&cfg);
+        cfg.scan_len = 100000;
+        cfg.scan_every = 400000;
+        runTrace(&cfg);
+        cfg.scan_len = 300000;
+        cfg.scan_every = 1000000;
+        runTrace(&cfg);
+    }
+    return 0;
+}
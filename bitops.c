@@ -215,13 +215,8 @@ unsigned char *getObjectReadOnlyString(robj *o, long *len, char *llbuf) {
     return p;
 }
 
-int RcSetBit(redisCache db, robj *key, size_t bitoffset, long on)
+static int setbitCommand(redisDb *redis_db, robj *key, size_t bitoffset, long on)
 {
-    if (NULL == db || NULL == key) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     /* Bits can only be set or cleared... */
     if (on & ~1) {
         return C_ERR;
@@ -248,13 +243,20 @@ int RcSetBit(redisCache db, robj *key, size_t bitoffset, long on)
     return C_OK;
 }
 
-int RcGetBit(redisCache db, robj *key, size_t bitoffset, long *val)
+int RcSetBit(redisCache db, robj *key, size_t bitoffset, long on)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = setbitCommand(redis_db, key, bitoffset, on);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int getbitCommand(redisDb *redis_db, robj *key, size_t bitoffset, long *val)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_STRING)) {
         return REDIS_KEY_NOT_EXIST;
@@ -279,13 +281,20 @@ int RcGetBit(redisCache db, robj *key, size_t bitoffset, long *val)
     return C_OK;
 }
 
-int RcBitCount(redisCache db, robj *key, long start, long end, long *val, int have_offset)
+int RcGetBit(redisCache db, robj *key, size_t bitoffset, long *val)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = getbitCommand(redis_db, key, bitoffset, val);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int bitcountCommand(redisDb *redis_db, robj *key, long start, long end, long *val, int have_offset)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_STRING)) {
         return REDIS_KEY_NOT_EXIST;
@@ -323,13 +332,20 @@ int RcBitCount(redisCache db, robj *key, long start, long end, long *val, int ha
     return C_OK;
 }
 
-int RcBitPos(redisCache db, robj *key, long bit, long start, long end, long *val, int offset_status)
+int RcBitCount(redisCache db, robj *key, long start, long end, long *val, int have_offset)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = bitcountCommand(redis_db, key, start, end, val, have_offset);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int bitposCommand(redisDb *redis_db, robj *key, long bit, long start, long end, long *val, int offset_status)
+{
     if (bit != 0 && bit != 1) {
         return C_ERR;
     }
@@ -392,3 +408,15 @@ int RcBitPos(redisCache db, robj *key, long bit, long start, long end, long *val
 
     return C_OK;
 }
+
+int RcBitPos(redisCache db, robj *key, long bit, long start, long end, long *val, int offset_status)
+{
+    if (NULL == db || NULL == key) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = bitposCommand(redis_db, key, bit, start, end, val, offset_status);
+    unlockShard(redis_db);
+
+    return retval;
+}
@@ -5,6 +5,14 @@
 
 typedef long long mstime_t; /* millisecond time type. */
 
+/* Anti-warning macro... */
+#define UNUSED(V) ((void) V)
+
+/* Cache handle creation flags */
+#define CACHE_HANDLE_THREAD_SAFE (1<<0)  /* Lock shards, share between threads */
+#define CACHE_HANDLE_FAST_HASH (1<<1)    /* Non cryptographic hash, trusted keys only */
+#define CACHE_HANDLE_OPEN_ADDRESSING (1<<2) /* Keyspace without per key dictEntry */
+
 /* Error codes */
 #define C_OK                    0
 #define C_ERR                   -1
@@ -15,6 +23,14 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_ITEM_NOT_EXIST    -6
 #define REDIS_NO_KEYS    		-7
 
+/* Why a key was removed by the cache itself, see RcSetKeyEventCallback() */
+#define KEY_EVENT_EVICTED 1
+#define KEY_EVENT_EXPIRED 2
+typedef void keyEventProc(void *privdata, int event, const char *key, size_t keylen);
+
+/* Keys reported by RcScanBigKeys(), 'type' is one of OBJ_* */
+typedef void bigKeyProc(void *privdata, const char *key, size_t keylen, int type, size_t bytes);
+
 /* The actual Redis Object */
 #define OBJ_STRING 0
 #define OBJ_LIST 1
@@ -30,11 +46,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define OBJ_ENCODING_HT 2      /* Encoded as hash table */
 #define OBJ_ENCODING_ZIPMAP 3  /* Encoded as zipmap */
 #define OBJ_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
-#define OBJ_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
+#define OBJ_ENCODING_ZIPLIST 5 /* No longer used: old hash/zset encoding. */
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
+#define OBJ_ENCODING_LISTPACK 10 /* Encoded as a listpack */
 
 /* Redis maxmemory strategies. Instead of using just incremental number
  * for this defines, we use a set of flags so that testing for certain
@@ -42,7 +59,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_FLAG_LRU (1<<0)
 #define MAXMEMORY_FLAG_LFU (1<<1)
 #define MAXMEMORY_FLAG_ALLKEYS (1<<2)
-#define MAXMEMORY_FLAG_NO_SHARED_INTEGERS (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)
+#define MAXMEMORY_FLAG_TINYLFU (1<<3)
+#define MAXMEMORY_FLAG_SIZE (1<<4)
+#define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
+    (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_TINYLFU)
 
 #define MAXMEMORY_VOLATILE_LRU ((0<<8)|MAXMEMORY_FLAG_LRU)
 #define MAXMEMORY_VOLATILE_LFU ((1<<8)|MAXMEMORY_FLAG_LFU)
@@ -52,17 +72,18 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+#define MAXMEMORY_ALLKEYS_TINYLFU ((8<<8)|MAXMEMORY_FLAG_TINYLFU|MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_ALLKEYS_GDSF \
+    ((9<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_SIZE|MAXMEMORY_FLAG_ALLKEYS)
 
 /* LRU */
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
 #define LRU_CLOCK_RESOLUTION 1000 /* LRU clock resolution in ms */
 
-#define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 16 /* Loopkups per loop. */
-#define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
-#define ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC 25 /* CPU max % for keys collection */
-#define ACTIVE_EXPIRE_CYCLE_SLOW 0
-#define ACTIVE_EXPIRE_CYCLE_FAST 1
+#define ACTIVE_EXPIRE_CYCLE_KEYS_PER_LOOP 20 /* Keys sampled per loop. */
+#define ACTIVE_EXPIRE_CYCLE_STALE_WINDOW 1000 /* Keys of the stale % estimate */
+#define ACTIVE_EXPIRE_CYCLE_MAX_BUCKETS (ACTIVE_EXPIRE_CYCLE_KEYS_PER_LOOP*20) /* Buckets visited per loop */
 
 #define OBJ_SHARED_REFCOUNT INT_MAX
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
@@ -78,13 +99,16 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
+#define CONFIG_DEFAULT_EVICT_HIGH_WATERMARK 95  /* Used when the config is 0 */
+#define CONFIG_DEFAULT_EVICT_LOW_WATERMARK 90
+#define CONFIG_DEFAULT_ACTIVE_EXPIRE_STALE_PERC 10  /* Used when the config is 0 */
 
-/* Zip structure related defaults */
+/* Zip structure related defaults, used when the config is 0 */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
-#define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 0
-#define OBJ_ZSET_MAX_ZIPLIST_VALUE 0
+#define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
+#define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
 
 /* Hash structure related defaults */
 #define OBJ_HASH_KEY 1
@@ -93,10 +117,15 @@ typedef long long mstime_t; /* millisecond time type. */
 /* Hash table parameters */
 #define HASHTABLE_MIN_FILL        10      /* Minimal hash table fill 10% */
 
-/* List defaults */
+/* List defaults, the size is used when the config is 0 */
 #define OBJ_LIST_MAX_ZIPLIST_SIZE -2
 #define OBJ_LIST_COMPRESS_DEPTH 0
 
+/* Codecs of the compressed list nodes, same values of QUICKLIST_CODEC_* */
+#define LIST_COMPRESS_CODEC_LZF 0       /* The default */
+#define LIST_COMPRESS_CODEC_FAST 1      /* LZ4 like, faster to decompress */
+#define LIST_COMPRESS_CODEC_HIGH 2      /* Same format, better ratio, slower */
+
 /* List related stuff */
 #define REDIS_LIST_HEAD 0
 #define REDIS_LIST_TAIL 1
@@ -126,10 +155,25 @@ typedef long long mstime_t; /* millisecond time type. */
 
 // redisdb config
 typedef struct _db_config {
-    unsigned long long maxmemory;       /* Can used max memory */
+    unsigned long long maxmemory;       /* Max memory of the handle, all shards */
     int maxmemory_policy;               /* Policy for key eviction */
     int maxmemory_samples;              /* Pricision of random sampling */
     int lfu_decay_time;                 /* LFU counter decay factor. */
+    int evict_high_watermark;           /* % of maxmemory starting RcEvictStep() */
+    int evict_low_watermark;            /* % of maxmemory RcEvictStep() evicts down to */
+    int lazyfree_lazy_eviction;         /* Free evicted values in background */
+    int lazyfree_lazy_expire;           /* Free expired values in background */
+    int lazyfree_lazy_server_del;       /* Free overwritten values in background */
+    int maxmemory_eviction_pool;        /* Eviction pool size, EVPOOL_SIZE if 0 */
+    int active_expire_stale_perc;       /* % of expired keys RcActiveExpireCycle() tolerates */
+    int zset_max_listpack_entries;      /* Max zset members kept in a listpack, -1 never */
+    int zset_max_listpack_value;        /* Max member length kept in a listpack, -1 never */
+    int hash_max_listpack_entries;      /* Max hash fields kept in a listpack, -1 never */
+    int hash_max_listpack_value;        /* Max field/value length kept in a listpack, -1 never */
+    int set_max_intset_entries;         /* Max set members kept in an intset, -1 never */
+    int list_max_listpack_size;         /* Quicklist fill factor, see quicklistNew() */
+    int list_compress_depth;            /* Quicklist nodes not compressed at each end, 0 off */
+    int list_compress_codec;            /* LIST_COMPRESS_CODEC_* of the compressed nodes */
 } db_config;
 
 // redisdb status
@@ -139,6 +183,10 @@ typedef struct _db_status {
     long long stat_keyspace_hits;       /* Number of successful lookups of keys */
     long long stat_keyspace_misses;     /* Number of failed lookups of keys */
     size_t stat_peak_memory;            /* Max used memory record */
+    long long stat_expire_cycle_time_used; /* Microseconds spent in RcActiveExpireCycle() */
+    long long stat_expired_stale_keys;  /* Estimated expired keys not yet removed */
+    long long stat_volatile_keys;       /* Keys with an expire, as of the last cycle */
+    double stat_expired_stale_perc;     /* Of the volatile keys, handle stats only */
 } db_status;
 
 #endif
@@ -38,18 +38,25 @@
 #include "commondef.h"
 #include "commonfunc.h"
 #include "zmalloc.h"
+#include "zset.h"
+#include "lazyfree.h"
 
 extern db_config g_db_config;
-extern db_status g_db_status;
 
 
+/* Keys embedded in their value object are released with the value. */
+static void dbKeyDestructor(void *privdata, void *key)
+{
+    if (!sdsIsEmbeddedKey((sds)key)) dictSdsDestructor(privdata,key);
+}
+
 /* Db->dict, keys are sds strings, vals are Redis objects. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
-    dictSdsDestructor,          /* key destructor */
+    dbKeyDestructor,            /* key destructor */
     dictObjectDestructor   /* val destructor */
 };
 
@@ -63,7 +70,7 @@ dictType keyptrDictType = {
     NULL                        /* val destructor */
 };
 
-/* Hash type hash table (note that small hashes are represented with ziplists) */
+/* Hash type hash table (note that small hashes are represented with listpacks) */
 dictType hashDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -73,6 +80,34 @@ dictType hashDictType = {
     dictSdsDestructor           /* val destructor */
 };
 
+/* Same as above, for DBs of handles created with CACHE_HANDLE_FAST_HASH */
+dictType dbDictTypeFast = {
+    dictSdsFastHash,            /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dbKeyDestructor,            /* key destructor */
+    dictObjectDestructor   /* val destructor */
+};
+
+dictType keyptrDictTypeFast = {
+    dictSdsFastHash,            /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+dictType hashDictTypeFast = {
+    dictSdsFastHash,            /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictSdsDestructor           /* val destructor */
+};
+
 /* Generic hash table type where keys are Redis Objects, Values
  * dummy pointers. */
 dictType objectKeyPointerValueDictType = {
@@ -84,42 +119,421 @@ dictType objectKeyPointerValueDictType = {
     NULL                       /* val destructor */
 };
 
-redisDb* createRedisDb(void)
+/* Create a shard of 'handle', charged to an accounting owner of its own,
+ * child of the one of the handle. Returns NULL when all the owners are
+ * taken: the DB could not be budgeted. */
+redisDb* createRedisDb(cacheHandle *handle, int flags)
 {
-    redisDb *db = zcallocate(sizeof(*db));
-    if (NULL == db) return NULL;
+    int owner = zmalloc_owner_create(handle->owner);
+    int prev_owner, dict_flags;
+    redisDb *db;
+
+    if (owner == 0) return NULL;
+    prev_owner = zmalloc_set_owner(owner);
+    db = zcallocate(sizeof(*db));
+    if (NULL == db) {
+        zmalloc_set_owner(prev_owner);
+        zmalloc_owner_release(owner);
+        return NULL;
+    }
 
-    db->dict = dictCreate(&dbDictType, NULL);
-    db->expires = dictCreate(&keyptrDictType, NULL);
-    db->eviction_pool = evictionPoolAlloc();
+    db->fast_hash = (flags & CACHE_HANDLE_FAST_HASH) != 0;
+    db->thread_safe = (flags & CACHE_HANDLE_THREAD_SAFE) != 0;
+    dict_flags = (flags & CACHE_HANDLE_OPEN_ADDRESSING) ? DICT_OPEN_ADDRESSING : 0;
+    db->dict = dictCreateWithFlags(handle->key_type, NULL, dict_flags);
+    db->expires = dictCreateWithFlags(db->fast_hash ? &keyptrDictTypeFast : &keyptrDictType,
+                                      NULL, dict_flags);
+    db->eviction_pool = evictionPoolAlloc(EVPOOL_SIZE);
+    db->config = &g_db_config;
+    pthread_mutex_init(&db->lock, NULL);
+    db->owner = owner;
+    db->handle = handle;
+    db->empty_mem = dbUsedMemory(db);
+    zmalloc_set_owner(prev_owner);
     return db;
 }
 
 void closeRedisDb(redisDb *db)
 {
     if (db) {
+        int owner = db->owner;
+        int prev_owner;
+
+        /* Values of this DB may still be in the lazy free queue. */
+        lazyfreeWaitPendingObjects();
+        prev_owner = zmalloc_set_owner(owner);
         dictRelease(db->dict);
         dictRelease(db->expires);
         evictionPoolDestroy(db->eviction_pool);
-        zfree(db->eviction_pool);
+        tinyLfuRelease(db->tinylfu);
+        pthread_mutex_destroy(&db->lock);
         zfree(db);
+        zmalloc_set_owner(prev_owner);
+        zmalloc_owner_release(owner);
+    }
+}
+
+/* Create a cache handle made of 'shard_num' shards, rounded up to the next
+ * power of two. With CACHE_HANDLE_THREAD_SAFE every command locks the shard
+ * owning its key, so the handle can be shared by multiple threads. With
+ * CACHE_HANDLE_FAST_HASH the keys and the members of big values are hashed
+ * with dictSdsFastHash() instead of SipHash. Returns NULL when there are
+ * not enough zmalloc owners left for the shards. */
+cacheHandle *createCacheHandle(unsigned int shard_num, int flags)
+{
+    unsigned int i, n = 1;
+
+    if (shard_num > CACHE_MAX_SHARDS) shard_num = CACHE_MAX_SHARDS;
+    while (n < shard_num) n <<= 1;
+
+    cacheHandle *handle = zcallocate(sizeof(*handle));
+    if (NULL == handle) return NULL;
+
+    handle->owner = zmalloc_owner_create(0);
+    handle->shards = zcallocate(sizeof(redisDb*) * n);
+    handle->shard_num = n;
+    handle->shard_mask = n - 1;
+    handle->next_shard = 0;
+    handle->key_type = (flags & CACHE_HANDLE_FAST_HASH) ? &dbDictTypeFast : &dbDictType;
+    if (handle->owner == 0) {
+        closeCacheHandle(handle);
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        handle->shards[i] = createRedisDb(handle, flags);
+        if (NULL == handle->shards[i]) {
+            closeCacheHandle(handle);
+            return NULL;
+        }
+    }
+    return handle;
+}
+
+void closeCacheHandle(cacheHandle *handle)
+{
+    if (handle) {
+        unsigned int i;
+        for (i = 0; i < handle->shard_num; i++) {
+            closeRedisDb(handle->shards[i]);
+        }
+        zfree(handle->shards);
+        zmalloc_owner_release(handle->owner);
+        zfree(handle);
+    }
+}
+
+/* Return the shard at index 'idx', locked if the handle is thread safe.
+ * Until unlockShard() is called, the memory allocated by the calling thread
+ * is charged to the shard. */
+redisDb *lockShard(cacheHandle *handle, unsigned int idx)
+{
+    redisDb *db = handle->shards[idx & handle->shard_mask];
+    if (db->thread_safe) pthread_mutex_lock(&db->lock);
+    db->prev_owner = zmalloc_set_owner(db->owner);
+    db->prev_fast_hash = setValueFastHash(db->fast_hash);
+    db->locked_key = NULL;
+    return db;
+}
+
+/* Return the shard owning 'key', locked if the handle is thread safe.
+ * The shard is selected using the high bits of the key hash: the low bits
+ * are the ones used by the shard dict to select a bucket, and reusing them
+ * would leave most of the buckets of every shard empty. The hash function
+ * is the one of the keyspace of the shards, taken from the handle: the dict
+ * of another shard can be replaced and released at any time, see
+ * emptyDbAsync(). The hash is kept in the shard until it is unlocked, so
+ * that the command does not hash the key again, see dbKeyHash(). */
+redisDb *lockKeyShard(cacheHandle *handle, robj *key)
+{
+    uint64_t hash = handle->key_type->hashFunction(key->ptr);
+    redisDb *db = lockShard(handle, (unsigned int)(hash >> 32));
+
+    db->locked_key = key->ptr;
+    db->locked_key_hash = hash;
+    return db;
+}
+
+void unlockShard(redisDb *db)
+{
+    db->locked_key = NULL;
+    zmalloc_set_owner(db->prev_owner);
+    setValueFastHash(db->prev_fast_hash);
+    if (db->thread_safe) pthread_mutex_unlock(&db->lock);
+}
+
+/* Hash of 'key' in the keyspace and in the expires of 'db', which use the
+ * same hash function. Free if the shard was locked for this very key. */
+uint64_t dbKeyHash(redisDb *db, robj *key)
+{
+    if (key->ptr == db->locked_key) return db->locked_key_hash;
+    return dictGetHash(db->dict,key->ptr);
+}
+
+/* Memory charged to this DB: its keys, values and internal structures. */
+size_t dbUsedMemory(redisDb *db)
+{
+    return zmalloc_owner_used_memory(db->owner);
+}
+
+/* Memory charged to the shards of the handle, read in a single step from
+ * the owner all the shard owners charge as well. */
+size_t getCacheHandleUsedMemory(cacheHandle *handle)
+{
+    return zmalloc_owner_used_memory(handle->owner);
+}
+
+/* ----------------------------------------------------------------------------
+ * Batches of keys
+ * --------------------------------------------------------------------------*/
+
+/* Keys of a batch are hashed once, grouped by shard so that every shard is
+ * locked only once, and then looked up in chunks of KEY_BATCH_PREFETCH:
+ * the buckets of a whole chunk are prefetched before the first lookup of
+ * the chunk is performed. */
+#define KEY_BATCH_PREFETCH 16
+#define KEY_BATCH_STATIC 64
+
+static void prefetchKeyBuckets(redisDb *db, uint64_t *hashes, size_t *idx, size_t num)
+{
+    size_t j;
+
+    for (j = 0; j < num; j++) {
+        dictPrefetchBucket(db->dict, hashes[idx[j]]);
+        dictPrefetchBucket(db->expires, hashes[idx[j]]);
+    }
+    for (j = 0; j < num; j++) {
+        dictPrefetchEntry(db->dict, hashes[idx[j]]);
+        dictPrefetchEntry(db->expires, hashes[idx[j]]);
+    }
+}
+
+/* Call 'proc' for every key of the batch, with the shard of the key locked.
+ * Keys of the same shard are processed in the order they were given, so
+ * the same key appearing twice behaves as with two single key calls. */
+void processKeyBatch(cacheHandle *handle, robj **keys, size_t num,
+                     keyBatchProc *proc, void *privdata)
+{
+    uint64_t static_hashes[KEY_BATCH_STATIC];
+    size_t static_order[KEY_BATCH_STATIC];
+    uint64_t *hashes = static_hashes;
+    size_t *order = static_order;
+    size_t *start = NULL;
+    unsigned int shard, shard_num = handle->shard_num;
+    size_t j;
+
+    if (num > KEY_BATCH_STATIC) {
+        hashes = zmalloc(sizeof(uint64_t) * num);
+        order = zmalloc(sizeof(size_t) * num);
+    }
+    for (j = 0; j < num; j++) {
+        hashes[j] = handle->key_type->hashFunction(keys[j]->ptr);
+    }
+
+    /* Group the keys by shard with a counting sort, which is stable. After
+     * this start[shard] is where the keys of 'shard' begin in 'order'. */
+    if (shard_num == 1) {
+        for (j = 0; j < num; j++) order[j] = j;
+    } else {
+        start = zcallocate(sizeof(size_t) * (shard_num + 1));
+        for (j = 0; j < num; j++) start[((hashes[j] >> 32) & handle->shard_mask) + 1]++;
+        for (shard = 0; shard < shard_num; shard++) start[shard+1] += start[shard];
+        for (j = 0; j < num; j++) {
+            shard = (hashes[j] >> 32) & handle->shard_mask;
+            order[start[shard]++] = j;
+        }
+        /* start[shard] now points to the end of 'shard', shift back. */
+        for (shard = shard_num; shard > 0; shard--) start[shard] = start[shard-1];
+        start[0] = 0;
+    }
+
+    for (shard = 0; shard < shard_num; shard++) {
+        size_t first = start ? start[shard] : 0;
+        size_t last = start ? start[shard+1] : num;
+        redisDb *db;
+
+        if (first == last) continue;
+        db = lockShard(handle, shard);
+        for (j = first; j < last; j += KEY_BATCH_PREFETCH) {
+            size_t k, chunk = last - j;
+            if (chunk > KEY_BATCH_PREFETCH) chunk = KEY_BATCH_PREFETCH;
+
+            prefetchKeyBuckets(db, hashes, order+j, chunk);
+            for (k = j; k < j + chunk; k++) {
+                db->locked_key = keys[order[k]]->ptr;
+                db->locked_key_hash = hashes[order[k]];
+                proc(db, keys[order[k]], hashes[order[k]], order[k], privdata);
+            }
+        }
+        unlockShard(db);
+    }
+
+    if (start) zfree(start);
+    if (hashes != static_hashes) {
+        zfree(hashes);
+        zfree(order);
+    }
+}
+
+/* Give the handle its own configuration. Until this is called the shards
+ * follow the process wide configuration set by RcSetConfig(). */
+void setCacheHandleConfig(cacheHandle *handle, db_config *cfg)
+{
+    unsigned int i;
+
+    atomicSet(handle->config.maxmemory,cfg->maxmemory);
+    atomicSet(handle->config.maxmemory_policy,cfg->maxmemory_policy);
+    atomicSet(handle->config.maxmemory_samples,cfg->maxmemory_samples);
+    atomicSet(handle->config.maxmemory_eviction_pool,cfg->maxmemory_eviction_pool);
+    atomicSet(handle->config.lfu_decay_time,cfg->lfu_decay_time);
+    atomicSet(handle->config.evict_high_watermark,cfg->evict_high_watermark);
+    atomicSet(handle->config.evict_low_watermark,cfg->evict_low_watermark);
+    atomicSet(handle->config.lazyfree_lazy_eviction,cfg->lazyfree_lazy_eviction);
+    atomicSet(handle->config.lazyfree_lazy_expire,cfg->lazyfree_lazy_expire);
+    atomicSet(handle->config.lazyfree_lazy_server_del,cfg->lazyfree_lazy_server_del);
+    atomicSet(handle->config.active_expire_stale_perc,cfg->active_expire_stale_perc);
+    atomicSet(handle->config.zset_max_listpack_entries,cfg->zset_max_listpack_entries);
+    atomicSet(handle->config.zset_max_listpack_value,cfg->zset_max_listpack_value);
+    atomicSet(handle->config.hash_max_listpack_entries,cfg->hash_max_listpack_entries);
+    atomicSet(handle->config.hash_max_listpack_value,cfg->hash_max_listpack_value);
+    atomicSet(handle->config.set_max_intset_entries,cfg->set_max_intset_entries);
+    atomicSet(handle->config.list_max_listpack_size,cfg->list_max_listpack_size);
+    atomicSet(handle->config.list_compress_depth,cfg->list_compress_depth);
+    atomicSet(handle->config.list_compress_codec,cfg->list_compress_codec);
+    for (i = 0; i < handle->shard_num; i++) {
+        atomicSet(handle->shards[i]->config,&handle->config);
+    }
+}
+
+void setCacheHandleKeyEventProc(cacheHandle *handle, keyEventProc *proc, void *privdata)
+{
+    unsigned int i;
+
+    for (i = 0; i < handle->shard_num; i++) {
+        redisDb *db = lockShard(handle, i);
+        db->key_event_proc = proc;
+        db->key_event_privdata = privdata;
+        unlockShard(db);
+    }
+}
+
+/* Stats are kept per shard, so that threads working on different shards
+ * never write to the same cache line, and are only summed up here. */
+void getCacheHandleStats(cacheHandle *handle, db_status *stats)
+{
+    unsigned int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < handle->shard_num; i++) {
+        db_status *s = &handle->shards[i]->stats;
+        long long v;
+        atomicGet(s->stat_evictedkeys, v);
+        stats->stat_evictedkeys += v;
+        atomicGet(s->stat_expiredkeys, v);
+        stats->stat_expiredkeys += v;
+        atomicGet(s->stat_keyspace_hits, v);
+        stats->stat_keyspace_hits += v;
+        atomicGet(s->stat_keyspace_misses, v);
+        stats->stat_keyspace_misses += v;
+        atomicGet(s->stat_expire_cycle_time_used, v);
+        stats->stat_expire_cycle_time_used += v;
+        atomicGet(s->stat_expired_stale_keys, v);
+        stats->stat_expired_stale_keys += v;
+        atomicGet(s->stat_volatile_keys, v);
+        stats->stat_volatile_keys += v;
+    }
+    if (stats->stat_volatile_keys)
+        stats->stat_expired_stale_perc = (double)stats->stat_expired_stale_keys*100/
+                                         stats->stat_volatile_keys;
+}
+
+void resetCacheHandleHitAndMiss(cacheHandle *handle)
+{
+    unsigned int i;
+
+    for (i = 0; i < handle->shard_num; i++) {
+        db_status *s = &handle->shards[i]->stats;
+        atomicSet(s->stat_keyspace_hits, 0);
+        atomicSet(s->stat_keyspace_misses, 0);
     }
 }
 
 /* Update LFU when an object is accessed.
  * Firstly, decrement the counter if the decrement time is reached.
  * Then logarithmically increment the counter, and update the access time. */
-void updateLFU(robj *val) {
-    unsigned long counter = LFUDecrAndReturn(val);
+void updateLFU(redisDb *db, robj *val) {
+    unsigned long counter = LFUDecrAndReturn(val,db->config);
     counter = LFULogIncr(counter);
     val->lru = (LFUGetTimeInMinutes()<<8) | counter;
 }
 
-/* Low level key lookup API, not actually called directly from commands
- * implementations that should instead rely on lookupKeyRead(),
- * lookupKeyWrite() and lookupKeyReadWithFlags(). */
-robj *lookupKey(redisDb *db, robj *key, int flags) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+/* Count an access to the key with this hash in the W-TinyLFU sketch of the
+ * DB, and return the tick to store in the 'lru' field of its value. */
+static unsigned int tinyLfuAccess(redisDb *db, uint64_t hash) {
+    db->tinylfu = tinyLfuEnsureCapacity(db->tinylfu,dictSize(db->dict));
+    tinyLfuRecord(db->tinylfu,hash);
+    return db->tinylfu->tick;
+}
+
+/* The keyspace and the expires use the same hash function, so commands
+ * hash the key once and use the hash for all the lookups they perform. */
+static long long getExpireWithHash(redisDb *db, robj *key, uint64_t hash) {
+    dictEntry *de;
+
+    if (dictSize(db->expires) == 0 ||
+       (de = dictFindWithHash(db->expires,key->ptr,hash)) == NULL) return -1;
+
+    return dictGetSignedIntegerVal(de);
+}
+
+static int dbDeleteWithHash(redisDb *db, robj *key, uint64_t hash) {
+    /* Deleting an entry from the expires dict will not free the sds of
+     * the key, because it is shared with the main dictionary. */
+    if (dictSize(db->expires) > 0) dictDeleteWithHash(db->expires,key->ptr,hash);
+    return dictDeleteWithHash(db->dict,key->ptr,hash) == DICT_OK;
+}
+
+/* Tell the host about a key the cache is going to remove by itself. The
+ * key is passed as it is, so nothing is allocated per event. */
+static void notifyKeyEvent(redisDb *db, int event, sds key) {
+    if (db->key_event_proc)
+        db->key_event_proc(db->key_event_privdata,event,key,sdslen(key));
+}
+
+/* Delete a key found to be logically expired, freeing its value in
+ * background if lazyfree_lazy_expire is set. */
+static int dbDeleteExpiredWithHash(redisDb *db, robj *key, uint64_t hash) {
+    int lazy;
+
+    atomicIncr(db->stats.stat_expiredkeys, 1);
+    notifyKeyEvent(db,KEY_EVENT_EXPIRED,key->ptr);
+    atomicGet(db->config->lazyfree_lazy_expire, lazy);
+    return lazy ? dbAsyncDeleteWithHash(db,key,hash) :
+                  dbDeleteWithHash(db,key,hash);
+}
+
+/* Return the keyspace entry of 'key', or NULL if the key does not exist or
+ * is logically expired, in which case it is deleted. The expires are only
+ * probed when the key exists, and the bucket is prefetched before probing
+ * the keyspace so that the two cache misses overlap. */
+static dictEntry *dbFindWithHash(redisDb *db, robj *key, uint64_t hash) {
+    int has_volatile = dictSize(db->expires) != 0;
+    dictEntry *de;
+    mstime_t when;
+
+    if (has_volatile) dictPrefetchBucket(db->expires,hash);
+    de = dictFindWithHash(db->dict,key->ptr,hash);
+    if (de == NULL || !has_volatile) return de;
+
+    when = getExpireWithHash(db,key,hash);
+    if (when < 0 || mstime() <= when) return de;
+
+    dbDeleteExpiredWithHash(db,key,hash);
+    return NULL;
+}
+
+/* Update the access time of the value in the entry found by a lookup of
+ * the key with this hash, if any, and return it. */
+static robj *lookupKeyWithEntry(redisDb *db, dictEntry *de, uint64_t hash, int flags) {
     if (de) {
         robj *val = dictGetVal(de);
 
@@ -127,10 +541,12 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
          * Don't do it if we have a saving child, as this will trigger
          * a copy on write madness. */
         int maxmemory_policy;
-        atomicGet(g_db_config.maxmemory_policy, maxmemory_policy);
+        atomicGet(db->config->maxmemory_policy, maxmemory_policy);
         if (!(flags & LOOKUP_NOTOUCH)) {
             if (maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-                updateLFU(val);
+                updateLFU(db,val);
+            } else if (maxmemory_policy & MAXMEMORY_FLAG_TINYLFU) {
+                val->lru = tinyLfuAccess(db,hash);
             } else {
                 val->lru = LRU_CLOCK();
             }
@@ -141,6 +557,14 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
     }
 }
 
+/* Low level key lookup API, not actually called directly from commands
+ * implementations that should instead rely on lookupKeyRead(),
+ * lookupKeyWrite() and lookupKeyReadWithFlags(). */
+robj *lookupKey(redisDb *db, robj *key, int flags) {
+    uint64_t hash = dbKeyHash(db,key);
+    return lookupKeyWithEntry(db,dictFindWithHash(db->dict,key->ptr,hash),hash,flags);
+}
+
 /* Lookup a key for read operations, or return NULL if the key is not found
  * in the specified DB.
  *
@@ -162,16 +586,33 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
  * for read operations. Even if the key expiry is master-driven, we can
  * correctly report a key is expired on slaves even if the master is lagging
  * expiring our key via DELs in the replication link. */
-robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
-    expireIfNeeded(db,key);
-    robj *val = lookupKey(db,key,flags);
-    if (val == NULL)
-        atomicIncr(g_db_status.stat_keyspace_misses, 1);
-    else
-        atomicIncr(g_db_status.stat_keyspace_hits, 1);
+static robj *lookupKeyReadGeneric(redisDb *db, robj *key, uint64_t hash, int flags) {
+    robj *val = lookupKeyWithEntry(db,dbFindWithHash(db,key,hash),hash,flags);
+    if (val == NULL) {
+        int maxmemory_policy;
+
+        atomicIncr(db->stats.stat_keyspace_misses, 1);
+        /* W-TinyLFU counts the misses too, so that a key requested often
+         * is not evicted first once it is added back. */
+        atomicGet(db->config->maxmemory_policy, maxmemory_policy);
+        if (maxmemory_policy & MAXMEMORY_FLAG_TINYLFU && !(flags & LOOKUP_NOTOUCH))
+            tinyLfuAccess(db,hash);
+    } else {
+        atomicIncr(db->stats.stat_keyspace_hits, 1);
+    }
     return val;
 }
 
+robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
+    return lookupKeyReadGeneric(db,key,dbKeyHash(db,key),flags);
+}
+
+/* Like lookupKeyRead(), with the hash of the key already computed, as done
+ * by batches of keys. */
+robj *lookupKeyReadWithHash(redisDb *db, robj *key, uint64_t hash) {
+    return lookupKeyReadGeneric(db,key,hash,LOOKUP_NONE);
+}
+
 /* Like lookupKeyReadWithFlags(), but does not use any flag, which is the
  * common case. */
 robj *lookupKeyRead(redisDb *db, robj *key) {
@@ -184,8 +625,74 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
-    expireIfNeeded(db,key);
-    return lookupKey(db,key,LOOKUP_NONE);
+    uint64_t hash = dbKeyHash(db,key);
+    return lookupKeyWithEntry(db,dbFindWithHash(db,key,hash),hash,LOOKUP_NONE);
+}
+
+/* Objects are created with the process wide policy in mind, make sure
+ * the LRU field of a value added to the DB means what the policy of this
+ * DB expects. */
+static void initValueLRU(redisDb *db, robj *val) {
+    int maxmemory_policy;
+
+    atomicGet(db->config->maxmemory_policy, maxmemory_policy);
+    if (maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+        val->lru = (LFUGetTimeInMinutes()<<8) | LFU_INIT_VAL;
+    } else if (maxmemory_policy & MAXMEMORY_FLAG_TINYLFU) {
+        /* Adding the key is not counted as an access: usually the key was
+         * just looked up and missed, and that was already counted. */
+        db->tinylfu = tinyLfuEnsureCapacity(db->tinylfu,dictSize(db->dict));
+        val->lru = db->tinylfu->tick;
+    } else {
+        val->lru = LRU_CLOCK();
+    }
+}
+
+/* The key of a keyspace entry may be embedded in its value object, see
+ * createStringObjectWithKey(). When the entry 'de' gets the value 'val'
+ * it switches to the key embedded in 'val', or to a private copy of the
+ * key if the old value was holding it, and so does the expire entry that
+ * shares the key, found with the 'hash' of the key. Called before the old
+ * value is released. */
+static void updateEntryKey(redisDb *db, dictEntry *de, uint64_t hash, robj *val) {
+    sds key = dictGetKey(de), newkey = objectGetEmbeddedKey(val);
+    dictEntry *ede;
+
+    if (newkey == key) return;
+    if (newkey == NULL) {
+        if (!sdsIsEmbeddedKey(key)) return;
+        newkey = sdsdup(key);
+    }
+    if (dictSize(db->expires) > 0 &&
+        (ede = dictFindWithHash(db->expires,key,hash)) != NULL)
+        dictSetKey(db->expires,ede,newkey);
+    if (!sdsIsEmbeddedKey(key)) sdsfree(key);
+    dictSetKey(db->dict,de,newkey);
+}
+
+/* Replace the value of an existing keyspace entry, releasing the old one.
+ * With LFU the access frequency of the key is inherited by the new value,
+ * with W-TinyLFU the overwrite counts as an access of the key. */
+static void overwriteEntryValue(redisDb *db, dictEntry *de, uint64_t hash, robj *val) {
+    robj *old = dictGetVal(de);
+    int maxmemory_policy, lazy;
+
+    atomicGet(db->config->maxmemory_policy, maxmemory_policy);
+    if (maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+        val->lru = old->lru;
+        /* LFU should be not only copied but also updated
+         * when a key is overwritten. */
+        updateLFU(db,val);
+    } else if (maxmemory_policy & MAXMEMORY_FLAG_TINYLFU) {
+        val->lru = tinyLfuAccess(db,hash);
+    }
+    /* Set the new value before releasing the old one, they may be the
+     * same object. */
+    updateEntryKey(db,de,hash,val);
+    dictSetVal(db->dict, de, val);
+    atomicGet(db->config->lazyfree_lazy_server_del, lazy);
+    if (lazy) freeObjAsync(db,old);
+    else decrRefCount(old);
 }
 
 /* Add the key to the DB. It's up to the caller to increment the reference
@@ -193,8 +700,14 @@ robj *lookupKeyWrite(redisDb *db, robj *key) {
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    dictAdd(db->dict, copy, val);
+    sds copy = objectGetEmbeddedKey(val);
+    dictEntry *de;
+
+    if (copy == NULL) copy = sdsdup(key->ptr);
+
+    initValueLRU(db,val);
+    de = dictAddRawWithHash(db->dict, copy, dbKeyHash(db,key), NULL);
+    if (de) dictSetVal(db->dict, de, val);
  }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -203,21 +716,10 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    uint64_t hash = dbKeyHash(db,key);
+    dictEntry *de = dictFindWithHash(db->dict,key->ptr,hash);
 
-    int maxmemory_policy;
-    atomicGet(g_db_config.maxmemory_policy, maxmemory_policy);
-    if (maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-        robj *old = dictGetVal(de);
-        int saved_lru = old->lru;
-        dictReplace(db->dict, key->ptr, val);
-        val->lru = saved_lru;
-        /* LFU should be not only copied but also updated
-         * when a key is overwritten. */
-        updateLFU(val);
-    } else {
-        dictReplace(db->dict, key->ptr, val);
-    }
+    overwriteEntryValue(db,de,hash,val);
 }
 
 /* High level Set operation. This function can be used in order to set
@@ -229,17 +731,131 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
  *
  * All the new keys in the database should be craeted via this interface. */
 void setKey(redisDb *db, robj *key, robj *val) {
-    if (lookupKeyWrite(db,key) == NULL) {
-        dbAdd(db,key,val);
+    setKeyWithExpire(db,key,val,-1);
+}
+
+/* Like setKey(), but the key gets the expire 'when' (unix time in
+ * milliseconds) unless it is -1. The key is hashed once, and added or
+ * found with a single probe of the keyspace. An old value that is already
+ * logically expired is replaced as if the key did not exist. */
+void setKeyWithExpire(redisDb *db, robj *key, robj *val, long long when) {
+    uint64_t hash = dbKeyHash(db,key);
+    dictEntry *de, *existing;
+    long long old_when = -1;
+
+    incrRefCount(val);
+    /* The expire entry is only read here, and updated or deleted in place
+     * at the end: unlinking it would cost a copy of the entry with open
+     * addressing, and a new entry for the new expire. */
+    if (dictSize(db->expires) > 0) {
+        dictEntry *ede = dictFindWithHash(db->expires,key->ptr,hash);
+        if (ede) old_when = dictGetSignedIntegerVal(ede);
+    }
+
+    de = dictAddRawWithHash(db->dict,key->ptr,hash,&existing);
+    if (de) {
+        sds copy = objectGetEmbeddedKey(val);
+
+        dictSetKey(db->dict,de,copy ? copy : sdsdup(key->ptr));
+        initValueLRU(db,val);
+        dictSetVal(db->dict,de,val);
+    } else if (old_when >= 0 && mstime() > old_when) {
+        robj *old = dictGetVal(existing);
+        int lazy;
+
+        atomicIncr(db->stats.stat_expiredkeys, 1);
+        notifyKeyEvent(db,KEY_EVENT_EXPIRED,key->ptr);
+        initValueLRU(db,val);
+        updateEntryKey(db,existing,hash,val);
+        dictSetVal(db->dict,existing,val);
+        atomicGet(db->config->lazyfree_lazy_expire, lazy);
+        if (lazy) freeObjAsync(db,old);
+        else decrRefCount(old);
+        de = existing;
     } else {
-        dbOverwrite(db,key,val);
+        overwriteEntryValue(db,existing,hash,val);
+        de = existing;
+    }
+
+    if (when != -1) {
+        /* Reuse the sds from the main dict in the expire dict */
+        dictEntry *ede = dictAddRawWithHash(db->expires,dictGetKey(de),hash,&existing);
+        dictSetSignedIntegerVal(ede ? ede : existing,when);
+    } else if (old_when != -1) {
+        dictDeleteWithHash(db->expires,key->ptr,hash);
     }
-    incrRefCount(val);
-    removeExpire(db,key);
 }
 
 int dbExists(redisDb *db, robj *key) {
-    return dictFind(db->dict,key->ptr) != NULL;
+    return dictFindWithHash(db->dict,key->ptr,dbKeyHash(db,key)) != NULL;
+}
+
+/* Memory used by a key of the keyspace: its name, its value and its entry.
+ * Up to 'samples' elements of aggregate values are sampled, 0 means all. */
+static size_t dbEntryMemoryUsage(redisDb *db, dictEntry *de, size_t samples) {
+    robj *val = dictGetVal(de);
+    sds key = dictGetKey(de);
+    size_t usage;
+
+    if (samples == 0) samples = SIZE_MAX;
+    /* A key embedded in its value is not counted by objectComputeSize(),
+     * it has the same type 8 sds header of a separate one. */
+    usage = objectComputeSize(val,samples) + sdsAllocSize(key);
+    if (!dictIsOpenAddressing(db->dict)) usage += sizeof(dictEntry);
+    return usage;
+}
+
+/* Set '*bytes' to the memory used by the key, see dbEntryMemoryUsage().
+ * Return C_ERR if the key does not exist. */
+int dbMemoryUsage(redisDb *db, robj *key, size_t samples, size_t *bytes) {
+    dictEntry *de;
+
+    expireIfNeeded(db,key);
+    de = dictFindWithHash(db->dict,key->ptr,dbKeyHash(db,key));
+    if (de == NULL) return C_ERR;
+    *bytes = dbEntryMemoryUsage(db,de,samples);
+    return C_OK;
+}
+
+typedef struct bigKeyScanData {
+    redisDb *db;
+    size_t min_bytes;
+    size_t samples;
+    bigKeyProc *proc;
+    void *privdata;
+    unsigned long visited;
+} bigKeyScanData;
+
+static void bigKeyScanCallback(void *privdata, const dictEntry *de) {
+    bigKeyScanData *data = privdata;
+    size_t bytes = dbEntryMemoryUsage(data->db,(dictEntry*)de,data->samples);
+    sds key = dictGetKey(de);
+
+    data->visited++;
+    if (bytes >= data->min_bytes)
+        data->proc(data->privdata,key,sdslen(key),((robj*)dictGetVal(de))->type,bytes);
+}
+
+/* Scan the keyspace from 'cursor' until at least '*count' keys are visited
+ * or the scan is complete, calling 'proc' for the keys using 'min_bytes'
+ * or more. '*count' is set to the keys visited, and the cursor to continue
+ * from is returned, 0 once the whole keyspace was scanned. */
+unsigned long dbScanBigKeys(redisDb *db, unsigned long cursor, unsigned long *count,
+                            size_t min_bytes, size_t samples, bigKeyProc *proc,
+                            void *privdata) {
+    bigKeyScanData data;
+
+    data.db = db;
+    data.min_bytes = min_bytes;
+    data.samples = samples;
+    data.proc = proc;
+    data.privdata = privdata;
+    data.visited = 0;
+    do {
+        cursor = dictScan(db->dict,cursor,bigKeyScanCallback,NULL,&data);
+    } while (cursor != 0 && data.visited < *count);
+    *count = data.visited;
+    return cursor;
 }
 
 /* Return a random key, in form of a Redis object.
@@ -283,14 +899,7 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
-        return 1;
-    } else {
-        return 0;
-    }
+    return dbDeleteWithHash(db,key,dbKeyHash(db,key));
 }
 
 /* Remove all keys from all the databases in a Redis server.
@@ -313,14 +922,14 @@ long long emptyDb(redisDb *db, void(callback)(void*)) {
     removed += dictSize(db->dict);
     dictEmpty(db->dict,callback);
     dictEmpty(db->expires,callback);
-    atomicSet(g_db_status.stat_keyspace_hits, 0);
-    atomicSet(g_db_status.stat_keyspace_misses, 0);
+    atomicSet(db->stats.stat_keyspace_hits, 0);
+    atomicSet(db->stats.stat_keyspace_misses, 0);
 
     return removed;
 }
 
 int removeExpire(redisDb *db, robj *key) {
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    return dictDeleteWithHash(db->expires,key->ptr,dbKeyHash(db,key)) == DICT_OK;
 }
 
 /* Set an expire to the specified key. If the expire is set in the context
@@ -328,12 +937,13 @@ int removeExpire(redisDb *db, robj *key) {
  * to NULL. The 'when' parameter is the absolute unix time in milliseconds
  * after which the key will no longer be considered valid. */
 void setExpire(redisDb *db, robj *key, long long when) {
-    dictEntry *kde, *de;
+    uint64_t hash = dbKeyHash(db,key);
+    dictEntry *kde, *de, *existing;
 
     /* Reuse the sds from the main dict in the expire dict */
-    if (NULL != (kde = dictFind(db->dict,key->ptr))) {
-        de = dictAddOrFind(db->expires,dictGetKey(kde));
-        dictSetSignedIntegerVal(de,when); 
+    if (NULL != (kde = dictFindWithHash(db->dict,key->ptr,hash))) {
+        de = dictAddRawWithHash(db->expires,dictGetKey(kde),hash,&existing);
+        dictSetSignedIntegerVal(de ? de : existing,when);
     }
 }
 
@@ -357,8 +967,13 @@ void setExpire(redisDb *db, robj *key, long long when) {
  * The return value of the function is 0 if the key is still valid,
  * otherwise the function returns 1 if the key is expired. */
 int expireIfNeeded(redisDb *db, robj *key) {
-    
-    mstime_t when = getExpire(db,key);
+    uint64_t hash;
+
+    /* No expire? return ASAP */
+    if (dictSize(db->expires) == 0) return 0;
+
+    hash = dbKeyHash(db,key);
+    mstime_t when = getExpireWithHash(db,key,hash);
     if (when < 0) return 0; /* No expire for this key */
 
     /* Return when this key has not expired */
@@ -366,213 +981,375 @@ int expireIfNeeded(redisDb *db, robj *key) {
     if (now <= when) return 0;
 
     /* Delete the key */
-    atomicIncr(g_db_status.stat_expiredkeys, 1);
-    return dbDelete(db,key);
+    return dbDeleteExpiredWithHash(db,key,hash);
 }
 
 /* Return the expire time of the specified key, or -1 if no expire
  * is associated with this key (i.e. the key is non volatile) */
 long long getExpire(redisDb *db, robj *key) {
-    dictEntry *de;
-
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
+    if (dictSize(db->expires) == 0) return -1;
 
-    return dictGetSignedIntegerVal(de);
+    return getExpireWithHash(db,key,dbKeyHash(db,key));
 }
 
 /* ----------------------------------------------------------------------------
  * The external API for eviction: freeMemroyIfNeeded() is called by the
  * server when there is data to add in order to make space if needed.
  * --------------------------------------------------------------------------*/
+/* Memory used by the DB as far as the eviction is concerned: the values
+ * queued for the lazy free thread are as good as already freed. */
+static size_t evictionUsedMemory(redisDb *db) {
+    size_t used = dbUsedMemory(db), pending;
+
+    atomicGet(db->lazyfree_pending_mem, pending);
+    return used > pending ? used-pending : 0;
+}
+
+/* Same as evictionUsedMemory() for the whole handle 'db' is a shard of,
+ * the one compared against maxmemory. */
+static size_t handleEvictionUsedMemory(redisDb *db) {
+    size_t used = getCacheHandleUsedMemory(db->handle), pending;
+
+    atomicGet(db->handle->lazyfree_pending_mem, pending);
+    return used > pending ? used-pending : 0;
+}
+
+/* Evict the best key of the DB according to 'maxmemory_policy', storing
+ * in '*freed' the memory released. With 'lazy' a big value is freed by the
+ * lazy free thread, '*freed' accounting its estimated size. Returns C_ERR
+ * if there is no key that the policy allows to evict. */
+static int evictOneKey(redisDb *db, int maxmemory_policy, int lazy, long long *freed) {
+    sds bestkey = NULL;
+    dict *dict;
+    dictEntry *de;
+    robj *keyobj;
+    long long delta;
+
+    if (maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_TINYLFU) ||
+        maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
+    {
+        int pool_size;
+
+        atomicGet(db->config->maxmemory_eviction_pool, pool_size);
+        if (pool_size <= 0) pool_size = EVPOOL_SIZE;
+        if (pool_size > EVPOOL_MAX_SIZE) pool_size = EVPOOL_MAX_SIZE;
+        if (pool_size != db->eviction_pool->size) {
+            size_t used = dbUsedMemory(db), pending;
+
+            evictionPoolDestroy(db->eviction_pool);
+            db->eviction_pool = evictionPoolAlloc(pool_size);
+            /* The pool is part of the memory of an empty DB. The delta is
+             * only exact if the lazy free thread is not freeing for us. */
+            atomicGet(db->lazyfree_pending_mem, pending);
+            if (pending == 0) db->empty_mem += dbUsedMemory(db) - used;
+        }
+
+        /* We don't want to make local-db choices when expiring keys,
+         * so to start populate the eviction pool sampling keys from
+         * every DB. */
+        dict = (maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                db->dict : db->expires;
+        if (maxmemory_policy & MAXMEMORY_FLAG_TINYLFU)
+            db->tinylfu = tinyLfuEnsureCapacity(db->tinylfu,dictSize(db->dict));
+        while(bestkey == NULL && dictSize(dict) != 0) {
+            evictionPool *pool = db->eviction_pool;
+
+            /* Sample again once the pool served the evictions it was
+             * populated for, or it only had ghosts left. */
+            if (pool->credit <= 0 || pool->used == 0)
+                evictionPoolPopulate(dict, db->dict, pool, db->config, db->tinylfu);
+
+            /* If the best key exists, is our pick. Otherwise it is a
+             * ghost and we need to try the next element. */
+            de = evictionPoolPopBest(pool, dict, db->dict, db->config, db->tinylfu);
+            if (de) bestkey = dictGetKey(de);
+        }
+    }
+
+    /* volatile-random and allkeys-random policy */
+    else if (maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
+             maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
+    {
+        /* When evicting a random key, we try to evict a key for
+         * each DB, so we use the static 'next_db' variable to
+         * incrementally visit all DBs. */
+        dict = (maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
+                db->dict : db->expires;
+        if (dictSize(dict) != 0) {
+            de = dictGetRandomKey(dict);
+            bestkey = dictGetKey(de);
+        }
+    }
+
+    /* Finally remove the selected key. */
+    if (bestkey == NULL) return C_ERR;
+    notifyKeyEvent(db,KEY_EVENT_EVICTED,bestkey);
+    keyobj = createStringObject(bestkey,sdslen(bestkey));
+    delta = (long long) evictionUsedMemory(db);
+    if (lazy) dbAsyncDelete(db,keyobj);
+    else dbDelete(db,keyobj);
+    delta -= (long long) evictionUsedMemory(db);
+    *freed = delta;
+
+    atomicIncr(db->stats.stat_evictedkeys, 1);
+    decrRefCount(keyobj);
+    return C_OK;
+}
+
 int freeMemoryIfNeeded(redisDb *db) {
     size_t mem_used, mem_tofree, mem_freed;
     long long delta;
     unsigned long long maxmemory;
-    int maxmemory_policy;
+    int maxmemory_policy, lazy;
 
     /* Check if we are over the memory usage limit. If we are not, no need
-     * to subtract the slaves output buffers. We can just return ASAP. */
-    atomicGet(g_db_config.maxmemory, maxmemory);
-    mem_used = zmalloc_used_memory();
+     * to subtract the slaves output buffers. We can just return ASAP.
+     * The memory of the whole handle is checked against its maxmemory, so
+     * that other handles never cause evictions here, and a shard holding
+     * more than its share of the keys is not limited to 1/N of the budget.
+     * The excess is freed from this shard, the one being written. */
+    atomicGet(db->config->maxmemory, maxmemory);
+    mem_used = handleEvictionUsedMemory(db);
     if (mem_used <= maxmemory) return C_OK;
 
     /* Compute how much memory we need to free. */
     mem_tofree = mem_used - maxmemory;
     mem_freed = 0;
 
-    atomicGet(g_db_config.maxmemory_policy, maxmemory_policy);
+    atomicGet(db->config->maxmemory_policy, maxmemory_policy);
     if (maxmemory_policy == MAXMEMORY_NO_EVICTION) return C_ERR;
 
+    atomicGet(db->config->lazyfree_lazy_eviction, lazy);
     while (mem_freed < mem_tofree) {
-        int k, keys_freed = 0;
-        sds bestkey = NULL;
-        dict *dict;
-        dictEntry *de;
-
-        if (maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
-            maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
-        {
-            struct evictionPoolEntry *pool = db->eviction_pool;
-
-            while(bestkey == NULL) {
-                unsigned long keys = 0;
-
-                /* We don't want to make local-db choices when expiring keys,
-                 * so to start populate the eviction pool sampling keys from
-                 * every DB. */
-                dict = (maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
-                        db->dict : db->expires;
-                if ((keys = dictSize(dict)) != 0) {
-                    evictionPoolPopulate(dict, db->dict, pool);
-                }
-                if (!keys) break; /* No keys to evict. */
-
-                /* Go backward from best to worst element to evict. */
-                for (k = EVPOOL_SIZE-1; k >= 0; k--) {
-                    if (pool[k].key == NULL) continue;
-
-                    if (maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(db->dict, pool[k].key);
-                    } else {
-                        de = dictFind(db->expires, pool[k].key);
-                    }
-
-                    /* Remove the entry from the pool. */
-                    if (pool[k].key != pool[k].cached)
-                        sdsfree(pool[k].key);
-                    pool[k].key = NULL;
-                    pool[k].idle = 0;
-
-                    /* If the key exists, is our pick. Otherwise it is
-                     * a ghost and we need to try the next element. */
-                    if (de) {
-                        bestkey = dictGetKey(de);
-                        break;
-                    } else {
-                        /* Ghost... Iterate again. */
-                    }
-                }
-            }
-        }
-
-        /* volatile-random and allkeys-random policy */
-        else if (maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
-                 maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
-        {
-            /* When evicting a random key, we try to evict a key for
-             * each DB, so we use the static 'next_db' variable to
-             * incrementally visit all DBs. */
-            dict = (maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
-                    db->dict : db->expires;
-            if (dictSize(dict) != 0) {
-                de = dictGetRandomKey(dict);
-                bestkey = dictGetKey(de);
-            }
-        }
+        if (evictOneKey(db,maxmemory_policy,lazy,&delta) == C_ERR) return C_ERR;
+        mem_freed += delta;
+    }
 
-        /* Finally remove the selected key. */
-        if (bestkey) {
-            robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-            delta = (long long) zmalloc_used_memory();
-            dbDelete(db,keyobj);
-            delta -= (long long) zmalloc_used_memory();
-            mem_freed += delta;
-
-            g_db_status.stat_evictedkeys++;
-            decrRefCount(keyobj);
-            keys_freed++;
-        }
+    return C_OK;
+}
 
-        if (!keys_freed) return C_ERR;
+/* Eviction ahead of demand, see RcEvictStep(). Once the memory used by the
+ * handle goes over the high watermark, keys are evicted until it is back
+ * under the low watermark, for at most 'budget_us' microseconds per call,
+ * so that freeMemoryIfNeeded() is rarely left any work to do. Every shard
+ * gives back its share of the distance to the low watermark, proportional
+ * to the memory it uses. Returns the number of keys evicted. */
+int evictionStep(redisDb *db, long long budget_us) {
+    unsigned long long maxmemory;
+    size_t handle_used, mem_used, target, high, low;
+    int maxmemory_policy, high_pct, low_pct, evicting, evicted = 0;
+    long long deadline, delta;
+
+    atomicGet(db->config->maxmemory, maxmemory);
+    atomicGet(db->config->maxmemory_policy, maxmemory_policy);
+    atomicGet(db->config->evict_high_watermark, high_pct);
+    atomicGet(db->config->evict_low_watermark, low_pct);
+    if (maxmemory_policy == MAXMEMORY_NO_EVICTION) return 0;
+    if (high_pct <= 0 || high_pct > 100)
+        high_pct = CONFIG_DEFAULT_EVICT_HIGH_WATERMARK;
+    if (low_pct <= 0 || low_pct > high_pct)
+        low_pct = high_pct < CONFIG_DEFAULT_EVICT_LOW_WATERMARK ?
+                  high_pct : CONFIG_DEFAULT_EVICT_LOW_WATERMARK;
+    high = maxmemory/100*high_pct;
+    low = maxmemory/100*low_pct;
+
+    handle_used = handleEvictionUsedMemory(db);
+    atomicGet(db->handle->evicting, evicting);
+    if (handle_used <= low) {
+        if (evicting) atomicSet(db->handle->evicting, 0);
+        return 0;
+    }
+    if (!evicting) {
+        if (handle_used <= high) return 0;
+        atomicSet(db->handle->evicting, 1);
     }
 
-    return C_OK;
+    mem_used = evictionUsedMemory(db);
+    target = mem_used-(size_t)((double)mem_used*(handle_used-low)/handle_used);
+
+    /* The values are always freed synchronously here: this already runs
+     * outside of the commands, and the thread would only delay the drop
+     * of the memory used below the low watermark. */
+    deadline = ustime()+budget_us;
+    while (mem_used > target) {
+        if (evictOneKey(db,maxmemory_policy,0,&delta) == C_ERR) break;
+        mem_used = evictionUsedMemory(db);
+        /* Out of time, the next call goes on from here. The time is only
+         * checked every few keys, it costs as much as an eviction. */
+        if ((++evicted & 15) == 0 && ustime() >= deadline) return evicted;
+    }
+    return evicted;
 }
 
-/* Helper function for the activeExpireCycle() function.
- * This function will try to expire the key that is stored in the hash table
- * entry 'de' of the 'expires' hash table of a Redis database.
- *
- * activeExpireCycle() 函数使用的检查键是否过期的辅佐函数。
- *
- * If the key is found to be expired, it is removed from the database and
- * 1 is returned. Otherwise no operation is performed and 0 is returned.
- *
- * 如果 de 中的键已经过期，那么移除它，并返回 1 ，否则不做动作，并返回 0 。
- *
- * When a key is expired, server.stat_expiredkeys is incremented.
- *
- * The parameter 'now' is the current time in milliseconds as is passed
- * to the function to avoid too many gettimeofday() syscalls.
- *
- * 参数 now 是毫秒格式的当前时间
- */
-static int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
-    // 获取键的过期时间
-    long long t = dictGetSignedIntegerVal(de);
-    if (now > t) {
+typedef struct expireScanData {
+    long long now;          /* mstime() of the loop */
+    int sampled;            /* Volatile keys visited */
+    int found;              /* Expired keys copied to 'keys' */
+    robj *keys[ACTIVE_EXPIRE_CYCLE_KEYS_PER_LOOP*2];
+} expireScanData;
+
+/* Keys can't be deleted while dictScan() visits their bucket, so the
+ * expired ones are copied and deleted after the scan step. The rare keys
+ * not fitting in 'keys' are found by the next pass. */
+static void expireScanCallback(void *privdata, const dictEntry *de)
+{
+    expireScanData *data = privdata;
 
-        // 键已过期
+    data->sampled++;
+    if (data->now > dictGetSignedIntegerVal(de) &&
+        data->found < ACTIVE_EXPIRE_CYCLE_KEYS_PER_LOOP*2)
+    {
         sds key = dictGetKey(de);
-        robj *keyobj = createStringObject(key,sdslen(key));
-
-        // 从数据库中删除该键
-        dbDelete(db,keyobj);
-        decrRefCount(keyobj);
-        // 更新计数器
-        atomicIncr(g_db_status.stat_expiredkeys, 1);
-        return 1;
-    } else {
-        return 0;
+        data->keys[data->found++] = createStringObject(key,sdslen(key));
     }
 }
 
-int activeExpireCycle(redisDb *db)
+/* Scan the volatile keys ACTIVE_EXPIRE_CYCLE_KEYS_PER_LOOP at a time and
+ * delete the expired ones, as long as more than active_expire_stale_perc
+ * percent of the keys of the last loop were expired and there is time left
+ * in the budget. The scan goes on from where the previous call stopped, so
+ * the keys ahead of the cursor were not checked for a whole pass: the share
+ * of expired keys found there, a moving average over the last keys sampled,
+ * estimates the stale keys of the DB published in the stats.
+ * Returns the number of keys expired. */
+int activeExpireCycle(redisDb *db, long long budget_us)
 {
-    static int type = ACTIVE_EXPIRE_CYCLE_SLOW;
-
-    unsigned long num, slots;
+    expireScanData data;
+    unsigned long num, buckets;
+    int stale_perc, expired = 0, sampled = 0, loop_expired, j;
+    long long start, deadline;
+
+    atomicGet(db->config->active_expire_stale_perc, stale_perc);
+    if (stale_perc <= 0 || stale_perc > 100)
+        stale_perc = CONFIG_DEFAULT_ACTIVE_EXPIRE_STALE_PERC;
+    start = ustime();
+    deadline = start + budget_us;
+    do {
+        // If there is nothing to expire
+        if (dictSize(db->expires) == 0) break;
+
+        data.now = mstime();
+        data.sampled = data.found = 0;
+        buckets = 0;
+        /* The expires are never shrunk, so after a mass expire or delete
+         * the table is mostly empty buckets: they are bounded as well, and
+         * the time is checked every few ones. */
+        do {
+            db->expires_cursor = dictScan(db->expires, db->expires_cursor,
+                                          expireScanCallback, NULL, &data);
+            if ((++buckets & 15) == 0 && ustime() >= deadline) break;
+        } while (db->expires_cursor != 0 &&
+                 data.sampled < ACTIVE_EXPIRE_CYCLE_KEYS_PER_LOOP &&
+                 buckets < ACTIVE_EXPIRE_CYCLE_MAX_BUCKETS);
+
+        loop_expired = data.found;
+        if (db->expires_cursor == 0) {
+            db->expires_pass_kept = db->expires_pass_sampled = 0;
+        } else {
+            db->expires_pass_kept += data.sampled - data.found;
+            db->expires_pass_sampled += data.sampled;
+        }
+        for (j = 0; j < data.found; j++) {
+            dbDeleteExpiredWithHash(db,data.keys[j],
+                                    dictGetHash(db->dict,data.keys[j]->ptr));
+            decrRefCount(data.keys[j]);
+        }
+        expired += loop_expired;
+        sampled += data.sampled;
+    } while (loop_expired*100 > data.sampled*stale_perc && ustime() < deadline);
+
+    /* Every key sampled weights 1/ACTIVE_EXPIRE_CYCLE_STALE_WINDOW, so the
+     * estimate follows the data quickly when there is a lot to expire, and
+     * is not thrown off by the few keys sampled by the idle cycles. At the
+     * start of a pass only the keys of the new pass count. */
+    if (sampled) {
+        unsigned long window = db->expires_pass_sampled;
+        double weight;
+
+        if (window > ACTIVE_EXPIRE_CYCLE_STALE_WINDOW)
+            window = ACTIVE_EXPIRE_CYCLE_STALE_WINDOW;
+        weight = (unsigned long)sampled >= window ? 1 : (double)sampled/window;
+        db->expire_stale_perc = (double)expired*100/sampled*weight +
+                                db->expire_stale_perc*(1-weight);
+    }
+    /* Only the keys ahead of the cursor can be expired. */
+    num = dictSize(db->expires);
+    atomicSet(db->stats.stat_volatile_keys, (long long)num);
+    num = num > db->expires_pass_kept ? num - db->expires_pass_kept : 0;
+    atomicSet(db->stats.stat_expired_stale_keys,
+              (long long)(num*db->expire_stale_perc/100));
+    atomicIncr(db->stats.stat_expire_cycle_time_used, ustime()-start);
+    return expired;
+}
 
-    // If there is nothing to expire
-    if (0 == (num = dictSize(db->expires))) return 0;
+/* ----------------------------------------------------------------------------
+ * Incremental rehashing
+ * --------------------------------------------------------------------------*/
 
-    /* When there are less than 1% filled slots getting random
-     * keys is expensive, so stop here waiting for better times...
-     * The dictionary will be resized asap. */
-    slots = dictSlots(db->expires);
-    if (num && slots > DICT_HT_INITIAL_SIZE && (num*100/slots < 1)) return 0;
+typedef struct rehashScanData {
+    long long deadline;     /* ustime() at which we must stop */
+    int rehashes;           /* Buckets moved so far */
+} rehashScanData;
 
-    if (ACTIVE_EXPIRE_CYCLE_SLOW == type) {
-        num = (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP) ? ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP : num;
-    }
-    else {
-        num = (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP * 2) ? ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP * 2 : num;
-    }
+/* Return the hash table used by the value 'o', or NULL if the value is not
+ * encoded as a hash table. */
+static dict *objectGetDict(robj *o)
+{
+    if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) return o->ptr;
+    if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_HT) return o->ptr;
+    if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST)
+        return ((zset*)o->ptr)->dict;
+    return NULL;
+}
 
-    int expired = 0;
-    long long now = mstime();
-    while (num--) {
-        dictEntry *de;
+static void rehashScanCallback(void *privdata, const dictEntry *de)
+{
+    rehashScanData *data = privdata;
+    dict *d = objectGetDict(dictGetVal(de));
+    long long now;
+
+    if (d == NULL || !dictIsRehashing(d)) return;
+    now = ustime();
+    if (now >= data->deadline) return;
+    data->rehashes += dictRehashMicroseconds(d, data->deadline-now);
+}
 
-        // 从 expires 中随机取出一个带过期时间的键
-        if ((de = dictGetRandomKey(db->expires)) == NULL) break;
+/* Move buckets of the tables being resized to their new table for at most
+ * 'budget_us' microseconds, so that resizes don't have to be completed by
+ * the commands, one step at a time. The keyspace and the expires come
+ * first, then the remaining time is used to scan the keyspace looking for
+ * hash, set and sorted set values in the middle of a rehashing. The scan
+ * goes on from where the previous call stopped.
+ *
+ * Returns the number of buckets moved (as dictRehashMilliseconds()). */
+int incrementallyRehash(redisDb *db, long long budget_us)
+{
+    rehashScanData data;
+    long long now = ustime();
+    int steps = 0;
 
-        // 如果键已经过期，那么删除它，并将 expired 计数器增一
-        if (activeExpireCycleTryExpire(db,de,now)) expired++;
-    }
+    data.deadline = now + budget_us;
+    data.rehashes = 0;
 
-    // 如果已删除的过期键占当前总数据库带过期时间的键数量的 25 %
-    // 則下次執行快速淘汰
-    if (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4) {
-        type = ACTIVE_EXPIRE_CYCLE_FAST;
+    if (dictIsRehashing(db->dict)) {
+        data.rehashes += dictRehashMicroseconds(db->dict, data.deadline-now);
+        now = ustime();
     }
-    else {
-        type = ACTIVE_EXPIRE_CYCLE_SLOW;
+    if (dictIsRehashing(db->expires) && now < data.deadline) {
+        data.rehashes += dictRehashMicroseconds(db->expires, data.deadline-now);
+        now = ustime();
     }
 
-    return expired;
+    /* Checking the time at every bucket would cost more than the scan
+     * itself, so it is only checked every few buckets. */
+    while (now < data.deadline && dictSize(db->dict)) {
+        db->rehash_cursor = dictScan(db->dict, db->rehash_cursor,
+                                     rehashScanCallback, NULL, &data);
+        if (db->rehash_cursor == 0) break;
+        if ((++steps & 15) == 0) now = ustime();
+    }
+    return data.rehashes;
 }
 
 /* Prepare the string object stored at 'key' to be modified destructively
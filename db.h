@@ -1,6 +1,8 @@
 #ifndef __DB_H__
 #define __DB_H__
 
+#include <pthread.h>
+
 #include "object.h"
 #include "dict.h"
 #include "evict.h"
@@ -16,19 +18,79 @@ extern "C" {
 typedef struct redisDb {
     dict *dict;                                 /* The keyspace for this DB */
     dict *expires;                              /* Timeout of keys with a timeout set */
-    struct evictionPoolEntry *eviction_pool;    /* Eviction pool of keys */
+    evictionPool *eviction_pool;                /* Eviction pool of keys */
+    tinyLfu *tinylfu;                           /* Access frequency sketch, or NULL */
+    db_config *config;                          /* Handle config, or the global one */
+    db_status stats;                            /* Stats of this DB only */
+    int thread_safe;                            /* Take 'lock' around every command */
+    pthread_mutex_t lock;                       /* Serializes commands on this DB */
+    int owner;                                  /* zmalloc owner charged for this DB */
+    int prev_owner;                             /* Owner to restore on unlock */
+    sds locked_key;                             /* Key the shard was locked for, or NULL */
+    uint64_t locked_key_hash;                   /* Hash of 'locked_key', see dbKeyHash() */
+    struct cacheHandle *handle;                 /* Handle this DB is a shard of */
+    unsigned long rehash_cursor;                /* Values scan cursor of incrementallyRehash() */
+    unsigned long expires_cursor;               /* Expires scan cursor of activeExpireCycle() */
+    unsigned long expires_pass_kept;            /* Keys not expired in this scan pass */
+    unsigned long expires_pass_sampled;         /* Keys visited in this scan pass */
+    double expire_stale_perc;                   /* Estimated % of expired keys ahead */
+    int fast_hash;                              /* Use dictSdsFastHash() for keys and values */
+    int prev_fast_hash;                         /* setValueFastHash() to restore on unlock */
+    size_t lazyfree_pending_mem;                /* Size of the values in the lazy free queue */
+    size_t empty_mem;                           /* dbUsedMemory() with no keys */
+    keyEventProc *key_event_proc;               /* Evicted and expired keys callback */
+    void *key_event_privdata;
 } redisDb;
 
-redisDb* createRedisDb(void);
+/* The object behind a redisCache handle. Keys are spread over 'shard_num'
+ * independent redisDb shards by the high bits of their hash, so that threads
+ * working on different keys only contend when they hit the same shard.
+ * A handle with a single shard and no locking behaves exactly like a plain
+ * redisDb, the caller being in charge of synchronization. */
+#define CACHE_MAX_SHARDS 1024
+typedef struct cacheHandle {
+    redisDb **shards;                           /* Array of 'shard_num' shards */
+    unsigned int shard_num;                     /* Always a power of two */
+    unsigned int shard_mask;                    /* shard_num-1 */
+    unsigned int next_shard;                    /* Round robin cursor for handle wide jobs */
+    dictType *key_type;                         /* Type of the shard keyspaces, hashes the keys */
+    int owner;                                  /* zmalloc owner, parent of the shard owners */
+    int evicting;                               /* evictionStep() going to the low watermark */
+    size_t lazyfree_pending_mem;                /* Sum of the shards lazyfree_pending_mem */
+    db_config config;                           /* Set by RcSetHandleConfig() */
+} cacheHandle;
+
+redisDb* createRedisDb(cacheHandle *handle, int flags);
 void closeRedisDb(redisDb *db);
+cacheHandle *createCacheHandle(unsigned int shard_num, int flags);
+void closeCacheHandle(cacheHandle *handle);
+void setCacheHandleConfig(cacheHandle *handle, db_config *cfg);
+void setCacheHandleKeyEventProc(cacheHandle *handle, keyEventProc *proc, void *privdata);
+void getCacheHandleStats(cacheHandle *handle, db_status *stats);
+void resetCacheHandleHitAndMiss(cacheHandle *handle);
+redisDb *lockKeyShard(cacheHandle *handle, robj *key);
+redisDb *lockShard(cacheHandle *handle, unsigned int idx);
+void unlockShard(redisDb *db);
+typedef void keyBatchProc(redisDb *db, robj *key, uint64_t hash, size_t idx, void *privdata);
+void processKeyBatch(cacheHandle *handle, robj **keys, size_t num,
+                     keyBatchProc *proc, void *privdata);
+size_t getCacheHandleUsedMemory(cacheHandle *handle);
+size_t dbUsedMemory(redisDb *db);
+uint64_t dbKeyHash(redisDb *db, robj *key);
 robj *lookupKey(redisDb *db, robj *key, int flags);
 robj *lookupKeyRead(redisDb *db, robj *key);
+robj *lookupKeyReadWithHash(redisDb *db, robj *key, uint64_t hash);
 robj *lookupKeyWrite(redisDb *db, robj *key);
 void dbAdd(redisDb *db, robj *key, robj *val);
 void dbOverwrite(redisDb *db, robj *key, robj *val);
 void setKey(redisDb *db, robj *key, robj *val);
+void setKeyWithExpire(redisDb *db, robj *key, robj *val, long long when);
 int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
+int dbMemoryUsage(redisDb *db, robj *key, size_t samples, size_t *bytes);
+unsigned long dbScanBigKeys(redisDb *db, unsigned long cursor, unsigned long *count,
+                            size_t min_bytes, size_t samples, bigKeyProc *proc,
+                            void *privdata);
 int dbDelete(redisDb *db, robj *key);
 long long emptyDb(redisDb *db, void(callback)(void*));
 int removeExpire(redisDb *db, robj *key);
@@ -36,7 +98,9 @@ void setExpire(redisDb *db, robj *key, long long when);
 long long getExpire(redisDb *db, robj *key);
 int expireIfNeeded(redisDb *db, robj *key);
 int freeMemoryIfNeeded(redisDb *db);
-int activeExpireCycle(redisDb *db);
+int evictionStep(redisDb *db, long long budget_us);
+int activeExpireCycle(redisDb *db, long long budget_us);
+int incrementallyRehash(redisDb *db, long long budget_us);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
 
 #ifdef _cplusplus
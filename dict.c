@@ -3,7 +3,8 @@
  * This file implements in memory hash tables with insert/del/replace/find/
  * get-random-element operations. Hash tables will auto resize if needed
  * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * chaining, or by open addressing for dicts created with the
+ * DICT_OPEN_ADDRESSING flag. See the source code for more information... :)
  *
  * Copyright (c) 2006-2012, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -43,6 +44,10 @@
 #include <limits.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <stddef.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "dict.h"
 #include "zmalloc.h"
@@ -69,6 +74,17 @@ static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
 static long _dictKeyIndex(dict *ht, const void *key, uint64_t hash, dictEntry **existing);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
+static int _dictOaExpand(dict *d, unsigned long size, int same_size);
+static int _dictOaRehash(dict *d, int n);
+static dictEntry *_dictOaFind(dict *d, const void *key, uint64_t hash, int *table);
+static dictEntry *_dictOaAddRaw(dict *d, void *key, uint64_t hash, dictEntry **existing);
+static dictEntry *_dictOaGenericDelete(dict *d, const void *key, uint64_t hash, int nofree);
+static void _dictOaClear(dict *d, dictht *ht, void(callback)(void *));
+static void _dictOaPrefetch(dictht *ht, uint64_t hash, int entry);
+static dictEntry *_dictOaNext(dictIterator *iter);
+static dictEntry *_dictOaGetRandomKey(dict *d);
+static unsigned int _dictOaGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
+static unsigned long _dictOaScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);
 
 /* -------------------------- hash functions -------------------------------- */
 
@@ -96,6 +112,13 @@ uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len) {
     return siphash_nocase(buf,len,dict_hash_function_seed);
 }
 
+/* Much faster but not resistant to hash flooding, see fasthash.c. */
+uint64_t fasthash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+
+uint64_t dictGenFastHashFunction(const void *key, int len) {
+    return fasthash(key,len,dict_hash_function_seed);
+}
+
 /* ----------------------------- API implementation ------------------------- */
 
 /* Reset a hash table already initialized with ht_init().
@@ -106,6 +129,8 @@ static void _dictReset(dictht *ht)
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
+    ht->ctrl = NULL;
+    ht->tombstones = 0;
 }
 
 /* Create a new hash table */
@@ -118,6 +143,15 @@ dict *dictCreate(dictType *type,
     return d;
 }
 
+/* Create a new hash table with DICT_* flags */
+dict *dictCreateWithFlags(dictType *type, void *privDataPtr, int flags)
+{
+    dict *d = dictCreate(type,privDataPtr);
+
+    d->flags = flags;
+    return d;
+}
+
 /* Initialize the hash table */
 int _dictInit(dict *d, dictType *type,
         void *privDataPtr)
@@ -128,6 +162,8 @@ int _dictInit(dict *d, dictType *type,
     d->privdata = privDataPtr;
     d->rehashidx = -1;
     d->iterators = 0;
+    d->flags = 0;
+    d->target_moves = 0;
     return DICT_OK;
 }
 
@@ -148,7 +184,10 @@ int dictResize(dict *d)
 int dictExpand(dict *d, unsigned long size)
 {
     dictht n; /* the new hash table */
-    unsigned long realsize = _dictNextPower(size);
+    unsigned long realsize;
+
+    if (dictIsOpenAddressing(d)) return _dictOaExpand(d,size,0);
+    realsize = _dictNextPower(size);
 
     /* the size is invalid if it is smaller than the number of
      * elements already inside the hash table */
@@ -163,6 +202,8 @@ int dictExpand(dict *d, unsigned long size)
     n.sizemask = realsize-1;
     n.table = zcallocate(realsize*sizeof(dictEntry*));
     n.used = 0;
+    n.ctrl = NULL;
+    n.tombstones = 0;
 
     /* Is this the first initialization? If so it's not really a rehashing
      * we just set the first hash table so that it can accept keys. */
@@ -189,6 +230,7 @@ int dictExpand(dict *d, unsigned long size)
 int dictRehash(dict *d, int n) {
     int empty_visits = n*10; /* Max number of empty buckets to visit. */
     if (!dictIsRehashing(d)) return 0;
+    if (dictIsOpenAddressing(d)) return _dictOaRehash(d,n);
 
     while(n-- && d->ht[0].used != 0) {
         dictEntry *de, *nextde;
@@ -250,6 +292,28 @@ int dictRehashMilliseconds(dict *d, int ms) {
     return rehashes;
 }
 
+static long long timeInMicroseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Like dictRehashMilliseconds() but with a budget in microseconds, for
+ * callers that need to fit rehashing in a short cron slot. Nothing is done
+ * while safe iterators are bound to the dict. */
+int dictRehashMicroseconds(dict *d, long long us) {
+    long long start = timeInMicroseconds();
+    int rehashes = 0;
+
+    if (d->iterators) return 0;
+    while(dictRehash(d,100)) {
+        rehashes += 100;
+        if (timeInMicroseconds()-start >= us) break;
+    }
+    return rehashes;
+}
+
 /* This function performs just a step of rehashing, and only if there are
  * no safe iterators bound to our hash table. When we have iterators in the
  * middle of a rehashing we can't mess with the two hash tables otherwise
@@ -291,16 +355,24 @@ int dictAdd(dict *d, void *key, void *val)
  * If key was added, the hash entry is returned to be manipulated by the caller.
  */
 dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
+{
+    return dictAddRawWithHash(d, key, dictHashKey(d,key), existing);
+}
+
+/* Like dictAddRaw() with the hash of the key already computed by the caller
+ * with dictGetHash(). */
+dictEntry *dictAddRawWithHash(dict *d, void *key, uint64_t hash, dictEntry **existing)
 {
     long index;
     dictEntry *entry;
     dictht *ht;
 
+    if (dictIsOpenAddressing(d)) return _dictOaAddRaw(d,key,hash,existing);
     if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key, dictHashKey(d,key), existing)) == -1)
+    if ((index = _dictKeyIndex(d, key, hash, existing)) == -1)
         return NULL;
 
     /* Allocate the memory and store the new entry.
@@ -340,7 +412,7 @@ int dictReplace(dict *d, void *key, void *val)
      * as the previous one. In this context, think to reference counting,
      * you want to increment (set), and then decrement (free), and not the
      * reverse. */
-    auxentry = *existing;
+    auxentry.v = existing->v;
     dictSetVal(d, existing, val);
     dictFreeVal(d, &auxentry);
     return 0;
@@ -362,15 +434,15 @@ dictEntry *dictAddOrFind(dict *d, void *key) {
 /* Search and remove an element. This is an helper function for
  * dictDelete() and dictUnlink(), please check the top comment
  * of those functions. */
-static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
-    uint64_t h, idx;
+static dictEntry *dictGenericDelete(dict *d, const void *key, uint64_t h, int nofree) {
+    uint64_t idx;
     dictEntry *he, *prevHe;
     int table;
 
     if (d->ht[0].used == 0 && d->ht[1].used == 0) return NULL;
 
+    if (dictIsOpenAddressing(d)) return _dictOaGenericDelete(d,key,h,nofree);
     if (dictIsRehashing(d)) _dictRehashStep(d);
-    h = dictHashKey(d, key);
 
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
@@ -402,7 +474,11 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
 /* Remove an element, returning DICT_OK on success or DICT_ERR if the
  * element was not found. */
 int dictDelete(dict *ht, const void *key) {
-    return dictGenericDelete(ht,key,0) ? DICT_OK : DICT_ERR;
+    return dictGenericDelete(ht,key,dictHashKey(ht,key),0) ? DICT_OK : DICT_ERR;
+}
+
+int dictDeleteWithHash(dict *ht, const void *key, uint64_t hash) {
+    return dictGenericDelete(ht,key,hash,0) ? DICT_OK : DICT_ERR;
 }
 
 /* Remove an element from the table, but without actually releasing
@@ -427,7 +503,11 @@ int dictDelete(dict *ht, const void *key) {
  * dictFreeUnlinkedEntry(entry); // <- This does not need to lookup again.
  */
 dictEntry *dictUnlink(dict *ht, const void *key) {
-    return dictGenericDelete(ht,key,1);
+    return dictGenericDelete(ht,key,dictHashKey(ht,key),1);
+}
+
+dictEntry *dictUnlinkWithHash(dict *ht, const void *key, uint64_t hash) {
+    return dictGenericDelete(ht,key,hash,1);
 }
 
 /* You need to call this function to really free the entry after a call
@@ -443,6 +523,11 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he) {
 int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
     unsigned long i;
 
+    if (dictIsOpenAddressing(d)) {
+        _dictOaClear(d,ht,callback);
+        return DICT_OK;
+    }
+
     /* Free all the elements */
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dictEntry *he, *nextHe;
@@ -475,13 +560,22 @@ void dictRelease(dict *d)
 }
 
 dictEntry *dictFind(dict *d, const void *key)
+{
+    if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
+    return dictFindWithHash(d, key, dictHashKey(d, key));
+}
+
+/* Like dictFind() but with the hash of the key already computed by the
+ * caller with dictGetHash(), so that it can be reused for many lookups or
+ * for dictPrefetchBucket(). */
+dictEntry *dictFindWithHash(dict *d, const void *key, uint64_t h)
 {
     dictEntry *he;
-    uint64_t h, idx, table;
+    uint64_t idx, table;
 
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
     if (dictIsRehashing(d)) _dictRehashStep(d);
-    h = dictHashKey(d, key);
+    if (dictIsOpenAddressing(d)) return _dictOaFind(d,key,h,NULL);
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
         he = d->ht[table].table[idx];
@@ -495,6 +589,45 @@ dictEntry *dictFind(dict *d, const void *key)
     return NULL;
 }
 
+/* Batched lookups first call dictPrefetchBucket() for all the keys, then
+ * dictPrefetchEntry(), then dictFindWithHash(): the memory accesses of
+ * every stage are independent, so the cache misses of the different keys
+ * overlap instead of being paid one after the other. */
+#if defined(__GNUC__)
+#define dictPrefetchAddr(p) __builtin_prefetch(p)
+#else
+#define dictPrefetchAddr(p) ((void)(p))
+#endif
+
+void dictPrefetchBucket(dict *d, uint64_t hash) {
+    if (d->ht[0].used + d->ht[1].used == 0) return;
+    if (dictIsOpenAddressing(d)) {
+        _dictOaPrefetch(&d->ht[0],hash,0);
+        if (dictIsRehashing(d)) _dictOaPrefetch(&d->ht[1],hash,0);
+        return;
+    }
+    dictPrefetchAddr(&d->ht[0].table[hash & d->ht[0].sizemask]);
+    if (dictIsRehashing(d))
+        dictPrefetchAddr(&d->ht[1].table[hash & d->ht[1].sizemask]);
+}
+
+void dictPrefetchEntry(dict *d, uint64_t hash) {
+    dictEntry *he;
+
+    if (d->ht[0].used + d->ht[1].used == 0) return;
+    if (dictIsOpenAddressing(d)) {
+        _dictOaPrefetch(&d->ht[0],hash,1);
+        if (dictIsRehashing(d)) _dictOaPrefetch(&d->ht[1],hash,1);
+        return;
+    }
+    he = d->ht[0].table[hash & d->ht[0].sizemask];
+    if (he) dictPrefetchAddr(he);
+    if (dictIsRehashing(d)) {
+        he = d->ht[1].table[hash & d->ht[1].sizemask];
+        if (he) dictPrefetchAddr(he);
+    }
+}
+
 void *dictFetchValue(dict *d, const void *key) {
     dictEntry *he;
 
@@ -512,10 +645,10 @@ long long dictFingerprint(dict *d) {
     long long integers[6], hash = 0;
     int j;
 
-    integers[0] = (long) d->ht[0].table;
+    integers[0] = (long) d->ht[0].table ^ (long) d->ht[0].ctrl;
     integers[1] = d->ht[0].size;
     integers[2] = d->ht[0].used;
-    integers[3] = (long) d->ht[1].table;
+    integers[3] = (long) d->ht[1].table ^ (long) d->ht[1].ctrl;
     integers[4] = d->ht[1].size;
     integers[5] = d->ht[1].used;
 
@@ -548,6 +681,7 @@ dictIterator *dictGetIterator(dict *d)
     iter->table = 0;
     iter->index = -1;
     iter->safe = 0;
+    iter->target_moves = 0;
     iter->entry = NULL;
     iter->nextEntry = NULL;
     return iter;
@@ -562,6 +696,7 @@ dictIterator *dictGetSafeIterator(dict *d) {
 
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (dictIsOpenAddressing(iter->d)) return _dictOaNext(iter);
     while (1) {
         if (iter->entry == NULL) {
             dictht *ht = &iter->d->ht[iter->table];
@@ -616,11 +751,12 @@ dictEntry *dictGetRandomKey(dict *d)
 
     if (dictSize(d) == 0) return NULL;
     if (dictIsRehashing(d)) _dictRehashStep(d);
+    if (dictIsOpenAddressing(d)) return _dictOaGetRandomKey(d);
     if (dictIsRehashing(d)) {
         do {
             /* We are sure there are no elements in indexes from 0
              * to rehashidx-1 */
-            h = d->rehashidx + (random() % (d->ht[0].size +
+            h = d->rehashidx + (redisRandom() % (d->ht[0].size +
                                             d->ht[1].size -
                                             d->rehashidx));
             he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
@@ -628,7 +764,7 @@ dictEntry *dictGetRandomKey(dict *d)
         } while(he == NULL);
     } else {
         do {
-            h = random() & d->ht[0].sizemask;
+            h = redisRandom() & d->ht[0].sizemask;
             he = d->ht[0].table[h];
         } while(he == NULL);
     }
@@ -643,7 +779,7 @@ dictEntry *dictGetRandomKey(dict *d)
         he = he->next;
         listlen++;
     }
-    listele = random() % listlen;
+    listele = redisRandom() % listlen;
     he = orighe;
     while(listele--) he = he->next;
     return he;
@@ -687,6 +823,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
         else
             break;
     }
+    if (dictIsOpenAddressing(d)) return _dictOaGetSomeKeys(d,des,count);
 
     tables = dictIsRehashing(d) ? 2 : 1;
     maxsizemask = d->ht[0].sizemask;
@@ -694,7 +831,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
         maxsizemask = d->ht[1].sizemask;
 
     /* Pick a random point inside the larger table. */
-    unsigned long i = random() & maxsizemask;
+    unsigned long i = redisRandom() & maxsizemask;
     unsigned long emptylen = 0; /* Continuous empty entries so far. */
     while(stored < count && maxsteps--) {
         for (j = 0; j < tables; j++) {
@@ -717,7 +854,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
             if (he == NULL) {
                 emptylen++;
                 if (emptylen >= 5 && emptylen > count) {
-                    i = random() & maxsizemask;
+                    i = redisRandom() & maxsizemask;
                     emptylen = 0;
                 }
             } else {
@@ -845,6 +982,10 @@ unsigned long dictScan(dict *d,
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
+    if (dictIsOpenAddressing(d)) {
+        assert(bucketfn == NULL);
+        return _dictOaScan(d,v,fn,privdata);
+    }
 
     if (!dictIsRehashing(d)) {
         t0 = &(d->ht[0]);
@@ -984,6 +1125,547 @@ static long _dictKeyIndex(dict *d, const void *key, uint64_t hash, dictEntry **e
     return idx;
 }
 
+/* ------------------------ open addressing tables -------------------------- */
+
+/* Dicts created with the DICT_OPEN_ADDRESSING flag store the key and the
+ * value inline in a flat array of slots instead of allocating a dictEntry
+ * for every element: a lookup costs a cache miss for the control bytes and
+ * one for the slot, instead of one for the bucket and one for every entry
+ * of the chain, and every element saves the dictEntry allocation and the
+ * bucket pointer.
+ *
+ * The slots are split in groups of 16, and every slot has a control byte
+ * that is either EMPTY, DELETED, or the 7 high bits of the hash of the
+ * element stored there. The control bytes of a group are matched against
+ * a key at once with SSE2, so the keys are only compared for the slots
+ * that match. An element is stored in the first free slot of the probe
+ * sequence of groups starting at 'hash & sizemask' (for these tables
+ * 'size' is the number of slots and 'sizemask' the number of groups - 1),
+ * and a lookup stops at the first group of the sequence having an EMPTY
+ * slot. A deleted slot can only be marked EMPTY if its group has another
+ * EMPTY slot, since then no probe sequence ever went past the group,
+ * otherwise it is marked DELETED (a tombstone) until the next rehashing.
+ *
+ * A slot is a dictEntry without the 'next' pointer, so the entry API and
+ * macros are the same of the chained tables. However entries can move to
+ * the new table at every rehashing step, so an entry returned by the dict
+ * is only valid until the next call against the same dict. Unlinked
+ * entries are copies, so that dictFreeUnlinkedEntry() works as usual.
+ *
+ * The tables are resized when used + deleted slots reach 7/8 of the size,
+ * regardless of dictDisableResize() since an open addressing table can't
+ * go past its size. Rehashing is incremental like in the chained tables,
+ * moving one group of ht[0] at every step. */
+
+#define DICT_OA_GROUP 16
+#define DICT_OA_MIN_SIZE 16
+#define DICT_OA_EMPTY 0x80
+#define DICT_OA_DELETED 0xfe
+#define DICT_OA_SLOT_SIZE (offsetof(dictEntry,next))
+#define dictOaH2(hash) ((unsigned char)((hash) >> 57))
+#define dictOaIsFull(c) (((c) & 0x80) == 0)
+#define dictOaMaxLoad(size) ((size)-(size)/8)
+#define dictOaSlot(ht,i) \
+    ((dictEntry*)((ht)->ctrl+(ht)->size+(i)*DICT_OA_SLOT_SIZE))
+#define dictOaSlotIndex(ht,he) \
+    (((unsigned char*)(he)-(ht)->ctrl-(ht)->size)/DICT_OA_SLOT_SIZE)
+
+/* Return a bitmap of the slots of the group 'g' with control byte 'c'. */
+static inline unsigned int dictOaMatch(const unsigned char *g, unsigned char c) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)g);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl,_mm_set1_epi8((char)c)));
+#else
+    unsigned int m = 0, j;
+
+    for (j = 0; j < DICT_OA_GROUP; j++)
+        if (g[j] == c) m |= 1U<<j;
+    return m;
+#endif
+}
+
+/* Return a bitmap of the slots of the group 'g' holding an element. */
+static inline unsigned int dictOaMatchFull(const unsigned char *g) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)g);
+    return ~(unsigned int)_mm_movemask_epi8(ctrl) & 0xffff;
+#else
+    unsigned int m = 0, j;
+
+    for (j = 0; j < DICT_OA_GROUP; j++)
+        if (dictOaIsFull(g[j])) m |= 1U<<j;
+    return m;
+#endif
+}
+
+/* Index of the lowest bit set in the non zero bitmap 'm'. */
+static inline unsigned int dictOaFirst(unsigned int m) {
+#if defined(__GNUC__)
+    return __builtin_ctz(m);
+#else
+    unsigned int j = 0;
+
+    while (!(m & 1)) {
+        m >>= 1;
+        j++;
+    }
+    return j;
+#endif
+}
+
+/* Number of bits set in the bitmap 'm'. */
+static inline unsigned int dictOaCount(unsigned int m) {
+#if defined(__GNUC__)
+    return __builtin_popcount(m);
+#else
+    unsigned int count = 0;
+
+    while (m) {
+        m &= m-1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static void _dictOaInitTable(dictht *ht, unsigned long realsize)
+{
+    ht->table = NULL;
+    ht->size = realsize;
+    ht->sizemask = realsize/DICT_OA_GROUP-1;
+    ht->used = 0;
+    ht->ctrl = zmalloc(realsize*(DICT_OA_SLOT_SIZE+1));
+    ht->tombstones = 0;
+    memset(ht->ctrl,DICT_OA_EMPTY,realsize);
+}
+
+static int _dictOaExpand(dict *d, unsigned long size, int same_size)
+{
+    dictht n; /* the new hash table */
+    unsigned long realsize = DICT_OA_MIN_SIZE;
+
+    if (dictIsRehashing(d) || d->ht[0].used > size)
+        return DICT_ERR;
+    while (dictOaMaxLoad(realsize) < size) {
+        if (realsize >= LONG_MAX/(DICT_OA_SLOT_SIZE+1)) return DICT_ERR;
+        realsize *= 2;
+    }
+
+    /* Rehashing to the same table size is only useful to get rid of the
+     * tombstones. */
+    if (realsize == d->ht[0].size && !same_size) return DICT_ERR;
+
+    _dictOaInitTable(&n,realsize);
+    if (d->ht[0].ctrl == NULL) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Take the first free slot of the probe sequence of 'hash' in 'ht', that
+ * must not already contain the key, and return it with the key and the
+ * value still to be set. */
+static dictEntry *_dictOaInsert(dictht *ht, uint64_t hash) {
+    unsigned long g = hash & ht->sizemask, step = 0, idx;
+    unsigned int m;
+
+    while ((m = ~dictOaMatchFull(ht->ctrl+g*DICT_OA_GROUP) & 0xffff) == 0)
+        g = (g+(++step)) & ht->sizemask;
+    idx = g*DICT_OA_GROUP+dictOaFirst(m);
+    if (ht->ctrl[idx] == DICT_OA_DELETED) ht->tombstones--;
+    ht->ctrl[idx] = dictOaH2(hash);
+    ht->used++;
+    return dictOaSlot(ht,idx);
+}
+
+static void _dictOaClearSlot(dictht *ht, unsigned long idx) {
+    if (dictOaMatch(ht->ctrl+(idx & ~(unsigned long)(DICT_OA_GROUP-1)),DICT_OA_EMPTY)) {
+        ht->ctrl[idx] = DICT_OA_EMPTY;
+    } else {
+        ht->ctrl[idx] = DICT_OA_DELETED;
+        ht->tombstones++;
+    }
+    ht->used--;
+}
+
+static int _dictOaRehash(dict *d, int n) {
+    int empty_visits = n*10; /* Max number of empty groups to visit. */
+    dictht *t0 = &d->ht[0], *t1 = &d->ht[1];
+
+    while(n-- && t0->used != 0) {
+        unsigned long base;
+        unsigned int m;
+
+        assert(t0->sizemask >= (unsigned long)d->rehashidx);
+        while((m = dictOaMatchFull(t0->ctrl+d->rehashidx*DICT_OA_GROUP)) == 0) {
+            d->rehashidx++;
+            if (--empty_visits == 0) return 1;
+        }
+        /* Move all the elements of this group to the new table. */
+        base = d->rehashidx*DICT_OA_GROUP;
+        while(m) {
+            unsigned long idx = base+dictOaFirst(m);
+            dictEntry *de = dictOaSlot(t0,idx);
+
+            memcpy(_dictOaInsert(t1,dictHashKey(d,de->key)),de,DICT_OA_SLOT_SIZE);
+            _dictOaClearSlot(t0,idx);
+            m &= m-1;
+        }
+        d->rehashidx++;
+    }
+
+    /* Check if we already rehashed the whole table... */
+    if (t0->used == 0) {
+        zfree(t0->ctrl);
+        *t0 = *t1;
+        _dictReset(t1);
+        d->rehashidx = -1;
+        return 0;
+    }
+
+    /* More to rehash... */
+    return 1;
+}
+
+static dictEntry *_dictOaFindInTable(dict *d, dictht *ht, const void *key, uint64_t hash) {
+    unsigned long g = hash & ht->sizemask, step = 0;
+    unsigned char h2 = dictOaH2(hash);
+
+    if (ht->size == 0) return NULL;
+    while(1) {
+        const unsigned char *ctrl = ht->ctrl+g*DICT_OA_GROUP;
+        unsigned int m = dictOaMatch(ctrl,h2);
+
+        while(m) {
+            dictEntry *he = dictOaSlot(ht,g*DICT_OA_GROUP+dictOaFirst(m));
+            if (key==he->key || dictCompareKeys(d, key, he->key))
+                return he;
+            m &= m-1;
+        }
+        if (dictOaMatch(ctrl,DICT_OA_EMPTY) || ++step > ht->sizemask)
+            return NULL;
+        g = (g+step) & ht->sizemask;
+    }
+}
+
+/* Lookup 'key' in both the tables, without rehashing steps. If 'table' is
+ * not NULL it is set to the table of the element found. */
+static dictEntry *_dictOaFind(dict *d, const void *key, uint64_t hash, int *table) {
+    dictEntry *he;
+
+    if ((he = _dictOaFindInTable(d,&d->ht[0],key,hash)) != NULL) {
+        if (table) *table = 0;
+        return he;
+    }
+    if (!dictIsRehashing(d)) return NULL;
+    if ((he = _dictOaFindInTable(d,&d->ht[1],key,hash)) != NULL) {
+        if (table) *table = 1;
+    }
+    return he;
+}
+
+/* Replace the new table of a rehashing in progress with a bigger one, with
+ * room for all the elements of both the tables and then some. Only the
+ * elements of ht[1] move, so safe iterators still visiting ht[0] are not
+ * affected, and the ones visiting ht[1] start it again, see _dictOaNext(). */
+static int _dictOaGrowTarget(dict *d)
+{
+    dictht *t1 = &d->ht[1], n;
+    unsigned long realsize = t1->size, total = t1->used+d->ht[0].used, j;
+
+    while (dictOaMaxLoad(realsize) <= total*2) {
+        if (realsize >= LONG_MAX/(DICT_OA_SLOT_SIZE+1)) return DICT_ERR;
+        realsize *= 2;
+    }
+    _dictOaInitTable(&n,realsize);
+    for (j = 0; j < t1->size; j++) {
+        if (dictOaIsFull(t1->ctrl[j])) {
+            dictEntry *de = dictOaSlot(t1,j);
+            memcpy(_dictOaInsert(&n,dictHashKey(d,de->key)),de,DICT_OA_SLOT_SIZE);
+        }
+    }
+    zfree(t1->ctrl);
+    *t1 = n;
+    d->target_moves++;
+    return DICT_OK;
+}
+
+/* Make room for one more element in the table that gets the insertions. */
+static int _dictOaExpandIfNeeded(dict *d)
+{
+    dictht *ht;
+
+    /* If the hash table is empty expand it to the initial size. */
+    if (d->ht[0].size == 0) return _dictOaExpand(d,1,0);
+
+    /* The new table must have room for the elements still to move, or
+     * the rehashing is completed now and the new table is resized in turn.
+     * Safe iterators stop the rehashing, then the new table grows. */
+    if (dictIsRehashing(d)) {
+        ht = &d->ht[1];
+        if (ht->used+ht->tombstones+d->ht[0].used < dictOaMaxLoad(ht->size))
+            return DICT_OK;
+        if (d->iterators) return _dictOaGrowTarget(d);
+        while(_dictOaRehash(d,100));
+    }
+
+    /* Double the table when it is full, or rebuild it with the same size
+     * when most of the slots are tombstones. */
+    ht = &d->ht[0];
+    if (ht->used+ht->tombstones < dictOaMaxLoad(ht->size)) return DICT_OK;
+    return _dictOaExpand(d,ht->used*2,1);
+}
+
+static dictEntry *_dictOaAddRaw(dict *d, void *key, uint64_t hash, dictEntry **existing) {
+    dictEntry *entry;
+
+    if (existing) *existing = NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+
+    if ((entry = _dictOaFind(d,key,hash,NULL)) != NULL) {
+        if (existing) *existing = entry;
+        return NULL;
+    }
+    if (_dictOaExpandIfNeeded(d) == DICT_ERR)
+        return NULL;
+    entry = _dictOaInsert(dictIsRehashing(d) ? &d->ht[1] : &d->ht[0],hash);
+    dictSetKey(d, entry, key);
+    return entry;
+}
+
+static dictEntry *_dictOaGenericDelete(dict *d, const void *key, uint64_t hash, int nofree) {
+    dictEntry *he, *unlinked;
+    dictht *ht;
+    int table;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+
+    if ((he = _dictOaFind(d,key,hash,&table)) == NULL) return NULL;
+    ht = &d->ht[table];
+    if (nofree) {
+        /* The slot is reused by the next insertions: the caller gets a
+         * copy of the entry that it will release. */
+        unlinked = zmalloc(sizeof(*unlinked));
+        memcpy(unlinked,he,DICT_OA_SLOT_SIZE);
+        unlinked->next = NULL;
+    } else {
+        dictFreeKey(d, he);
+        dictFreeVal(d, he);
+        unlinked = he;
+    }
+    _dictOaClearSlot(ht,dictOaSlotIndex(ht,he));
+    return unlinked;
+}
+
+static void _dictOaClear(dict *d, dictht *ht, void(callback)(void *)) {
+    unsigned long i;
+
+    /* Free all the elements */
+    for (i = 0; i < ht->size && ht->used > 0; i++) {
+        dictEntry *he;
+
+        if (callback && (i & 65535) == 0) callback(d->privdata);
+
+        if (!dictOaIsFull(ht->ctrl[i])) continue;
+        he = dictOaSlot(ht,i);
+        dictFreeKey(d, he);
+        dictFreeVal(d, he);
+        ht->used--;
+    }
+    /* Free the table and re-initialize it */
+    zfree(ht->ctrl);
+    _dictReset(ht);
+}
+
+/* Prefetch the control bytes of the first group of the probe sequence, or
+ * if 'entry' is true, the first slot of the group matching the hash. */
+static void _dictOaPrefetch(dictht *ht, uint64_t hash, int entry) {
+    const unsigned char *ctrl = ht->ctrl+(hash & ht->sizemask)*DICT_OA_GROUP;
+    unsigned int m;
+
+    if (!entry) {
+        dictPrefetchAddr(ctrl);
+    } else if ((m = dictOaMatch(ctrl,dictOaH2(hash))) != 0) {
+        dictPrefetchAddr(dictOaSlot(ht,(hash & ht->sizemask)*DICT_OA_GROUP+dictOaFirst(m)));
+    }
+}
+
+static dictEntry *_dictOaNext(dictIterator *iter) {
+    dictht *ht = &iter->d->ht[iter->table];
+
+    if (iter->index == -1 && iter->table == 0) {
+        if (iter->safe)
+            iter->d->iterators++;
+        else
+            iter->fingerprint = dictFingerprint(iter->d);
+    }
+    /* The elements of ht[1] moved to a bigger table since the last call:
+     * visit it again from the start. */
+    if (iter->table == 1 && iter->target_moves != iter->d->target_moves) {
+        iter->target_moves = iter->d->target_moves;
+        iter->index = -1;
+    }
+    while (1) {
+        iter->index++;
+        if (iter->index >= (long) ht->size) {
+            if (dictIsRehashing(iter->d) && iter->table == 0) {
+                iter->table++;
+                iter->index = -1;
+                iter->target_moves = iter->d->target_moves;
+                ht = &iter->d->ht[1];
+                continue;
+            }
+            return NULL;
+        }
+        /* Slots don't move while iterating, and an element deleted by the
+         * user of a safe iterator just leaves a free slot behind. */
+        if (dictOaIsFull(ht->ctrl[iter->index])) {
+            iter->entry = dictOaSlot(ht,iter->index);
+            return iter->entry;
+        }
+    }
+}
+
+/* Pick a random non empty group and a random element inside it. */
+static dictEntry *_dictOaGetRandomKey(dict *d) {
+    unsigned long groups0 = d->ht[0].size/DICT_OA_GROUP;
+    unsigned long groups1 = d->ht[1].size/DICT_OA_GROUP;
+    unsigned long from = 0, g;
+    unsigned int m, listele;
+    dictht *ht;
+
+    /* We are sure there are no elements in the groups from 0 to
+     * rehashidx-1 of ht[0]. */
+    if (dictIsRehashing(d)) from = d->rehashidx;
+    do {
+        g = from + (redisRandom() % (groups0 + groups1 - from));
+        ht = &d->ht[0];
+        if (g >= groups0) {
+            ht = &d->ht[1];
+            g -= groups0;
+        }
+        m = dictOaMatchFull(ht->ctrl+g*DICT_OA_GROUP);
+    } while(m == 0);
+
+    /* Now pick one of the elements of the group at random. */
+    listele = redisRandom() % dictOaCount(m);
+    while(listele--) m &= m-1;
+    return dictOaSlot(ht,g*DICT_OA_GROUP+dictOaFirst(m));
+}
+
+/* Same as dictGetSomeKeys() walking groups instead of buckets. */
+static unsigned int _dictOaGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
+    unsigned long j; /* internal hash table id, 0 or 1. */
+    unsigned long tables = dictIsRehashing(d) ? 2 : 1;
+    unsigned long stored = 0, maxsizemask = d->ht[0].sizemask;
+    unsigned long maxsteps = count*10;
+    unsigned long i, emptylen = 0; /* Continuous empty groups so far. */
+
+    if (count == 0) return 0;
+    if (tables > 1 && maxsizemask < d->ht[1].sizemask)
+        maxsizemask = d->ht[1].sizemask;
+
+    /* Pick a random group inside the larger table. */
+    i = redisRandom() & maxsizemask;
+    while(stored < count && maxsteps--) {
+        for (j = 0; j < tables; j++) {
+            dictht *ht = &d->ht[j];
+            unsigned int m;
+
+            /* Nothing to find in the groups of ht[0] already rehashed. */
+            if (tables == 2 && j == 0 && i < (unsigned long) d->rehashidx) {
+                if (i > d->ht[1].sizemask) i = d->rehashidx;
+                continue;
+            }
+            if (i > ht->sizemask) continue; /* Out of range for this table. */
+            m = dictOaMatchFull(ht->ctrl+i*DICT_OA_GROUP);
+            if (m == 0) {
+                emptylen++;
+                if (emptylen >= 5 && emptylen > count) {
+                    i = redisRandom() & maxsizemask;
+                    emptylen = 0;
+                }
+            } else {
+                emptylen = 0;
+                while (m) {
+                    *des = dictOaSlot(ht,i*DICT_OA_GROUP+dictOaFirst(m));
+                    des++;
+                    stored++;
+                    if (stored == count) return stored;
+                    m &= m-1;
+                }
+            }
+        }
+        i = (i+1) & maxsizemask;
+    }
+    return stored;
+}
+
+/* Emit the elements of 'ht' whose probe sequence starts at the group 'g',
+ * that is, the elements a lookup starting from 'g' could find. This is the
+ * open addressing equivalent of a bucket, so the dictScan() cursor works
+ * with groups exactly like it works with buckets. Every element in the
+ * visited groups is hashed again to know where it belongs. */
+static void _dictOaScanGroup(dict *d, dictht *ht, unsigned long g,
+                             dictScanFunction *fn, void *privdata)
+{
+    unsigned long home = g, step = 0;
+
+    while(1) {
+        const unsigned char *ctrl = ht->ctrl+g*DICT_OA_GROUP;
+        unsigned int m = dictOaMatchFull(ctrl);
+
+        while(m) {
+            const dictEntry *de = dictOaSlot(ht,g*DICT_OA_GROUP+dictOaFirst(m));
+            if ((dictHashKey(d,de->key) & ht->sizemask) == home)
+                fn(privdata, de);
+            m &= m-1;
+        }
+        if (dictOaMatch(ctrl,DICT_OA_EMPTY) || ++step > ht->sizemask) return;
+        g = (g+step) & ht->sizemask;
+    }
+}
+
+static unsigned long _dictOaScan(dict *d, unsigned long v,
+                                 dictScanFunction *fn, void *privdata)
+{
+    dictht *t0, *t1;
+    unsigned long m0, m1;
+
+    if (!dictIsRehashing(d)) {
+        t0 = &(d->ht[0]);
+        m0 = t0->sizemask;
+        _dictOaScanGroup(d,t0,v & m0,fn,privdata);
+        v |= ~m0;
+        v = rev(v);
+        v++;
+        v = rev(v);
+    } else {
+        t0 = &d->ht[0];
+        t1 = &d->ht[1];
+
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        if (t0->size > t1->size) {
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+        m0 = t0->sizemask;
+        m1 = t1->sizemask;
+        _dictOaScanGroup(d,t0,v & m0,fn,privdata);
+        do {
+            _dictOaScanGroup(d,t1,v & m1,fn,privdata);
+            v |= ~m1;
+            v = rev(v);
+            v++;
+            v = rev(v);
+        } while (v & (m0 ^ m1));
+    }
+    return v;
+}
+
 void dictEmpty(dict *d, void(callback)(void*)) {
     _dictClear(d,&d->ht[0],callback);
     _dictClear(d,&d->ht[1],callback);
@@ -1012,6 +1694,8 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
     dictEntry *he, **heref;
     unsigned long idx, table;
 
+    /* Open addressing tables have no entry references to update. */
+    assert(!dictIsOpenAddressing(d));
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
     for (table = 0; table <= 1; table++) {
         idx = hash & d->ht[table].sizemask;
@@ -1041,6 +1725,10 @@ uint64_t dictSdsHash(const void *key) {
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
+uint64_t dictSdsFastHash(const void *key) {
+    return dictGenFastHashFunction((unsigned char*)key, sdslen((char*)key));
+}
+
 int dictSdsKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
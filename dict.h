@@ -71,6 +71,10 @@ typedef struct dictht {
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
+    /* Open addressing tables only: one control byte per slot followed by
+     * the slots themselves, and the number of deleted slots. */
+    unsigned char *ctrl;
+    unsigned long tombstones;
 } dictht;
 
 typedef struct dict {
@@ -79,16 +83,24 @@ typedef struct dict {
     dictht ht[2];
     long rehashidx; /* rehashing not in progress if rehashidx == -1 */
     unsigned long iterators; /* number of iterators currently running */
+    int flags; /* DICT_* creation flags */
+    int target_moves; /* open addressing: times ht[1] was rebuilt */
 } dict;
 
+/* Dict creation flags */
+#define DICT_OPEN_ADDRESSING (1<<0) /* Entries inline in the table, no chaining */
+
 /* If safe is set to 1 this is a safe iterator, that means, you can call
  * dictAdd, dictFind, and other functions against the dictionary even while
  * iterating. Otherwise it is a non safe iterator, and only dictNext()
- * should be called while iterating. */
+ * should be called while iterating. With open addressing, elements added
+ * while a safe iterator visits ht[1] can make it return some elements of
+ * ht[1] twice, but never skip one. */
 typedef struct dictIterator {
     dict *d;
     long index;
     int table, safe;
+    int target_moves; /* d->target_moves when entering ht[1] */
     dictEntry *entry, *nextEntry;
     /* unsafe iterator fingerprint for misuse detection. */
     long long fingerprint;
@@ -146,20 +158,28 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictIsOpenAddressing(d) ((d)->flags & DICT_OPEN_ADDRESSING)
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
+dict *dictCreateWithFlags(dictType *type, void *privDataPtr, int flags);
 int dictExpand(dict *d, unsigned long size);
 int dictAdd(dict *d, void *key, void *val);
 dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing);
+dictEntry *dictAddRawWithHash(dict *d, void *key, uint64_t hash, dictEntry **existing);
 dictEntry *dictAddOrFind(dict *d, void *key);
 int dictReplace(dict *d, void *key, void *val);
 int dictDelete(dict *d, const void *key);
+int dictDeleteWithHash(dict *ht, const void *key, uint64_t hash);
 dictEntry *dictUnlink(dict *ht, const void *key);
+dictEntry *dictUnlinkWithHash(dict *ht, const void *key, uint64_t hash);
 void dictFreeUnlinkedEntry(dict *d, dictEntry *he);
 void dictRelease(dict *d);
 dictEntry * dictFind(dict *d, const void *key);
 void *dictFetchValue(dict *d, const void *key);
+dictEntry *dictFindWithHash(dict *d, const void *key, uint64_t h);
+void dictPrefetchBucket(dict *d, uint64_t hash);
+void dictPrefetchEntry(dict *d, uint64_t hash);
 int dictResize(dict *d);
 dictIterator *dictGetIterator(dict *d);
 dictIterator *dictGetSafeIterator(dict *d);
@@ -170,11 +190,13 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
 void dictGetStats(char *buf, size_t bufsize, dict *d);
 uint64_t dictGenHashFunction(const void *key, int len);
 uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len);
+uint64_t dictGenFastHashFunction(const void *key, int len);
 void dictEmpty(dict *d, void(callback)(void*));
 void dictEnableResize(void);
 void dictDisableResize(void);
 int dictRehash(dict *d, int n);
 int dictRehashMilliseconds(dict *d, int ms);
+int dictRehashMicroseconds(dict *d, long long us);
 void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
@@ -184,6 +206,7 @@ int htNeedsResize(dict *dict);
 
 /* Keys hashing / comparison functions for dict.c hash tables. */
 uint64_t dictSdsHash(const void *key);
+uint64_t dictSdsFastHash(const void *key);
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
 void dictSdsDestructor(void *privdata, void *val);
 void dictObjectDestructor(void *privdata, void *val);
@@ -197,5 +220,10 @@ extern dictType dictTypeHeapStringCopyKeyValue;
 extern dictType objectKeyPointerValueDictType;
 extern dictType setDictType;
 extern dictType zsetDictType;
+extern dictType hashDictType;
+/* Same as above, using dictSdsFastHash(). */
+extern dictType setDictTypeFast;
+extern dictType zsetDictTypeFast;
+extern dictType hashDictTypeFast;
 
 #endif /* __DICT_H */
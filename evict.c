@@ -37,13 +37,27 @@
 #include "atomicvar.h"
 #include "commonfunc.h"
 #include "zmalloc.h"
-
-extern db_config g_db_config;
+#include "util.h"
 
 /* ----------------------------------------------------------------------------
  * Implementation of eviction, aging and LRU
  * --------------------------------------------------------------------------*/
 
+/* Clocks cached by updateCachedClock(), called by the host cron, so that
+ * accessing a key does not need to read the system time. Until the first
+ * call the clocks are computed at every access. */
+static int clock_cached = 0;
+static unsigned int cached_lruclock = 0;
+static unsigned long cached_lfuclock = 0;
+
+void updateCachedClock(void) {
+    long long now = mstime();
+
+    atomicSet(cached_lruclock,(now/LRU_CLOCK_RESOLUTION) & LRU_CLOCK_MAX);
+    atomicSet(cached_lfuclock,(now/60000) & 65535);
+    atomicSet(clock_cached,1);
+}
+
 /* Return the LRU clock, based on the clock resolution. This is a time
  * in a reduced-bits format that can be used to set and check the
  * object->lru field of redisObject structures. */
@@ -56,7 +70,16 @@ unsigned int getLRUClock(void) {
  * LRU clock (as it should be in production servers) we return the
  * precomputed value, otherwise we need to resort to a system call. */
 unsigned int LRU_CLOCK(void) {
-    return getLRUClock();
+    unsigned int lruclock;
+    int cached;
+
+    atomicGet(clock_cached,cached);
+    if (cached) {
+        atomicGet(cached_lruclock,lruclock);
+    } else {
+        lruclock = getLRUClock();
+    }
+    return lruclock;
 }
 
 /* Given an object returns the min number of milliseconds the object was never
@@ -94,7 +117,8 @@ unsigned long long estimateObjectIdleTime(robj *o) {
  * Redis uses an approximation of the LRU algorithm that runs in constant
  * memory. Every time there is a key to expire, we sample N keys (with
  * N very small, usually in around 5) to populate a pool of best keys to
- * evict of M keys (the pool size is defined by EVPOOL_SIZE).
+ * evict of M keys (the pool size is maxmemory_eviction_pool, EVPOOL_SIZE by
+ * default).
  *
  * The N keys sampled are added in the pool of good keys to expire (the one
  * with an old access time) if they are better than one of the current keys
@@ -109,138 +133,242 @@ unsigned long long estimateObjectIdleTime(robj *o) {
  * one key that can be evicted, if there is at least one key that can be
  * evicted in the whole database. */
 
-/* Create a new eviction pool. */
-struct evictionPoolEntry* evictionPoolAlloc(void) {
-    struct evictionPoolEntry *ep;
+/* Create a new eviction pool of 'size' entries. */
+evictionPool *evictionPoolAlloc(int size) {
+    evictionPool *pool;
     int j;
 
-    ep = zmalloc(sizeof(*ep)*EVPOOL_SIZE);
-    for (j = 0; j < EVPOOL_SIZE; j++) {
-        ep[j].idle = 0;
-        ep[j].key = NULL;
-        ep[j].cached = sdsnewlen(NULL,EVPOOL_CACHED_SDS_SIZE);
+    if (size <= 0) size = EVPOOL_SIZE;
+    if (size > EVPOOL_MAX_SIZE) size = EVPOOL_MAX_SIZE;
+    pool = zmalloc(sizeof(*pool)+sizeof(pool->entries[0])*size);
+    pool->size = size;
+    pool->used = 0;
+    pool->credit = 0;
+    for (j = 0; j < size; j++) {
+        pool->entries[j].idle = 0;
+        pool->entries[j].key = NULL;
+        pool->entries[j].cached = sdsnewlen(NULL,EVPOOL_CACHED_SDS_SIZE);
     }
-    return ep;
+    return pool;
 }
 
 /* Destroy a eviction pool. */
-void evictionPoolDestroy(struct evictionPoolEntry *pool) {
-    
+void evictionPoolDestroy(evictionPool *pool) {
     if (pool) {
         int j;
-        for (j = 0; j < EVPOOL_SIZE; j++) {
-            sdsfree(pool[j].cached);
+        for (j = 0; j < pool->size; j++) {
+            if (pool->entries[j].key != pool->entries[j].cached)
+                sdsfree(pool->entries[j].key);
+            sdsfree(pool->entries[j].cached);
         }
+        zfree(pool);
+    }
+}
+
+/* Entries are swapped as a whole: each one keeps its cached SDS. */
+static void evictionPoolSwap(evictionPool *pool, int i, int j) {
+    struct evictionPoolEntry tmp = pool->entries[i];
+    pool->entries[i] = pool->entries[j];
+    pool->entries[j] = tmp;
+}
+
+static void evictionPoolSiftUp(evictionPool *pool, int k) {
+    struct evictionPoolEntry *e = pool->entries;
+
+    while (k > 0 && e[(k-1)/2].idle > e[k].idle) {
+        evictionPoolSwap(pool,k,(k-1)/2);
+        k = (k-1)/2;
     }
 }
 
+static void evictionPoolSiftDown(evictionPool *pool, int k) {
+    struct evictionPoolEntry *e = pool->entries;
+
+    while (1) {
+        int min = k, l = 2*k+1, r = 2*k+2;
+        if (l < pool->used && e[l].idle < e[min].idle) min = l;
+        if (r < pool->used && e[r].idle < e[min].idle) min = r;
+        if (min == k) break;
+        evictionPoolSwap(pool,k,min);
+        k = min;
+    }
+}
+
+/* Drop the key of the entry 'k', that is no longer in use. */
+static void evictionPoolClearEntry(evictionPool *pool, int k) {
+    struct evictionPoolEntry *e = pool->entries+k;
+
+    if (e->key != e->cached) sdsfree(e->key);
+    e->key = NULL;
+    e->idle = 0;
+}
+
+/* Add 'key' with the given idle time to the pool, replacing the worst
+ * entry if the pool is full and the key is a better candidate. */
+static void evictionPoolInsert(evictionPool *pool, sds key, unsigned long long idle) {
+    struct evictionPoolEntry *e;
+    int k, klen;
+
+    if (pool->used < pool->size) {
+        k = pool->used++;
+    } else {
+        /* Can't insert if the element is <= the worst element we have. */
+        if (idle <= pool->entries[0].idle) return;
+        evictionPoolClearEntry(pool,0);
+        k = 0;
+    }
+
+    /* Try to reuse the cached SDS string allocated in the pool entry,
+     * because allocating and deallocating this object is costly
+     * (according to the profiler, not my fantasy. Remember:
+     * premature optimizbla bla bla bla. */
+    e = pool->entries+k;
+    klen = sdslen(key);
+    if (klen > EVPOOL_CACHED_SDS_SIZE) {
+        e->key = sdsdup(key);
+    } else {
+        memcpy(e->cached,key,klen+1);
+        sdssetlen(e->cached,klen);
+        e->key = e->cached;
+    }
+    e->idle = idle;
+    if (k == 0) evictionPoolSiftDown(pool,0);
+    else evictionPoolSiftUp(pool,k);
+}
+
+/* Return the score of the entry 'de' of 'sampledict' in the pool. */
+static unsigned long long evictionPoolScore(dictEntry *de, dict *sampledict, dict *keydict,
+                                            int maxmemory_policy, db_config *config,
+                                            tinyLfu *tlfu) {
+    unsigned long long idle = 0;
+    robj *o = NULL;
+
+    /* If the dictionary we are sampling from is not the main
+     * dictionary (but the expires one) we need to lookup the key
+     * again in the key dictionary to obtain the value object. */
+    if (maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
+        if (sampledict != keydict) de = dictFind(keydict, dictGetKey(de));
+        o = dictGetVal(de);
+    }
+
+    /* Calculate the idle time according to the policy. This is called
+     * idle just because the code initially handled LRU, but is in fact
+     * just a score where an higher score means better candidate. */
+    if (maxmemory_policy & MAXMEMORY_FLAG_LRU) {
+        idle = estimateObjectIdleTime(o);
+    } else if (maxmemory_policy & MAXMEMORY_FLAG_SIZE) {
+        /* Bytes per access, with 10 bits of fraction. */
+        size_t size = objectComputeSize(o,GDSF_SIZE_SAMPLES) +
+                      sdsAllocSize(dictGetKey(de)) + sizeof(dictEntry);
+
+        idle = ((unsigned long long)size << 10) /
+               LFUEstimateAccesses(LFUDecrAndReturn(o,config));
+    } else if (maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+        /* When we use an LRU policy, we sort the keys by idle time
+         * so that we expire keys starting from greater idle time.
+         * However when the policy is an LFU one, we have a frequency
+         * estimation, and we want to evict keys with lower frequency
+         * first. So inside the pool we put objects using the inverted
+         * frequency subtracting the actual frequency to the maximum
+         * frequency of 255. */
+        idle = 255-LFUDecrAndReturn(o,config);
+    } else if (maxmemory_policy & MAXMEMORY_FLAG_TINYLFU) {
+        /* Keys in the admission window always score lower than the others,
+         * that score by inverse frequency first, and idle ticks then. */
+        unsigned long long age = (tlfu->tick - o->lru) & LRU_CLOCK_MAX;
+        unsigned long window = dictSize(keydict)/100*TINYLFU_WINDOW_PERC;
+
+        if (age < window) {
+            idle = age;
+        } else {
+            uint64_t hash = dictGetHash(keydict,dictGetKey(de));
+            idle = ((16ULL-tinyLfuFrequency(tlfu,hash)) << LRU_BITS) | age;
+        }
+    } else if (maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
+        /* In this case the sooner the expire the better. */
+        idle = ULLONG_MAX - (long)dictGetVal(de);
+    } else {
+        // serverPanic("Unknown eviction policy in evictionPoolPopulate()");
+    }
+    return idle;
+}
+
 /* This is an helper function for freeMemoryIfNeeded(), it is used in order
  * to populate the evictionPool with a few entries every time we want to
  * expire a key. Keys with idle time smaller than one of the current
  * keys are added. Keys are always added if there are free entries.
  *
- * We insert keys on place in ascending order, so keys with the smaller
- * idle time are on the left, and keys with the higher idle time on the
- * right. */
-
-void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
-    int j, k, count;
+ * maxmemory_samples keys are sampled for each of the evictions the pool
+ * serves before the next call, see 'credit'. */
+void evictionPoolPopulate(dict *sampledict, dict *keydict, evictionPool *pool, db_config *config, tinyLfu *tlfu) {
+    int j, count, batch, tosample;
     int maxmemory_samples, maxmemory_policy;
+    dictEntry *samples[EVPOOL_MAX_SAMPLES];
 
-    atomicGet(g_db_config.maxmemory_samples, maxmemory_samples);
-    atomicGet(g_db_config.maxmemory_policy, maxmemory_policy);
+    atomicGet(config->maxmemory_samples, maxmemory_samples);
+    atomicGet(config->maxmemory_policy, maxmemory_policy);
 
-    dictEntry *samples[maxmemory_samples];
-    count = dictGetSomeKeys(sampledict,samples,maxmemory_samples);
+    batch = pool->size/EVPOOL_SIZE;
+    if (batch < 1) batch = 1;
+    tosample = maxmemory_samples*batch;
+    if (tosample < 1) tosample = 1;
+    if (tosample > EVPOOL_MAX_SAMPLES) tosample = EVPOOL_MAX_SAMPLES;
+    pool->credit = batch;
+
+    count = dictGetSomeKeys(sampledict,samples,tosample);
     for (j = 0; j < count; j++) {
-        unsigned long long idle;
-        sds key;
-        robj *o;
-        dictEntry *de;
+        evictionPoolInsert(pool,dictGetKey(samples[j]),
+            evictionPoolScore(samples[j],sampledict,keydict,maxmemory_policy,config,tlfu));
+    }
+}
 
-        de = samples[j];
-        key = dictGetKey(de);
+/* Remove the best candidate from the pool and return its entry in
+ * 'sampledict', the dict the pool was populated from. Candidates no longer
+ * in the dict are ghosts, and are dropped as well. Returns NULL once the
+ * pool is empty, so that the caller populates it again.
+ *
+ * The score of a candidate is computed again before it is picked: it may
+ * have been accessed since it was sampled, the more likely the bigger the
+ * pool is. Candidates that got a worse score go back in the pool.
+ *
+ * The best candidate of a min heap is one of its leaves, that are scanned:
+ * they are contiguous, and much less than the keys sampled to fill them. */
+dictEntry *evictionPoolPopBest(evictionPool *pool, dict *sampledict, dict *keydict, db_config *config, tinyLfu *tlfu) {
+    struct evictionPoolEntry *e = pool->entries;
+    int maxmemory_policy;
 
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
-            if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
-        }
+    atomicGet(config->maxmemory_policy, maxmemory_policy);
+    while (pool->used) {
+        dictEntry *de;
+        unsigned long long idle;
+        int j, best = pool->used/2;
 
-        /* Calculate the idle time according to the policy. This is called
-         * idle just because the code initially handled LRU, but is in fact
-         * just a score where an higher score means better candidate. */
-        if (maxmemory_policy & MAXMEMORY_FLAG_LRU) {
-            idle = estimateObjectIdleTime(o);
-        } else if (maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-            /* When we use an LRU policy, we sort the keys by idle time
-             * so that we expire keys starting from greater idle time.
-             * However when the policy is an LFU one, we have a frequency
-             * estimation, and we want to evict keys with lower frequency
-             * first. So inside the pool we put objects using the inverted
-             * frequency subtracting the actual frequency to the maximum
-             * frequency of 255. */
-            idle = 255-LFUDecrAndReturn(o);
-        } else if (maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
-            /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
-        } else {
-            // serverPanic("Unknown eviction policy in evictionPoolPopulate()");
-        }
+        for (j = best+1; j < pool->used; j++)
+            if (e[j].idle > e[best].idle) best = j;
 
-        /* Insert the element inside the pool.
-         * First, find the first empty bucket or the first populated
-         * bucket that has an idle time smaller than our idle time. */
-        k = 0;
-        while (k < EVPOOL_SIZE &&
-               pool[k].key &&
-               pool[k].idle < idle) k++;
-        if (k == 0 && pool[EVPOOL_SIZE-1].key != NULL) {
-            /* Can't insert if the element is < the worst element we have
-             * and there are no empty buckets. */
+        /* Replace it with the last entry, that can only move up. */
+        pool->used--;
+        evictionPoolSwap(pool,best,pool->used);
+        if (best < pool->used) evictionPoolSiftUp(pool,best);
+
+        de = dictFind(sampledict,e[pool->used].key);
+        if (de == NULL) {
+            /* Ghost... Iterate again. */
+            evictionPoolClearEntry(pool,pool->used);
             continue;
-        } else if (k < EVPOOL_SIZE && pool[k].key == NULL) {
-            /* Inserting into empty position. No setup needed before insert. */
-        } else {
-            /* Inserting in the middle. Now k points to the first element
-             * greater than the element to insert.  */
-            if (pool[EVPOOL_SIZE-1].key == NULL) {
-                /* Free space on the right? Insert at k shifting
-                 * all the elements from k to end to the right. */
-
-                /* Save SDS before overwriting. */
-                sds cached = pool[EVPOOL_SIZE-1].cached;
-                memmove(pool+k+1,pool+k,
-                    sizeof(pool[0])*(EVPOOL_SIZE-k-1));
-                pool[k].cached = cached;
-            } else {
-                /* No free space on right? Insert at k-1 */
-                k--;
-                /* Shift all elements on the left of k (included) to the
-                 * left, so we discard the element with smaller idle time. */
-                sds cached = pool[0].cached; /* Save SDS before overwriting. */
-                if (pool[0].key != pool[0].cached) sdsfree(pool[0].key);
-                memmove(pool,pool+1,sizeof(pool[0])*k);
-                pool[k].cached = cached;
-            }
         }
-
-        /* Try to reuse the cached SDS string allocated in the pool entry,
-         * because allocating and deallocating this object is costly
-         * (according to the profiler, not my fantasy. Remember:
-         * premature optimizbla bla bla bla. */
-        int klen = sdslen(key);
-        if (klen > EVPOOL_CACHED_SDS_SIZE) {
-            pool[k].key = sdsdup(key);
-        } else {
-            memcpy(pool[k].cached,key,klen+1);
-            sdssetlen(pool[k].cached,klen);
-            pool[k].key = pool[k].cached;
+        idle = evictionPoolScore(de,sampledict,keydict,maxmemory_policy,config,tlfu);
+        if (idle < e[pool->used].idle) {
+            /* The removed entry is the first free one: just put it back. */
+            e[pool->used].idle = idle;
+            evictionPoolSiftUp(pool,pool->used++);
+            continue;
         }
-        pool[k].idle = idle;
+        evictionPoolClearEntry(pool,pool->used);
+        pool->credit--;
+        return de;
     }
+    return NULL;
 }
 
 /* ----------------------------------------------------------------------------
@@ -284,7 +412,16 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
  * 16 bits. The returned time is suitable to be stored as LDT (last decrement
  * time) for the LFU implementation. */
 unsigned long LFUGetTimeInMinutes(void) {
-    return (time(NULL)/60) & 65535;
+    unsigned long lfuclock;
+    int cached;
+
+    atomicGet(clock_cached,cached);
+    if (cached) {
+        atomicGet(cached_lfuclock,lfuclock);
+    } else {
+        lfuclock = (time(NULL)/60) & 65535;
+    }
+    return lfuclock;
 }
 
 /* Given an object last access time, compute the minimum number of minutes
@@ -297,18 +434,46 @@ unsigned long LFUTimeElapsed(unsigned long ldt) {
     return 65535-ldt+now;
 }
 
+/* The probability to increment a counter with this value (minus
+ * LFU_INIT_VAL) is 1/(value*lfu_log_factor+1): here it is scaled to the
+ * range of a 32 bit random number. */
+#define LFU_INCR_THRESHOLD(v) \
+    ((uint32_t)(0xffffffffU/((v)*CONFIG_DEFAULT_LFU_LOG_FACTOR+1)))
+#define LFU_INCR_THRESHOLD4(v) LFU_INCR_THRESHOLD(v), LFU_INCR_THRESHOLD((v)+1), \
+    LFU_INCR_THRESHOLD((v)+2), LFU_INCR_THRESHOLD((v)+3)
+#define LFU_INCR_THRESHOLD16(v) LFU_INCR_THRESHOLD4(v), LFU_INCR_THRESHOLD4((v)+4), \
+    LFU_INCR_THRESHOLD4((v)+8), LFU_INCR_THRESHOLD4((v)+12)
+#define LFU_INCR_THRESHOLD64(v) LFU_INCR_THRESHOLD16(v), LFU_INCR_THRESHOLD16((v)+16), \
+    LFU_INCR_THRESHOLD16((v)+32), LFU_INCR_THRESHOLD16((v)+48)
+static const uint32_t lfu_incr_threshold[256] = {
+    LFU_INCR_THRESHOLD64(0), LFU_INCR_THRESHOLD64(64),
+    LFU_INCR_THRESHOLD64(128), LFU_INCR_THRESHOLD64(192)
+};
+
 /* Logarithmically increment a counter. The greater is the current counter value
  * the less likely is that it gets really implemented. Saturate it at 255. */
 uint8_t LFULogIncr(uint8_t counter) {
+    int baseval;
+
     if (counter == 255) return 255;
-    double r = (double)rand()/RAND_MAX;
-    double baseval = counter - LFU_INIT_VAL;
+    baseval = counter - LFU_INIT_VAL;
     if (baseval < 0) baseval = 0;
-    double p = 1.0/(baseval*CONFIG_DEFAULT_LFU_LOG_FACTOR+1);
-    if (r < p) counter++;
+    if ((uint32_t)redisRandom() <= lfu_incr_threshold[baseval]) counter++;
     return counter;
 }
 
+/* Return the number of accesses that are expected to take a counter from
+ * LFU_INIT_VAL to this value, plus LFU_INIT_VAL+1: the counters under the
+ * initial value, that were decremented, map to 1..LFU_INIT_VAL. Going from
+ * LFU_INIT_VAL+b to the next value takes b*lfu_log_factor+1 accesses. */
+unsigned long LFUEstimateAccesses(unsigned long counter) {
+    unsigned long b;
+
+    if (counter <= LFU_INIT_VAL) return counter+1;
+    b = counter - LFU_INIT_VAL;
+    return LFU_INIT_VAL+1 + b + CONFIG_DEFAULT_LFU_LOG_FACTOR*b*(b-1)/2;
+}
+
 /* If the object decrement time is reached decrement the LFU counter but
  * do not update LFU fields of the object, we update the access time
  * and counter in an explicit way when the object is really accessed.
@@ -319,13 +484,115 @@ uint8_t LFULogIncr(uint8_t counter) {
  * This function is used in order to scan the dataset for the best object
  * to fit: as we check for the candidate, we incrementally decrement the
  * counter of the scanned objects if needed. */
-unsigned long LFUDecrAndReturn(robj *o) {
+unsigned long LFUDecrAndReturn(robj *o, db_config *config) {
     unsigned long ldt = o->lru >> 8;
     unsigned long counter = o->lru & 255;
     int lfu_decay_time;
-    atomicGet(g_db_config.lfu_decay_time, lfu_decay_time);
+    atomicGet(config->lfu_decay_time, lfu_decay_time);
     unsigned long num_periods = lfu_decay_time ? LFUTimeElapsed(ldt) / lfu_decay_time : 0;
     if (num_periods)
         counter = (num_periods > counter) ? 0 : counter - num_periods;
     return counter;
 }
+
+/* ----------------------------------------------------------------------------
+ * W-TinyLFU frequency sketch, see tinyLfu in evict.h.
+ *
+ * Every row of the sketch is an array of 'width' 4 bit counters, packed
+ * 16 per word. A key increments one counter per row, at indexes derived
+ * from its hash by double hashing, and its frequency is the minimum of its
+ * counters. Only the counters equal to the minimum are incremented
+ * (conservative update), so that collisions inflate the estimate less.
+ * --------------------------------------------------------------------------*/
+
+#define TINYLFU_COUNTER_MAX 15
+
+tinyLfu *tinyLfuCreate(unsigned long keys) {
+    tinyLfu *t = zmalloc(sizeof(*t));
+    unsigned long width = TINYLFU_MIN_WIDTH;
+
+    while (width < keys*TINYLFU_KEY_COUNTERS && width < TINYLFU_MAX_WIDTH) width <<= 1;
+    t->table = zcallocate(sizeof(uint64_t)*TINYLFU_DEPTH*(width/16));
+    t->width = width;
+    t->additions = 0;
+    t->tick = 0;
+    return t;
+}
+
+void tinyLfuRelease(tinyLfu *t) {
+    if (t) {
+        zfree(t->table);
+        zfree(t);
+    }
+}
+
+/* Make the sketch wide enough for 'keys' keys. A new sketch is returned if
+ * the old one is too narrow: the counts are lost, but not the tick. */
+tinyLfu *tinyLfuEnsureCapacity(tinyLfu *t, unsigned long keys) {
+    tinyLfu *bigger;
+
+    if (t && (keys*TINYLFU_KEY_COUNTERS <= t->width ||
+              t->width >= TINYLFU_MAX_WIDTH)) return t;
+    bigger = tinyLfuCreate(keys);
+    if (t) {
+        bigger->tick = t->tick;
+        tinyLfuRelease(t);
+    }
+    return bigger;
+}
+
+/* Store in 'idx' the counter of every row for the key with this hash. */
+static void tinyLfuIndexes(tinyLfu *t, uint64_t hash, unsigned long *idx) {
+    uint64_t h2 = ((hash * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+    int i;
+
+    for (i = 0; i < TINYLFU_DEPTH; i++) {
+        idx[i] = i*t->width + ((hash + i*h2) & (t->width-1));
+    }
+}
+
+static unsigned int tinyLfuCounter(tinyLfu *t, unsigned long idx) {
+    return (t->table[idx>>4] >> ((idx&15)<<2)) & 15;
+}
+
+/* Halve all the counters. */
+static void tinyLfuAge(tinyLfu *t) {
+    unsigned long j, words = TINYLFU_DEPTH*(t->width/16);
+
+    for (j = 0; j < words; j++)
+        t->table[j] = (t->table[j] >> 1) & 0x7777777777777777ULL;
+    t->additions /= 2;
+}
+
+/* Count an access to the key with this hash, and advance the tick. */
+void tinyLfuRecord(tinyLfu *t, uint64_t hash) {
+    unsigned long idx[TINYLFU_DEPTH];
+    unsigned int c[TINYLFU_DEPTH], min = TINYLFU_COUNTER_MAX;
+    int i;
+
+    t->tick = (t->tick+1) & LRU_CLOCK_MAX;
+    tinyLfuIndexes(t,hash,idx);
+    for (i = 0; i < TINYLFU_DEPTH; i++) {
+        c[i] = tinyLfuCounter(t,idx[i]);
+        if (c[i] < min) min = c[i];
+    }
+    if (min == TINYLFU_COUNTER_MAX) return;
+    for (i = 0; i < TINYLFU_DEPTH; i++) {
+        if (c[i] == min) t->table[idx[i]>>4] += 1ULL << ((idx[i]&15)<<2);
+    }
+    if (++t->additions >= TINYLFU_SAMPLE_FACTOR*t->width) tinyLfuAge(t);
+}
+
+/* Return the estimated frequency of the key with this hash, 0-15. */
+unsigned int tinyLfuFrequency(tinyLfu *t, uint64_t hash) {
+    unsigned long idx[TINYLFU_DEPTH];
+    unsigned int c, min = TINYLFU_COUNTER_MAX;
+    int i;
+
+    tinyLfuIndexes(t,hash,idx);
+    for (i = 0; i < TINYLFU_DEPTH; i++) {
+        c = tinyLfuCounter(t,idx[i]);
+        if (c < min) min = c;
+    }
+    return min;
+}
@@ -11,15 +11,22 @@
 /* To improve the quality of the LRU approximation we take a set of keys
  * that are good candidate for eviction across freeMemoryIfNeeded() calls.
  *
- * Entries inside the eviciton pool are taken ordered by idle time, putting
- * greater idle times to the right (ascending order).
+ * Entries inside the eviciton pool are kept in a min heap by idle time, so
+ * that the worst candidate, the one a better sample replaces, is always
+ * the first entry.
  *
  * When an LFU policy is used instead, a reverse frequency indication is used
  * instead of the idle time, so that we still evict by larger value (larger
  * inverse frequency means to evict keys with the least frequent accesses).
  *
- * Empty entries have the key pointer set to NULL. */
+ * The pool has db_config.maxmemory_eviction_pool entries, EVPOOL_SIZE by
+ * default. A pool bigger than EVPOOL_SIZE keeps enough good candidates to
+ * serve a few evictions per sampling round: every round samples
+ * maxmemory_samples keys for each of the size/EVPOOL_SIZE evictions that
+ * follow it, with a single dictGetSomeKeys() call. */
 #define EVPOOL_SIZE 16
+#define EVPOOL_MAX_SIZE 1024
+#define EVPOOL_MAX_SAMPLES 256      /* Keys sampled per dictGetSomeKeys() call */
 #define EVPOOL_CACHED_SDS_SIZE 255
 struct evictionPoolEntry {
     unsigned long long idle;    /* Object idle time (inverse frequency for LFU) */
@@ -27,18 +34,63 @@ struct evictionPoolEntry {
     sds cached;                 /* Cached SDS object for key name. */
 };
 
+typedef struct evictionPool {
+    int size;                   /* Number of entries */
+    int used;                   /* Entries with a key, entries[0] is the worst */
+    int credit;                 /* Evictions left before sampling again */
+    struct evictionPoolEntry entries[];
+} evictionPool;
+
+void updateCachedClock(void);
 unsigned int getLRUClock(void);
 unsigned int LRU_CLOCK(void);
 unsigned long long estimateObjectIdleTime(robj *o);
 
-struct evictionPoolEntry* evictionPoolAlloc(void);
-void evictionPoolDestroy(struct evictionPoolEntry *pool);
-void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEntry *pool);
+/* W-TinyLFU: the access frequency of keys, including the ones not in the
+ * DB, is estimated by a count-min sketch of 4 bit counters, that are all
+ * halved every TINYLFU_SAMPLE_FACTOR*width accesses so that the sketch
+ * follows the changes of the access pattern. The 'lru' field of the values
+ * holds the 'tick' of their last access instead of a time, and the keys
+ * accessed in the last TINYLFU_WINDOW_PERC% of the keys are never evicted
+ * before the others: the window gives new keys the time to be accessed
+ * again. Outside of the window the key with the lowest frequency is
+ * evicted first, and the oldest among the ones with the same frequency. */
+#define TINYLFU_DEPTH 4             /* Rows of the sketch */
+#define TINYLFU_MIN_WIDTH 1024      /* Counters per row */
+#define TINYLFU_MAX_WIDTH (1<<26)
+#define TINYLFU_KEY_COUNTERS 2      /* Counters per row for every key */
+#define TINYLFU_SAMPLE_FACTOR 10
+#define TINYLFU_WINDOW_PERC 1
+typedef struct tinyLfu {
+    uint64_t *table;            /* TINYLFU_DEPTH rows of 'width' counters */
+    unsigned long width;        /* Power of two */
+    unsigned long additions;    /* Increments since the counters were halved */
+    unsigned int tick;          /* Accesses recorded, LRU_CLOCK_MAX wrapping */
+} tinyLfu;
+
+tinyLfu *tinyLfuCreate(unsigned long keys);
+void tinyLfuRelease(tinyLfu *t);
+tinyLfu *tinyLfuEnsureCapacity(tinyLfu *t, unsigned long keys);
+void tinyLfuRecord(tinyLfu *t, uint64_t hash);
+unsigned int tinyLfuFrequency(tinyLfu *t, uint64_t hash);
+
+evictionPool *evictionPoolAlloc(int size);
+void evictionPoolDestroy(evictionPool *pool);
+void evictionPoolPopulate(dict *sampledict, dict *keydict, evictionPool *pool, db_config *config, tinyLfu *tlfu);
+dictEntry *evictionPoolPopBest(evictionPool *pool, dict *sampledict, dict *keydict, db_config *config, tinyLfu *tlfu);
+
+/* GDSF: the values are scored by estimated size over access frequency, so
+ * that a big value rarely accessed is evicted before many small ones. The
+ * frequency is derived from the LFU counter, that the policy maintains just
+ * like allkeys-lfu, and the size is estimated sampling GDSF_SIZE_SAMPLES
+ * elements of aggregate values, so scoring never walks a value. */
+#define GDSF_SIZE_SAMPLES 1
 
 #define LFU_INIT_VAL 5
 unsigned long LFUGetTimeInMinutes(void);
 uint8_t LFULogIncr(uint8_t value);
-unsigned long LFUDecrAndReturn(robj *o);
+unsigned long LFUEstimateAccesses(unsigned long counter);
+unsigned long LFUDecrAndReturn(robj *o, db_config *config);
 
 
 #endif
@@ -0,0 +1,119 @@
+/*
+   Fast non cryptographic hash function for the dictionaries.
+
+   The construction is the one of wyhash by Wang Yi, that is released in the
+   public domain (The Unlicense): the input is consumed 16 bytes at a time,
+   and every pair of 64 bit words is mixed by a full 64x64->128 bit
+   multiplication, folding the high half of the product into the low half.
+   Inputs longer than 48 bytes are processed by three independent lanes so
+   that the multiplications of the lanes can be executed in parallel by the
+   CPU. Keys up to 16 bytes, the common case, need just two multiplications.
+
+   This function is *not* resistant to hash flooding: an attacker able to
+   choose the keys can make them collide on purpose, even without knowing
+   the seed. It must only be used for handles explicitly created with the
+   fast hash option, when the keys come from trusted clients. Everything
+   else uses SipHash (see siphash.c).
+
+   The function reads the input as little endian words, so on big endian
+   CPUs the hash values are different, but just as good.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#define FH_P0 0xa0761d6478bd642fULL
+#define FH_P1 0xe7037ed1a0b428dbULL
+#define FH_P2 0x8ebc6af09c88c6e3ULL
+#define FH_P3 0x589965cc75374cc3ULL
+
+/* Multiply 'a' and 'b' as 128 bit numbers, and store the low 64 bits of
+ * the product in 'a' and the high 64 bits in 'b'. */
+static inline void fhMum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 fh_uint128;
+    fh_uint128 r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl, lo, hi;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline uint64_t fhMix(uint64_t a, uint64_t b) {
+    fhMum(&a,&b);
+    return a ^ b;
+}
+
+static inline uint64_t fhRead64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v,p,sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t fhRead32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v,p,sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+/* Same prototype of siphash(): 'k' is the 16 bytes seed of the dicts. */
+uint64_t fasthash(const uint8_t *in, const size_t inlen, const uint8_t *k) {
+    const uint8_t *p = in;
+    uint64_t seed = fhRead64(k) ^ fhRead64(k+8);
+    uint64_t a, b;
+
+    seed ^= fhMix(seed ^ FH_P0, FH_P1);
+    if (inlen <= 16) {
+        if (inlen >= 4) {
+            /* Two overlapping 32 bit reads from each end cover the key. */
+            size_t mid = (inlen >> 3) << 2;
+            a = (fhRead32(p) << 32) | fhRead32(p+mid);
+            b = (fhRead32(p+inlen-4) << 32) | fhRead32(p+inlen-4-mid);
+        } else if (inlen > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[inlen>>1] << 8) | p[inlen-1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = inlen;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = fhMix(fhRead64(p) ^ FH_P1, fhRead64(p+8) ^ seed);
+                see1 = fhMix(fhRead64(p+16) ^ FH_P2, fhRead64(p+24) ^ see1);
+                see2 = fhMix(fhRead64(p+32) ^ FH_P3, fhRead64(p+40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = fhMix(fhRead64(p) ^ FH_P1, fhRead64(p+8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        /* The last 16 bytes, overlapping what was already consumed. */
+        a = fhRead64(p+i-16);
+        b = fhRead64(p+i-8);
+    }
+
+    a ^= FH_P1;
+    b ^= seed;
+    fhMum(&a,&b);
+    return fhMix(a ^ FH_P0 ^ inlen, b ^ FH_P1);
+}
@@ -34,6 +34,19 @@
 #include "intset.h"
 #include "zmalloc.h"
 #include "endianconv.h"
+#include "util.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* The AVX2 kernels are compiled with a target attribute and selected at
+ * runtime, so the library still runs on CPUs without AVX2. */
+#if defined(__x86_64__) && defined(__GNUC__) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define INTSET_HAVE_AVX2 1
+#endif
 
 /* Note that these encodings are ordered, so:
  * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
@@ -108,23 +121,137 @@ static intset *intsetResize(intset *is, uint32_t len) {
     return is;
 }
 
+/* Once the binary search narrowed the range down to this many bytes, the
+ * rest of the range is scanned linearly, comparing a vector of elements at
+ * a time where SIMD is available. */
+#define INTSET_SCAN_BYTES 128
+
+/* Return how many of the 'n' elements starting at 'pos' are smaller than
+ * 'value'. Since the elements are sorted this is the position of the first
+ * element not smaller than 'value', relative to 'pos'. */
+static uint32_t intsetRankScalar(intset *is, uint32_t pos, uint32_t n,
+                                 int64_t value, uint8_t enc)
+{
+    uint32_t i = 0;
+
+    while (i < n && _intsetGetEncoded(is,pos+i,enc) < value) i++;
+    return i;
+}
+
+#if defined(__SSE2__)
+/* Same as intsetRankScalar() for the 16 and 32 bit encodings, that SSE2
+ * can compare. 'value' must be representable with the encoding. */
+static uint32_t intsetRankSSE2(const int8_t *p, uint32_t n, int64_t value,
+                               uint8_t enc)
+{
+    uint32_t i = 0, rank = 0, lanes = sizeof(__m128i)/enc;
+    unsigned int m;
+    __m128i v, x;
+
+    v = (enc == INTSET_ENC_INT16) ? _mm_set1_epi16((int16_t)value) :
+                                    _mm_set1_epi32((int32_t)value);
+    for (; i+lanes <= n; i += lanes) {
+        x = _mm_loadu_si128((const __m128i*)(p+i*enc));
+        x = (enc == INTSET_ENC_INT16) ? _mm_cmpgt_epi16(v,x) :
+                                        _mm_cmpgt_epi32(v,x);
+        m = (unsigned int)_mm_movemask_epi8(x);
+        rank += __builtin_ctz(~m);
+    }
+    rank /= enc;
+    for (; i < n; i++) {
+        int64_t cur = (enc == INTSET_ENC_INT16) ? ((const int16_t*)p)[i] :
+                                                  ((const int32_t*)p)[i];
+        rank += cur < value;
+    }
+    return rank;
+}
+#endif
+
+#if defined(INTSET_HAVE_AVX2)
+/* Same as intsetRankScalar() for every encoding, using AVX2 compares. */
+__attribute__((target("avx2")))
+static uint32_t intsetRankAVX2(const int8_t *p, uint32_t n, int64_t value,
+                               uint8_t enc)
+{
+    uint32_t i = 0, rank = 0, lanes = sizeof(__m256i)/enc;
+    unsigned int m;
+    __m256i v, x;
+
+    if (enc == INTSET_ENC_INT16) v = _mm256_set1_epi16((int16_t)value);
+    else if (enc == INTSET_ENC_INT32) v = _mm256_set1_epi32((int32_t)value);
+    else v = _mm256_set1_epi64x(value);
+
+    for (; i+lanes <= n; i += lanes) {
+        x = _mm256_loadu_si256((const __m256i*)(p+i*enc));
+        if (enc == INTSET_ENC_INT16) x = _mm256_cmpgt_epi16(v,x);
+        else if (enc == INTSET_ENC_INT32) x = _mm256_cmpgt_epi32(v,x);
+        else x = _mm256_cmpgt_epi64(v,x);
+        m = (unsigned int)_mm256_movemask_epi8(x);
+        rank += __builtin_ctzll(~(unsigned long long)m);
+    }
+    rank /= enc;
+    for (; i < n; i++) {
+        int64_t cur;
+        if (enc == INTSET_ENC_INT16) cur = ((const int16_t*)p)[i];
+        else if (enc == INTSET_ENC_INT32) cur = ((const int32_t*)p)[i];
+        else cur = ((const int64_t*)p)[i];
+        rank += cur < value;
+    }
+    return rank;
+}
+#endif
+
+/* Dispatch to the fastest rank kernel supported by this CPU. The SIMD
+ * kernels read the contents in place, so they are only used on little
+ * endian targets, where no byte swapping is needed. */
+static uint32_t intsetRank(intset *is, uint32_t pos, uint32_t n,
+                           int64_t value, uint8_t enc)
+{
+#if defined(INTSET_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        return intsetRankAVX2(is->contents+pos*enc,n,value,enc);
+#endif
+#if defined(__SSE2__)
+    if (enc != INTSET_ENC_INT64)
+        return intsetRankSSE2(is->contents+pos*enc,n,value,enc);
+#endif
+    return intsetRankScalar(is,pos,n,value,enc);
+}
+
+/* Return the position of the first element not smaller than "value" in the
+ * range [min, max), or max if there is none. "value" must be representable
+ * with the encoding of the intset. */
+static uint32_t intsetLowerBound(intset *is, uint32_t min, uint32_t max,
+                                 int64_t value)
+{
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t n = max-min, half, window = INTSET_SCAN_BYTES/enc;
+
+    /* Branch free halving: the lower bound stays in [min, min+n]. */
+    while (n > window) {
+        half = n>>1;
+        min = (_intsetGetEncoded(is,min+half,enc) < value) ? min+half : min;
+        n -= half;
+    }
+    return min+intsetRank(is,min,n,value,enc);
+}
+
 /* Search for the position of "value". Return 1 when the value was found and
  * sets "pos" to the position of the value within the intset. Return 0 when
  * the value is not present in the intset and sets "pos" to the position
  * where "value" can be inserted. */
 static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
-    int min = 0, max = intrev32ifbe(is->length)-1, mid = -1;
-    int64_t cur = -1;
+    uint32_t len = intrev32ifbe(is->length), idx;
 
     /* The value can never be found when the set is empty */
-    if (intrev32ifbe(is->length) == 0) {
+    if (len == 0) {
         if (pos) *pos = 0;
         return 0;
     } else {
         /* Check for the case where we know we cannot find the value,
          * but do know the insert position. */
-        if (value > _intsetGet(is,intrev32ifbe(is->length)-1)) {
-            if (pos) *pos = intrev32ifbe(is->length);
+        if (value > _intsetGet(is,len-1)) {
+            if (pos) *pos = len;
             return 0;
         } else if (value < _intsetGet(is,0)) {
             if (pos) *pos = 0;
@@ -132,25 +259,11 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
         }
     }
 
-    while(max >= min) {
-        mid = ((unsigned int)min + (unsigned int)max) >> 1;
-        cur = _intsetGet(is,mid);
-        if (value > cur) {
-            min = mid+1;
-        } else if (value < cur) {
-            max = mid-1;
-        } else {
-            break;
-        }
-    }
-
-    if (value == cur) {
-        if (pos) *pos = mid;
-        return 1;
-    } else {
-        if (pos) *pos = min;
-        return 0;
-    }
+    /* Here _intsetGet(is,0) <= value <= _intsetGet(is,len-1), so the
+     * lower bound is always a valid position. */
+    idx = intsetLowerBound(is,0,len,value);
+    if (pos) *pos = idx;
+    return _intsetGet(is,idx) == value;
 }
 
 /* Upgrades the intset to a larger encoding and inserts the given integer. */
@@ -256,9 +369,48 @@ uint8_t intsetFind(intset *is, int64_t value) {
     return valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,NULL);
 }
 
+/* Look up the "count" values of the array "values", that must be sorted in
+ * ascending order, setting found[j] to 1 when values[j] belongs to the set
+ * and to 0 otherwise. The set is walked once: every lookup starts where the
+ * previous one stopped, so looking up many values costs less than calling
+ * intsetFind() for each of them. */
+void intsetFindSorted(intset *is, const int64_t *values, uint32_t count,
+                      uint8_t *found)
+{
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t len = intrev32ifbe(is->length), lo = 0, hi, step, j;
+    uint32_t window = INTSET_SCAN_BYTES/enc;
+
+    for (j = 0; j < count; j++) {
+        int64_t value = values[j];
+
+        found[j] = 0;
+        /* Values not representable with the current encoding are either
+         * smaller or greater than every element. */
+        if (lo == len || _intsetValueEncoding(value) > enc) continue;
+
+        /* Every element before "lo" is smaller than "value". When the
+         * values left are sparse compared to the elements left, a plain
+         * search of the rest of the set is faster, otherwise gallop. */
+        if ((len-lo)/(count-j) > window) {
+            lo = intsetLowerBound(is,lo,len,value);
+        } else {
+            hi = lo;
+            step = 1;
+            while (hi < len && _intsetGetEncoded(is,hi,enc) < value) {
+                lo = hi+1;
+                hi = (len-hi > step) ? hi+step : len;
+                step <<= 1;
+            }
+            if (lo < hi) lo = intsetLowerBound(is,lo,hi,value);
+        }
+        found[j] = lo < len && _intsetGetEncoded(is,lo,enc) == value;
+    }
+}
+
 /* Return random member */
 int64_t intsetRandom(intset *is) {
-    return _intsetGet(is,rand()%intrev32ifbe(is->length));
+    return _intsetGet(is,redisRandom()%intrev32ifbe(is->length));
 }
 
 /* Get the value at the given position. When this position is
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "lazyfree.h"
+#include "atomicvar.h"
+#include "commondef.h"
+#include "quicklist.h"
+#include "zmalloc.h"
+#include "zset.h"
+
+/* Jobs of the lazy free thread, run in the order they were queued. Objects
+ * and keyspaces are queued with the DB they belonged to, so that the thread
+ * frees them on behalf of the right zmalloc owner, and with their estimated
+ * size, accounted in db->lazyfree_pending_mem meanwhile. */
+#define LAZYFREE_JOB_OBJ 0          /* Release 'obj' */
+#define LAZYFREE_JOB_KEYSPACE 1     /* Release the 'dict' and 'expires' tables */
+#define LAZYFREE_JOB_CALLBACK 2     /* Call 'callback', nothing to free */
+typedef struct lazyfreeJob {
+    struct lazyfreeJob *next;
+    int type;
+    redisDb *db;
+    size_t size;
+    robj *obj;
+    dict *dict, *expires;
+    void (*callback)(void *privdata);
+    void *privdata;
+} lazyfreeJob;
+
+static pthread_once_t lazyfree_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t lazyfree_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lazyfree_newjob_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t lazyfree_done_cond = PTHREAD_COND_INITIALIZER;
+static lazyfreeJob *lazyfree_head = NULL, *lazyfree_tail = NULL;
+static size_t lazyfree_objects = 0; /* Jobs queued or running */
+
+/* The pending memory is accounted for the DB and for its whole handle. */
+static void lazyfreePendingIncr(redisDb *db, size_t size) {
+    atomicIncr(db->lazyfree_pending_mem,size);
+    atomicIncr(db->handle->lazyfree_pending_mem,size);
+}
+
+static void lazyfreePendingDecr(redisDb *db, size_t size) {
+    atomicDecr(db->lazyfree_pending_mem,size);
+    atomicDecr(db->handle->lazyfree_pending_mem,size);
+}
+
+/* Return the amount of work needed in order to free an object.
+ * The return value is not always the actual number of allocations the
+ * object is composed of, but a number proportional to it.
+ *
+ * For strings the function always returns 1.
+ *
+ * For aggregated objects represented by hash tables or other data structures
+ * the function just returns the number of elements the object is composed of.
+ *
+ * Objects composed of single allocations are always reported as having a
+ * single item even if they are actually logical composed of multiple
+ * elements.
+ *
+ * For lists the function returns the number of elements in the quicklist
+ * representing the list. */
+size_t lazyfreeGetFreeEffort(robj *obj) {
+    if (obj->type == OBJ_LIST) {
+        quicklist *ql = obj->ptr;
+        return ql->len;
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
+        zset *zs = obj->ptr;
+        return zs->zsl->length;
+    } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else {
+        return 1; /* Everything else is a single allocation. */
+    }
+}
+
+static void lazyfreeProcessJob(lazyfreeJob *job) {
+    int prev_owner;
+
+    if (job->type == LAZYFREE_JOB_CALLBACK) {
+        job->callback(job->privdata);
+        zfree(job);
+        return;
+    }
+
+    prev_owner = zmalloc_set_owner(job->db->owner);
+    if (job->type == LAZYFREE_JOB_OBJ) {
+        decrRefCount(job->obj);
+    } else {
+        /* The expires share the keys of the main dict, but never free them. */
+        dictRelease(job->expires);
+        dictRelease(job->dict);
+    }
+    lazyfreePendingDecr(job->db,job->size);
+    zfree(job);
+    zmalloc_set_owner(prev_owner);
+}
+
+static void *lazyfreeProcessJobs(void *arg) {
+    lazyfreeJob *job;
+
+    UNUSED(arg);
+    pthread_mutex_lock(&lazyfree_mutex);
+    while(1) {
+        if (lazyfree_head == NULL) {
+            pthread_cond_wait(&lazyfree_newjob_cond,&lazyfree_mutex);
+            continue;
+        }
+        job = lazyfree_head;
+        lazyfree_head = job->next;
+        if (lazyfree_head == NULL) lazyfree_tail = NULL;
+        pthread_mutex_unlock(&lazyfree_mutex);
+
+        lazyfreeProcessJob(job);
+        pthread_mutex_lock(&lazyfree_mutex);
+        if (--lazyfree_objects == 0) pthread_cond_broadcast(&lazyfree_done_cond);
+    }
+    return NULL;
+}
+
+static void lazyfreeInit(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread,&attr,lazyfreeProcessJobs,NULL) != 0) {
+        fprintf(stderr,"Fatal: can't initialize the lazy free thread.\n");
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* Append a job, allocated with zcallocate(), to the queue of the thread. */
+static void lazyfreeQueueJob(lazyfreeJob *job) {
+    pthread_once(&lazyfree_once,lazyfreeInit);
+    pthread_mutex_lock(&lazyfree_mutex);
+    if (lazyfree_tail) lazyfree_tail->next = job;
+    else lazyfree_head = job;
+    lazyfree_tail = job;
+    lazyfree_objects++;
+    pthread_cond_signal(&lazyfree_newjob_cond);
+    pthread_mutex_unlock(&lazyfree_mutex);
+}
+
+/* Block until the lazy free thread released every queued object. Must be
+ * called before a DB is released, since the thread may still be freeing
+ * its values. */
+void lazyfreeWaitPendingObjects(void) {
+    pthread_mutex_lock(&lazyfree_mutex);
+    while (lazyfree_objects) pthread_cond_wait(&lazyfree_done_cond,&lazyfree_mutex);
+    pthread_mutex_unlock(&lazyfree_mutex);
+}
+
+/* Release the reference to 'obj', a value of 'db' that is no longer
+ * reachable from the keyspace. If this is the last reference and the
+ * object is big enough, the lazy free thread releases it instead of the
+ * caller. Until then its estimated size is in db->lazyfree_pending_mem,
+ * so that the eviction does not free the same memory twice. */
+void freeObjAsync(redisDb *db, robj *obj) {
+    if (obj->refcount == 1 && lazyfreeGetFreeEffort(obj) > LAZYFREE_THRESHOLD) {
+        lazyfreeJob *job = zcallocate(sizeof(*job));
+
+        job->type = LAZYFREE_JOB_OBJ;
+        job->obj = obj;
+        job->db = db;
+        job->size = objectComputeSize(obj,OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+        lazyfreePendingIncr(db,job->size);
+        lazyfreeQueueJob(job);
+    } else {
+        decrRefCount(obj);
+    }
+}
+
+/* Delete a key, value, and associated expiration entry if any, from the DB.
+ * If there are enough allocations to free the value object may be put into
+ * a lazy free list instead of being freed synchronously. The lazy free list
+ * will be reclaimed in a different thread. */
+int dbAsyncDeleteWithHash(redisDb *db, robj *key, uint64_t hash) {
+    dictEntry *de;
+
+    /* Deleting an entry from the expires dict will not free the sds of
+     * the key, because it is shared with the main dictionary. */
+    if (dictSize(db->expires) > 0) dictDeleteWithHash(db->expires,key->ptr,hash);
+
+    /* If the value is composed of a few allocations, to free in a lazy way
+     * is actually just slower... So under a certain limit we just free
+     * the object synchronously. Values holding their key are strings, so
+     * the key is never released by the thread. */
+    de = dictUnlinkWithHash(db->dict,key->ptr,hash);
+    if (de == NULL) return 0;
+    if (!objectGetEmbeddedKey(dictGetVal(de))) {
+        freeObjAsync(db,dictGetVal(de));
+        dictSetVal(db->dict,de,NULL);
+    }
+
+    /* Release the key, and the value if it was not detached above. */
+    dictFreeUnlinkedEntry(db->dict,de);
+    return 1;
+}
+
+int dbAsyncDelete(redisDb *db, robj *key) {
+    return dbAsyncDeleteWithHash(db,key,dbKeyHash(db,key));
+}
+
+/* Empty a Redis DB asynchronously. What the function does actually is to
+ * create a new empty set of hash tables and scheduling the old ones for
+ * lazy freeing, so the call takes constant time whatever the size of the
+ * DB. Everything the DB used but its empty structures is accounted as
+ * pending until the thread released it. Returns the number of keys
+ * removed. */
+long long emptyDbAsync(redisDb *db) {
+    lazyfreeJob *job;
+    long long removed = dictSize(db->dict);
+    size_t used = dbUsedMemory(db), pending;
+
+    if (removed == 0 && dictSize(db->expires) == 0) return 0;
+    atomicGet(db->lazyfree_pending_mem, pending);
+    job = zcallocate(sizeof(*job));
+    job->type = LAZYFREE_JOB_KEYSPACE;
+    job->db = db;
+    job->dict = db->dict;
+    job->expires = db->expires;
+    job->size = used > pending+db->empty_mem ? used-pending-db->empty_mem : 0;
+    db->dict = dictCreateWithFlags(job->dict->type,job->dict->privdata,job->dict->flags);
+    db->expires = dictCreateWithFlags(job->expires->type,job->expires->privdata,job->expires->flags);
+    lazyfreePendingIncr(db,job->size);
+    atomicSet(db->stats.stat_keyspace_hits, 0);
+    atomicSet(db->stats.stat_keyspace_misses, 0);
+    lazyfreeQueueJob(job);
+    return removed;
+}
+
+/* Call 'callback' from the lazy free thread once everything queued so far
+ * has been released. */
+void lazyfreeCallWhenDone(void (*callback)(void *privdata), void *privdata) {
+    lazyfreeJob *job = zcallocate(sizeof(*job));
+
+    job->type = LAZYFREE_JOB_CALLBACK;
+    job->callback = callback;
+    job->privdata = privdata;
+    lazyfreeQueueJob(job);
+}
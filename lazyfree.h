@@ -0,0 +1,20 @@
+#ifndef __LAZYFREE_H__
+#define __LAZYFREE_H__
+
+#include "object.h"
+#include "db.h"
+
+/* Values whose free effort (see lazyfreeGetFreeEffort()) is above this
+ * threshold are released by the lazy free thread, smaller ones are freed
+ * synchronously since queueing them would cost more than freeing them. */
+#define LAZYFREE_THRESHOLD 64
+
+size_t lazyfreeGetFreeEffort(robj *obj);
+void lazyfreeWaitPendingObjects(void);
+void freeObjAsync(redisDb *db, robj *obj);
+int dbAsyncDeleteWithHash(redisDb *db, robj *key, uint64_t hash);
+int dbAsyncDelete(redisDb *db, robj *key);
+long long emptyDbAsync(redisDb *db);
+void lazyfreeCallWhenDone(void (*callback)(void *privdata), void *privdata);
+
+#endif
@@ -0,0 +1,619 @@
+/* Listpack -- A lists of strings serialization format
+ *
+ * The listpack replaces the ziplist as the compact encoding of small hashes,
+ * sorted sets and quicklist nodes. The layout is the one of the Redis
+ * listpack specification:
+ *
+ * <tot-bytes> <num-elements> <element-1> ... <element-N> <listpack-end-byte>
+ *
+ * <tot-bytes> is an unsigned 32 bit little endian integer holding the size
+ * of the whole listpack, header and terminator included. <num-elements> is
+ * an unsigned 16 bit little endian integer holding the number of elements,
+ * or 65535 when the number is too big to fit and must be computed by
+ * scanning the listpack. The end byte is always 255.
+ *
+ * Every element is stored as:
+ *
+ * <encoding-type><element-data><element-tot-len>
+ *
+ * where the encoding byte tells if the element is an integer or a string
+ * (and for small values also holds the value or the string length), and
+ * <element-tot-len> is the size of <encoding-type><element-data>, stored
+ * with a variable length encoding that can be parsed right to left, so that
+ * the list can be traversed backward.
+ *
+ * The main difference with the ziplist is that an element only stores its
+ * own length, not the length of the previous one. Inserting or deleting an
+ * element never changes the neighbours, so there is no cascading update:
+ * every change is a single memmove plus at most one reallocation.
+ *
+ * The encodings are:
+ *
+ * 0xxxxxxx                         7 bit unsigned integer.
+ * 10xxxxxx <data>                  String up to 63 bytes.
+ * 110xxxxx yyyyyyyy                13 bit signed integer.
+ * 1110xxxx yyyyyyyy <data>         String up to 4095 bytes.
+ * 11110000 <4 bytes len> <data>    String up to 2^32-1 bytes.
+ * 11110001 <2 bytes>               16 bit signed integer.
+ * 11110010 <3 bytes>               24 bit signed integer.
+ * 11110011 <4 bytes>               32 bit signed integer.
+ * 11110100 <8 bytes>               64 bit signed integer.
+ * 11111111                         End of listpack.
+ *
+ * Multi byte integers and lengths are little endian. Strings that are the
+ * canonical representation of a 64 bit integer are always stored as
+ * integers, so comparing an element with a string never needs to convert
+ * the element.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "listpack.h"
+#include "zmalloc.h"
+#include "util.h"
+
+#define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_EOF 0xFF
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+
+#define LP_ENCODING_IS_STRING(byte) (LP_ENCODING_IS_6BIT_STR(byte) || \
+                                     LP_ENCODING_IS_12BIT_STR(byte) || \
+                                     (byte) == LP_ENCODING_32BIT_STR)
+
+#define lpGetTotalBytes(lp) \
+    (((uint32_t)(lp)[0]) | ((uint32_t)(lp)[1] << 8) | \
+     ((uint32_t)(lp)[2] << 16) | ((uint32_t)(lp)[3] << 24))
+#define lpGetNumElements(lp) (((uint32_t)(lp)[4]) | ((uint32_t)(lp)[5] << 8))
+#define lpSetTotalBytes(lp,v) do { \
+    (lp)[0] = (v)&0xff; \
+    (lp)[1] = ((v)>>8)&0xff; \
+    (lp)[2] = ((v)>>16)&0xff; \
+    (lp)[3] = ((v)>>24)&0xff; \
+} while(0)
+#define lpSetNumElements(lp,v) do { \
+    (lp)[4] = (v)&0xff; \
+    (lp)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/* Create a new, empty listpack. */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Return the total number of bytes the listpack is composed of. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Store the encoding of the integer 'v' into 'intenc' and return the
+ * number of bytes used. */
+static unsigned long lpEncodeInteger(long long v, unsigned char *intenc) {
+    if (v >= 0 && v <= 127) {
+        intenc[0] = v;
+        return 1;
+    } else if (v >= -4096 && v <= 4095) {
+        if (v < 0) v = ((int64_t)1<<13)+v;
+        intenc[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+        intenc[1] = v&0xff;
+        return 2;
+    } else if (v >= -32768 && v <= 32767) {
+        if (v < 0) v = ((int64_t)1<<16)+v;
+        intenc[0] = LP_ENCODING_16BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = v>>8;
+        return 3;
+    } else if (v >= -8388608 && v <= 8388607) {
+        if (v < 0) v = ((int64_t)1<<24)+v;
+        intenc[0] = LP_ENCODING_24BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = v>>16;
+        return 4;
+    } else if (v >= INT32_MIN && v <= INT32_MAX) {
+        if (v < 0) v = ((int64_t)1<<32)+v;
+        intenc[0] = LP_ENCODING_32BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = (v>>16)&0xff;
+        intenc[4] = v>>24;
+        return 5;
+    } else {
+        uint64_t uv = v;
+        int j;
+        intenc[0] = LP_ENCODING_64BIT_INT;
+        for (j = 1; j <= 8; j++) {
+            intenc[j] = uv&0xff;
+            uv >>= 8;
+        }
+        return 9;
+    }
+}
+
+/* Return the size of the encoding plus data of a string of length 'len'. */
+static unsigned long lpStringEncodedSize(uint32_t len) {
+    if (len < 64) return 1+len;
+    else if (len < 4096) return 2+len;
+    else return 5+(unsigned long)len;
+}
+
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf+1,s,len);
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf+2,s,len);
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf+5,s,len);
+    }
+}
+
+/* Store the reverse encoded length 'l' into 'buf' and return the number of
+ * bytes needed. If 'buf' is NULL just return the number of bytes. The byte
+ * at the lowest address has the high bit clear, all the others have it set,
+ * so that the length can be parsed starting from its last byte. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    unsigned long len, j;
+
+    if (l <= 127) len = 1;
+    else if (l < 16383) len = 2;
+    else if (l < 2097151) len = 3;
+    else if (l < 268435455) len = 4;
+    else len = 5;
+
+    if (buf) {
+        for (j = len; j > 0; j--) {
+            buf[j-1] = l & 127;
+            if (j != 1) buf[j-1] |= 128;
+            l >>= 7;
+        }
+    }
+    return len;
+}
+
+/* Decode the backlen whose last byte is pointed by 'p'. */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+    } while (shift <= 28);
+    return val;
+}
+
+/* Return the size of the encoding plus data of the element at 'p', without
+ * the backlen. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+(p[0]&0x3F);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+(((p[0]&0xF)<<8)|p[1]);
+    switch (p[0]) {
+    case LP_ENCODING_16BIT_INT: return 3;
+    case LP_ENCODING_24BIT_INT: return 4;
+    case LP_ENCODING_32BIT_INT: return 5;
+    case LP_ENCODING_64BIT_INT: return 9;
+    case LP_ENCODING_32BIT_STR:
+        return 5+((uint32_t)p[1]|((uint32_t)p[2]<<8)|
+                  ((uint32_t)p[3]<<16)|((uint32_t)p[4]<<24));
+    case LP_EOF: return 1;
+    }
+    assert(0);
+    return 0;
+}
+
+/* Skip the element at 'p' returning the address of the next one, which
+ * may be the end byte. */
+static unsigned char *lpSkip(unsigned char *p) {
+    unsigned long entrylen = lpCurrentEncodedSize(p);
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    return p+entrylen;
+}
+
+/* Decode the element at 'p'. Strings are returned as a pointer inside the
+ * listpack with the length in '*slen', integers are stored in '*lval' and
+ * NULL is returned. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    uint64_t uval, negstart, negmax;
+    int j;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        *lval = p[0] & 0x7f;
+        return NULL;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *slen = p[0] & 0x3F;
+        return p+1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((uint64_t)(p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *slen = ((p[0]&0xF)<<8) | p[1];
+        return p+2;
+    } else if (p[0] == LP_ENCODING_16BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (p[0] == LP_ENCODING_24BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8 | (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (p[0] == LP_ENCODING_32BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 | (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (p[0] == LP_ENCODING_64BIT_INT) {
+        uval = 0;
+        for (j = 8; j >= 1; j--) uval = (uval << 8) | p[j];
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else {
+        /* LP_ENCODING_32BIT_STR */
+        assert(p[0] == LP_ENCODING_32BIT_STR);
+        *slen = (uint32_t)p[1] | (uint32_t)p[2]<<8 |
+                (uint32_t)p[3]<<16 | (uint32_t)p[4]<<24;
+        return p+5;
+    }
+
+    /* Convert the two's complement representation to a signed value. */
+    if (uval >= negstart) {
+        uval = negmax-uval;
+        *lval = -(long long)uval-1;
+    } else {
+        *lval = uval;
+    }
+    return NULL;
+}
+
+/* Return the first element of the listpack, or NULL if it is empty. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp+LP_HDR_SIZE;
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the element after 'p', or NULL if 'p' is the last one. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    assert(p >= lp+LP_HDR_SIZE && p < lp+lpGetTotalBytes(lp)-1);
+    p = lpSkip(p);
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the element before 'p', or NULL if 'p' is the first one. 'p' may
+ * also point to the end byte, in which case the last element is returned. */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    uint64_t prevlen;
+
+    assert(p >= lp+LP_HDR_SIZE && p < lp+lpGetTotalBytes(lp));
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--;
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    return p-prevlen+1;
+}
+
+/* Return the last element of the listpack, or NULL if it is empty. */
+unsigned char *lpLast(unsigned char *lp) {
+    return lpPrev(lp,lp+lpGetTotalBytes(lp)-1);
+}
+
+/* Return the number of elements. When the header count saturated, the
+ * listpack is scanned, and the header is fixed if the count fits again. */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned long count = 0;
+    unsigned char *p;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    p = lp+LP_HDR_SIZE;
+    while (p[0] != LP_EOF) {
+        count++;
+        p = lpSkip(p);
+    }
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Insert, replace or delete an element. 'where' is LP_BEFORE or LP_AFTER
+ * the element at 'p', or LP_REPLACE to overwrite it. A NULL 'ele' deletes
+ * the element at 'p'. To append, pass the end byte as 'p' with LP_BEFORE.
+ *
+ * If 'newp' is not NULL it is set to the address of the inserted element,
+ * or after a deletion to the element that took the place of the deleted
+ * one (NULL if the deleted element was the last one).
+ *
+ * Returns the listpack, that may have been reallocated, or NULL if the
+ * result would be bigger than 4GB. */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, unsigned int size, unsigned char *p, int where, unsigned char **newp) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    unsigned long enclen = 0, backlen_size = 0, replaced_len = 0, poff;
+    uint64_t old_bytes, new_bytes;
+    int isint = 0;
+    long long v;
+    unsigned char *dst;
+
+    if (ele == NULL) where = LP_REPLACE;
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+    poff = p-lp;
+
+    if (ele) {
+        if (size <= 20 && string2ll((char*)ele,size,&v)) {
+            enclen = lpEncodeInteger(v,intenc);
+            isint = 1;
+        } else {
+            enclen = lpStringEncodedSize(size);
+        }
+        backlen_size = lpEncodeBacklen(backlen,enclen);
+    }
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+
+    old_bytes = lpGetTotalBytes(lp);
+    new_bytes = old_bytes + enclen + backlen_size - replaced_len;
+    if (new_bytes > UINT32_MAX) return NULL;
+
+    /* Make room, or close the gap, with a single memmove around a single
+     * reallocation. The elements after 'p' never need to be rewritten. */
+    if (new_bytes > old_bytes) lp = zrealloc(lp,new_bytes);
+    dst = lp+poff;
+    memmove(dst+enclen+backlen_size,dst+replaced_len,
+            old_bytes-poff-replaced_len);
+    if (new_bytes < old_bytes) {
+        lp = zrealloc(lp,new_bytes);
+        dst = lp+poff;
+    }
+
+    if (newp) {
+        *newp = dst;
+        if (!ele && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (ele) {
+        if (isint)
+            memcpy(dst,intenc,enclen);
+        else
+            lpEncodeString(dst,ele,size);
+        memcpy(dst+enclen,backlen,backlen_size);
+    }
+
+    if (where != LP_REPLACE || ele == NULL) {
+        uint32_t numele = lpGetNumElements(lp);
+        if (numele != LP_HDR_NUMELE_UNKNOWN) {
+            if (ele) numele++; else numele--;
+            lpSetNumElements(lp,numele);
+        }
+    }
+    lpSetTotalBytes(lp,new_bytes);
+    return lp;
+}
+
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, unsigned int size) {
+    unsigned char *eofptr = lp+lpGetTotalBytes(lp)-1;
+    return lpInsert(lp,ele,size,eofptr,LP_BEFORE,NULL);
+}
+
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, unsigned int size) {
+    return lpInsert(lp,ele,size,lp+LP_HDR_SIZE,LP_BEFORE,NULL);
+}
+
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Delete 'num' elements starting at '*p' with a single memmove. On return
+ * '*p' points to the element that took the place of the first deleted one,
+ * or is NULL if the range included the last element. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num) {
+    unsigned char *first = *p, *tail = *p;
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned long deleted = 0;
+    size_t bytes = lpGetTotalBytes(lp), poff = first-lp;
+
+    while (tail[0] != LP_EOF && deleted < num) {
+        tail = lpSkip(tail);
+        deleted++;
+    }
+
+    memmove(first,tail,lp+bytes-tail);
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,numele-deleted);
+    lp = zrealloc(lp,bytes);
+    *p = lp[poff] == LP_EOF ? NULL : lp+poff;
+    return lp;
+}
+
+/* Delete 'num' elements starting at 'index', negative indexes counting from
+ * the tail. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *p;
+
+    if (num == 0 || (p = lpSeek(lp,index)) == NULL) return lp;
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Merge listpacks 'first' and 'second' by appending 'second' to 'first'.
+ * The bigger of the two is reallocated to hold the result, the other one is
+ * freed and its pointer set to NULL, while the surviving pointer is updated
+ * to the merged listpack, that is also returned. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    unsigned char *target;
+    size_t first_bytes, second_bytes, lpbytes;
+    unsigned long first_len, second_len, lplength;
+    int append;
+
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL)
+        return NULL;
+    if (*first == *second) return NULL;
+
+    first_bytes = lpGetTotalBytes(*first);
+    second_bytes = lpGetTotalBytes(*second);
+    first_len = lpGetNumElements(*first);
+    second_len = lpGetNumElements(*second);
+
+    /* Keep the largest listpack so that it can be resized in place. */
+    append = first_bytes >= second_bytes;
+    lpbytes = first_bytes + second_bytes - LP_HDR_SIZE - 1;
+    if (lpbytes > UINT32_MAX) return NULL;
+    if (first_len == LP_HDR_NUMELE_UNKNOWN ||
+        second_len == LP_HDR_NUMELE_UNKNOWN) {
+        lplength = LP_HDR_NUMELE_UNKNOWN;
+    } else {
+        lplength = first_len + second_len;
+        if (lplength > LP_HDR_NUMELE_UNKNOWN) lplength = LP_HDR_NUMELE_UNKNOWN;
+    }
+
+    if (append) {
+        /* [FIRST - EOF][SECOND - HEADER] */
+        target = zrealloc(*first,lpbytes);
+        memcpy(target+first_bytes-1,*second+LP_HDR_SIZE,
+               second_bytes-LP_HDR_SIZE);
+    } else {
+        /* [FIRST - EOF][SECOND - HEADER], moving the second one forward. */
+        target = zrealloc(*second,lpbytes);
+        memmove(target+first_bytes-1,target+LP_HDR_SIZE,
+                second_bytes-LP_HDR_SIZE);
+        memcpy(target+LP_HDR_SIZE,*first+LP_HDR_SIZE,
+               first_bytes-LP_HDR_SIZE-1);
+    }
+    lpSetTotalBytes(target,lpbytes);
+    lpSetNumElements(target,lplength);
+
+    if (append) {
+        zfree(*second);
+        *second = NULL;
+        *first = target;
+    } else {
+        zfree(*first);
+        *first = NULL;
+        *second = target;
+    }
+    return target;
+}
+
+/* Return the element at 'index', negative indexes counting from the tail,
+ * or NULL when out of range. When the number of elements is known, the
+ * listpack is walked from the nearest end. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    uint32_t numele = lpGetNumElements(lp);
+    int forward = index >= 0;
+    unsigned char *p;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (index < 0) index = (long)numele+index;
+        if (index < 0 || index >= (long)numele) return NULL;
+        forward = (unsigned long)index <= numele/2;
+        if (!forward) index = -((long)numele-index);
+    }
+
+    if (forward) {
+        p = lp+LP_HDR_SIZE;
+        while (index-- > 0 && p[0] != LP_EOF) p = lpSkip(p);
+        return p[0] == LP_EOF ? NULL : p;
+    } else {
+        p = lpLast(lp);
+        while (++index < 0 && p) p = lpPrev(lp,p);
+        return p;
+    }
+}
+
+/* Return 1 if the element at 'p' is equal to the string 's'. */
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll, sll;
+
+    if (p[0] == LP_EOF) return 0;
+    vstr = lpGetValue(p,&vlen,&vll);
+    if (vstr) return vlen == slen && memcmp(vstr,s,slen) == 0;
+    return slen <= 20 && string2ll((char*)s,slen,&sll) && sll == vll;
+}
+
+/* Find the element equal to 's' starting at 'p', comparing one element
+ * and skipping 'skip' elements between comparisons. Returns NULL when the
+ * end of the listpack is reached. */
+unsigned char *lpFind(unsigned char *p, unsigned char *s, unsigned int slen, unsigned int skip) {
+    unsigned int skipcnt = 0;
+    int sencoding = 0; /* 0: not parsed yet, 1: integer, 2: not an integer. */
+    long long sll = 0;
+
+    while (p[0] != LP_EOF) {
+        if (skipcnt == 0) {
+            if (LP_ENCODING_IS_STRING(p[0])) {
+                unsigned char *vstr;
+                unsigned int vlen;
+                long long vll;
+
+                vstr = lpGetValue(p,&vlen,&vll);
+                if (vlen == slen && memcmp(vstr,s,slen) == 0) return p;
+            } else {
+                long long vll;
+
+                if (sencoding == 0) {
+                    sencoding = (slen <= 20 &&
+                                 string2ll((char*)s,slen,&sll)) ? 1 : 2;
+                }
+                if (sencoding == 1) {
+                    lpGetValue(p,NULL,&vll);
+                    if (vll == sll) return p;
+                }
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpSkip(p);
+    }
+    return NULL;
+}
@@ -0,0 +1,35 @@
+/* Listpack -- A lists of strings serialization format
+ *
+ * See listpack.c for the description of the format.
+ */
+
+#ifndef __LISTPACK_H
+#define __LISTPACK_H
+
+#include <stddef.h>
+
+#define LP_BEFORE 0
+#define LP_AFTER 1
+#define LP_REPLACE 2
+
+unsigned char *lpNew(void);
+void lpFree(unsigned char *lp);
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, unsigned int size, unsigned char *p, int where, unsigned char **newp);
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, unsigned int size);
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, unsigned int size);
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp);
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num);
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num);
+unsigned char *lpMerge(unsigned char **first, unsigned char **second);
+unsigned long lpLength(unsigned char *lp);
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval);
+unsigned char *lpFind(unsigned char *p, unsigned char *s, unsigned int slen, unsigned int skip);
+unsigned int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen);
+unsigned char *lpFirst(unsigned char *lp);
+unsigned char *lpLast(unsigned char *lp);
+unsigned char *lpNext(unsigned char *lp, unsigned char *p);
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p);
+unsigned char *lpSeek(unsigned char *lp, long index);
+size_t lpBytes(unsigned char *lp);
+
+#endif /* __LISTPACK_H */
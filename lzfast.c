@@ -0,0 +1,492 @@
+/*
+   LZ77 codec for the compressed quicklist nodes.
+
+   The format is the one of the LZ4 block format. The input is encoded as a
+   series of sequences, each one made of a run of literals followed by a
+   back reference into the output already decoded:
+
+       token | [literals length] | literals | offset | [match length]
+
+   The high nibble of the token is the number of literals, the low nibble
+   the length of the match minus 4. A nibble of 15 means that the length
+   continues in the following bytes, each one added to it, up to the first
+   byte that is not 255. The offset is 2 bytes little endian, 1 to 65535,
+   and the match may overlap the bytes it produces. The last sequence only
+   has literals: the input ends right after them, and the last 5 bytes of
+   the original data are always literals.
+
+   There is no entropy coding, so decompressing is mostly a sequence of
+   memcpy() of 16 bytes, a few times faster than lzf_decompress() that
+   copies the matches a byte at a time. The two levels produce the same
+   format and only differ in the match search: LZFAST_LEVEL_FAST probes a
+   single hash table slot per position, LZFAST_LEVEL_HIGH follows hash
+   chains up to LZFAST_HC_ATTEMPTS deep and defers a match by one byte when
+   the next position has a longer one, compressing better and slower.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "lzfast.h"
+#include "zmalloc.h"
+
+#define LZFAST_MINMATCH 4
+#define LZFAST_LAST_LITERALS 5
+#define LZFAST_MAX_OFFSET 65535
+#define LZFAST_HASH_LOG 12
+#define LZFAST_HASH_SIZE (1 << LZFAST_HASH_LOG)
+#define LZFAST_HC_ATTEMPTS 64
+#define LZFAST_SKIP_TRIGGER 6   /* Probe less often on incompressible data */
+#define LZFAST_RUN_MASK 15
+#define LZFAST_ML_MASK 15
+
+static inline uint32_t lzRead32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v,p,sizeof(v));
+    return v;
+}
+
+static inline uint32_t lzHash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZFAST_HASH_LOG);
+}
+
+/* Return the number of equal bytes at 'a' and 'b', with 'b' < 'a' and
+ * without reading past 'limit'. */
+static inline unsigned int lzCount(const uint8_t *a, const uint8_t *b,
+                                   const uint8_t *limit) {
+    const uint8_t *start = a;
+
+#if defined(__GNUC__)
+    while (a + 8 <= limit) {
+        uint64_t x, y, diff;
+        memcpy(&x,a,sizeof(x));
+        memcpy(&y,b,sizeof(y));
+        diff = x ^ y;
+        if (diff) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+            return (a - start) + (__builtin_clzll(diff) >> 3);
+#else
+            return (a - start) + (__builtin_ctzll(diff) >> 3);
+#endif
+        }
+        a += 8;
+        b += 8;
+    }
+#endif
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return a - start;
+}
+
+/* Append a sequence to 'op': the literals from 'anchor' to 'ip' and, if
+ * 'mlen' is not zero, a match of 'mlen' bytes at distance 'offset'.
+ * Returns the new output pointer, or NULL if there is not enough room. */
+static uint8_t *lzEmit(uint8_t *op, uint8_t *oend, const uint8_t *anchor,
+                       const uint8_t *ip, unsigned int offset, unsigned int mlen) {
+    size_t lit = ip - anchor, len;
+    uint8_t *token;
+
+    if ((size_t)(oend - op) < 1 + lit + lit/255 + 1 + (mlen ? 2 + mlen/255 + 1 : 0))
+        return NULL;
+
+    token = op++;
+    if (lit >= LZFAST_RUN_MASK) {
+        *token = LZFAST_RUN_MASK << 4;
+        for (len = lit - LZFAST_RUN_MASK; len >= 255; len -= 255) *op++ = 255;
+        *op++ = (uint8_t)len;
+    } else {
+        *token = (uint8_t)(lit << 4);
+    }
+    memcpy(op,anchor,lit);
+    op += lit;
+    if (mlen == 0) return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    len = mlen - LZFAST_MINMATCH;
+    if (len >= LZFAST_ML_MASK) {
+        *token |= LZFAST_ML_MASK;
+        for (len -= LZFAST_ML_MASK; len >= 255; len -= 255) *op++ = 255;
+        *op++ = (uint8_t)len;
+    } else {
+        *token |= (uint8_t)len;
+    }
+    return op;
+}
+
+static unsigned int lzCompressFast(const uint8_t *in, unsigned int in_len,
+                                   uint8_t *out, unsigned int out_len) {
+    const uint8_t *ip = in, *anchor = in, *iend = in + in_len;
+    uint8_t *op = out, *oend = out + out_len;
+    uint32_t htab[LZFAST_HASH_SIZE];
+
+    if (in_len > LZFAST_LAST_LITERALS + LZFAST_MINMATCH) {
+        const uint8_t *mflimit = iend - LZFAST_LAST_LITERALS;
+        const uint8_t *ilimit = mflimit - LZFAST_MINMATCH;
+        unsigned int searches = 1 << LZFAST_SKIP_TRIGGER;
+
+        memset(htab,0,sizeof(htab));
+        while (ip <= ilimit) {
+            uint32_t seq = lzRead32(ip), h = lzHash(seq);
+            const uint8_t *ref = in + htab[h];
+            unsigned int mlen;
+
+            htab[h] = ip - in;
+            if (ref >= ip || ip - ref > LZFAST_MAX_OFFSET || lzRead32(ref) != seq) {
+                ip += searches++ >> LZFAST_SKIP_TRIGGER;
+                continue;
+            }
+
+            /* Extend the match backward over the pending literals. */
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            mlen = LZFAST_MINMATCH + lzCount(ip+LZFAST_MINMATCH,ref+LZFAST_MINMATCH,mflimit);
+            if ((op = lzEmit(op,oend,anchor,ip,ip-ref,mlen)) == NULL) return 0;
+            ip += mlen;
+            anchor = ip;
+            searches = 1 << LZFAST_SKIP_TRIGGER;
+
+            /* Index a position inside the match, that often starts the
+             * next one. */
+            if (ip <= ilimit) htab[lzHash(lzRead32(ip-2))] = ip-2-in;
+        }
+    }
+    if ((op = lzEmit(op,oend,anchor,iend,0,0)) == NULL) return 0;
+    return op - out;
+}
+
+/* State of the hash chains of LZFAST_LEVEL_HIGH. head[] holds the last
+ * position+1 with a given hash, chain[] the distance from every position
+ * to the previous one with the same hash, 0 when there is none in range. */
+typedef struct lzChains {
+    const uint8_t *in;
+    const uint8_t *mflimit;
+    uint32_t next;              /* First position not yet in the chains */
+    uint32_t head[LZFAST_HASH_SIZE];
+    uint16_t *chain;
+} lzChains;
+
+/* Add the positions up to 'ip' to the chains, and return the length of the
+ * longest match of 'ip' storing its position in '*ref', or 0. */
+static unsigned int lzFindBest(lzChains *c, const uint8_t *ip, const uint8_t **ref) {
+    uint32_t pos = ip - c->in, seq = lzRead32(ip), p;
+    unsigned int best = 0, attempts = LZFAST_HC_ATTEMPTS;
+
+    while (c->next < pos) {
+        uint32_t h = lzHash(lzRead32(c->in + c->next)), prev = c->head[h];
+        uint32_t dist = prev ? c->next - (prev-1) : 0;
+
+        c->chain[c->next] = dist > LZFAST_MAX_OFFSET ? 0 : dist;
+        c->head[h] = ++c->next;
+    }
+
+    p = c->head[lzHash(seq)];
+    if (p == 0) return 0;
+    p--;
+    while (attempts-- && pos - p <= LZFAST_MAX_OFFSET) {
+        const uint8_t *cand = c->in + p;
+
+        if (lzRead32(cand) == seq && cand[best] == ip[best]) {
+            unsigned int len = LZFAST_MINMATCH +
+                lzCount(ip+LZFAST_MINMATCH,cand+LZFAST_MINMATCH,c->mflimit);
+            if (len > best) {
+                best = len;
+                *ref = cand;
+            }
+        }
+        if (c->chain[p] == 0) break;
+        p -= c->chain[p];
+    }
+    return best;
+}
+
+static unsigned int lzCompressHigh(const uint8_t *in, unsigned int in_len,
+                                   uint8_t *out, unsigned int out_len) {
+    const uint8_t *ip = in, *anchor = in, *iend = in + in_len;
+    uint8_t *op = out, *oend = out + out_len;
+    lzChains *c;
+
+    if (in_len <= LZFAST_LAST_LITERALS + LZFAST_MINMATCH)
+        return lzCompressFast(in,in_len,out,out_len);
+
+    c = zmalloc(sizeof(*c));
+    c->in = in;
+    c->mflimit = iend - LZFAST_LAST_LITERALS;
+    c->next = 0;
+    memset(c->head,0,sizeof(c->head));
+    c->chain = zmalloc(sizeof(uint16_t) * in_len);
+
+    while (ip <= c->mflimit - LZFAST_MINMATCH) {
+        const uint8_t *ref = NULL, *ref2 = NULL;
+        unsigned int mlen = lzFindBest(c,ip,&ref), mlen2;
+
+        if (mlen < LZFAST_MINMATCH) {
+            ip++;
+            continue;
+        }
+
+        /* Lazy matching: prefer a longer match starting at the next byte,
+         * paying one more literal. */
+        while (ip + 1 <= c->mflimit - LZFAST_MINMATCH &&
+               (mlen2 = lzFindBest(c,ip+1,&ref2)) > mlen + 1)
+        {
+            ip++;
+            mlen = mlen2;
+            ref = ref2;
+        }
+
+        if ((op = lzEmit(op,oend,anchor,ip,ip-ref,mlen)) == NULL) break;
+        ip += mlen;
+        anchor = ip;
+    }
+    if (op) op = lzEmit(op,oend,anchor,iend,0,0);
+
+    zfree(c->chain);
+    zfree(c);
+    return op ? (unsigned int)(op - out) : 0;
+}
+
+unsigned int lzfast_compress(const void *const in_data, unsigned int in_len,
+                             void *out_data, unsigned int out_len, int level) {
+    if (level == LZFAST_LEVEL_HIGH)
+        return lzCompressHigh(in_data,in_len,out_data,out_len);
+    return lzCompressFast(in_data,in_len,out_data,out_len);
+}
+
+unsigned int lzfast_decompress(const void *const in_data, unsigned int in_len,
+                               void *out_data, unsigned int out_len) {
+    const uint8_t *ip = in_data, *iend = ip + in_len;
+    uint8_t *op = out_data, *oend = op + out_len;
+
+    while (ip < iend) {
+        unsigned int token = *ip++;
+        size_t lit = token >> 4, mlen = token & LZFAST_ML_MASK, offset;
+        const uint8_t *match;
+        uint8_t b;
+
+        if (lit == LZFAST_RUN_MASK) {
+            do {
+                if (ip >= iend) return 0;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return 0;
+        if (lit <= 16 && iend - ip >= 16 && oend - op >= 16)
+            memcpy(op,ip,16); /* Short runs: one fixed size copy. */
+        else
+            memcpy(op,ip,lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break; /* The last sequence has no match. */
+
+        if (iend - ip < 2) return 0;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)out_data)) return 0;
+        if (mlen == LZFAST_ML_MASK) {
+            do {
+                if (ip >= iend) return 0;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZFAST_MINMATCH;
+        if ((size_t)(oend - op) < mlen) return 0;
+
+        match = op - offset;
+        if (offset >= 16 && (size_t)(oend - op) >= mlen + 16) {
+            /* Copy 16 bytes at a time: the extra bytes written past the
+             * match are overwritten by the next sequence. */
+            uint8_t *cpy = op + mlen;
+            do {
+                memcpy(op,match,16);
+                op += 16;
+                match += 16;
+            } while (op < cpy);
+            op = cpy;
+        } else if (offset >= mlen) {
+            memcpy(op,match,mlen);
+            op += mlen;
+        } else {
+            /* Overlapping match, e.g. a run of the same byte. */
+            while (mlen--) *op++ = *match++;
+        }
+    }
+    /* The caller knows the original size: a stream that decodes to less,
+     * like one truncated at a sequence boundary, is corrupted too. */
+    if (op != oend) return 0;
+    return op - (uint8_t*)out_data;
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define assert(_e) ((_e)?(void)0:(_assert(#_e,__FILE__,__LINE__),exit(1)))
+static void _assert(char *estr, char *file, int line) {
+    printf("\n\n=== ASSERTION FAILED ===\n");
+    printf("==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+/* Compress 'in' at 'level' into a buffer large enough for incompressible
+ * data, check that it decompresses back to the same bytes, and that every
+ * truncation of the compressed data is rejected. Returns the compressed
+ * size. */
+static unsigned int lzfastRoundTrip(const uint8_t *in, unsigned int len, int level) {
+    unsigned int bound = len + len/255 + 16, clen, dlen, cut;
+    uint8_t *comp = zmalloc(bound), *out = zmalloc(len+16);
+
+    clen = lzfast_compress(in,len,comp,bound,level);
+    assert(clen > 0);
+    dlen = lzfast_decompress(comp,clen,out,len);
+    assert(dlen == len);
+    assert(len == 0 || memcmp(in,out,len) == 0);
+
+    /* An output buffer one byte short must be detected. */
+    if (len > 0) assert(lzfast_decompress(comp,clen,out,len-1) == 0);
+
+    /* Truncated input, at every length for small streams. */
+    if (len > 0) {
+        unsigned int step = clen > 512 ? clen/256 : 1;
+        for (cut = 0; cut < clen; cut += step)
+            assert(lzfast_decompress(comp,cut,out,len) == 0);
+    }
+
+    zfree(comp);
+    zfree(out);
+    return clen;
+}
+
+static void lzfastFillRandom(uint8_t *p, unsigned int len) {
+    for (unsigned int i = 0; i < len; i++) p[i] = rand() & 0xff;
+}
+
+#define UNUSED(x) (void)(x)
+int lzfastTest(int argc, char *argv[]) {
+    unsigned int seed = time(NULL), i, len, clen;
+    int level;
+    uint8_t *buf = zmalloc(200000), out[64];
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(seed);
+    printf("lzfast test seed: %u\n", seed);
+
+    for (level = LZFAST_LEVEL_FAST; level <= LZFAST_LEVEL_HIGH; level++) {
+        printf("Level %d, empty input: ", level); {
+            lzfastRoundTrip(buf,0,level);
+            printf("OK\n");
+        }
+
+        printf("Level %d, tiny inputs: ", level); {
+            for (len = 1; len <= LZFAST_LAST_LITERALS + LZFAST_MINMATCH + 1; len++) {
+                memset(buf,'a',len);
+                lzfastRoundTrip(buf,len,level);
+                lzfastFillRandom(buf,len);
+                lzfastRoundTrip(buf,len,level);
+            }
+            printf("OK\n");
+        }
+
+        printf("Level %d, incompressible inputs: ", level); {
+            for (len = 10; len < 100000; len = len*3+1) {
+                lzfastFillRandom(buf,len);
+                clen = lzfastRoundTrip(buf,len,level);
+                assert(clen <= len + len/255 + 16);
+            }
+            printf("OK\n");
+        }
+
+        printf("Level %d, long runs: ", level); {
+            for (len = 16; len < 200000; len = len*5+3) {
+                memset(buf,'x',len);
+                clen = lzfastRoundTrip(buf,len,level);
+                assert(clen < len/100 + 16);
+                /* Runs of a short period, overlapping the output. */
+                for (i = 0; i < len; i++) buf[i] = "abc"[i%3];
+                lzfastRoundTrip(buf,len,level);
+            }
+            printf("OK\n");
+        }
+
+        printf("Level %d, mixed inputs: ", level); {
+            for (i = 0; i < 200; i++) {
+                unsigned int j = 0;
+                len = rand() % 5000;
+                while (j < len) {
+                    unsigned int run = 1 + rand() % 64;
+                    if (run > len - j) run = len - j;
+                    if (rand() % 2 && j >= 64)
+                        memmove(buf+j,buf+j-1-rand()%64,run);
+                    else
+                        lzfastFillRandom(buf+j,run);
+                    j += run;
+                }
+                lzfastRoundTrip(buf,len,level);
+            }
+            printf("OK\n");
+        }
+
+        printf("Level %d, repeats beyond the 64KB window: ", level); {
+            /* The same random block twice, at distances just below and
+             * above LZFAST_MAX_OFFSET: offsets must never wrap. */
+            unsigned int dist[] = {LZFAST_MAX_OFFSET - 8, LZFAST_MAX_OFFSET,
+                                   LZFAST_MAX_OFFSET + 1, 70000};
+            for (i = 0; i < sizeof(dist)/sizeof(dist[0]); i++) {
+                lzfastFillRandom(buf,dist[i]);
+                memcpy(buf+dist[i],buf,dist[i]);
+                lzfastRoundTrip(buf,dist[i]*2,level);
+            }
+            printf("OK\n");
+        }
+    }
+
+    printf("Corrupted input: "); {
+        /* 1 literal and a match at offset 0, or before the output start. */
+        const uint8_t zero_off[] = {0x10,'a',0x00,0x00,0x00,'a','a','a','a','a'};
+        const uint8_t far_off[] = {0x10,'a',0x02,0x00,0x00,'a','a','a','a','a'};
+        /* Literals length past the end of the input. */
+        const uint8_t long_lit[] = {0xf0,0xff,0xff,0x10,'a','b','c'};
+        /* Match length continuation cut short. */
+        const uint8_t cut_len[] = {0x1f,'a',0x01,0x00,0xff};
+
+        assert(lzfast_decompress(zero_off,sizeof(zero_off),out,10) == 0);
+        assert(lzfast_decompress(far_off,sizeof(far_off),out,10) == 0);
+        assert(lzfast_decompress(long_lit,sizeof(long_lit),out,sizeof(out)) == 0);
+        assert(lzfast_decompress(cut_len,sizeof(cut_len),out,sizeof(out)) == 0);
+        printf("OK\n");
+    }
+
+    printf("Random corruption never overflows: "); {
+        unsigned int bound, orig = 4000;
+        uint8_t *comp, *dec = zmalloc(orig);
+
+        for (i = 0; i < orig; i++) buf[i] = "lzfast"[rand()%6];
+        bound = orig + orig/255 + 16;
+        comp = zmalloc(bound);
+        clen = lzfast_compress(buf,orig,comp,bound,LZFAST_LEVEL_HIGH);
+        assert(clen > 0);
+        for (i = 0; i < 10000; i++) {
+            uint8_t *bad = zmalloc(clen);
+            unsigned int flips = 1 + rand() % 4, dlen;
+            memcpy(bad,comp,clen);
+            while (flips--) bad[rand()%clen] ^= 1 << (rand()%8);
+            dlen = lzfast_decompress(bad,clen,dec,orig);
+            assert(dlen == 0 || dlen == orig);
+            zfree(bad);
+        }
+        zfree(comp);
+        zfree(dec);
+        printf("OK\n");
+    }
+
+    zfree(buf);
+    printf("ALL TESTS PASSED!\n");
+    return 0;
+}
+#endif
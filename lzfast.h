@@ -0,0 +1,28 @@
+/* lzfast -- LZ77 codec for the compressed quicklist nodes.
+ *
+ * See lzfast.c for the description of the format.
+ */
+
+#ifndef __LZFAST_H
+#define __LZFAST_H
+
+/* Compression levels. Both produce the same format, so the decompressor
+ * does not need to know the level. */
+#define LZFAST_LEVEL_FAST 0     /* Single probe hash table, like LZ4 */
+#define LZFAST_LEVEL_HIGH 1     /* Hash chains and lazy matching, like LZ4HC */
+
+/* Same contract of lzf_compress() and lzf_decompress(): the number of bytes
+ * written to 'out_data' is returned, or 0 if the output does not fit in
+ * 'out_len' bytes (or, decompressing, if the input is corrupted). Unlike
+ * lzf_decompress(), 'out_len' must be the exact size of the original data:
+ * input that decodes to fewer bytes is reported as corrupted. */
+unsigned int lzfast_compress(const void *const in_data, unsigned int in_len,
+                             void *out_data, unsigned int out_len, int level);
+unsigned int lzfast_decompress(const void *const in_data, unsigned int in_len,
+                               void *out_data, unsigned int out_len);
+
+#ifdef REDIS_TEST
+int lzfastTest(int argc, char *argv[]);
+#endif
+
+#endif /* __LZFAST_H */
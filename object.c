@@ -44,18 +44,18 @@
 #include "util.h"
 #include "dict.h"
 #include "adlist.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "quicklist.h"
 #include "zset.h"
 #include "intset.h"
 #include "evict.h"
+#include "atomicvar.h"
 
 #ifdef __CYGWIN__
 #define strtold(a,b) ((long double)strtod((a),(b)))
 #endif
 
 extern db_config g_db_config;
-extern db_status g_db_status;
 
 /* Set dictionary type. Keys are SDS strings, values are ot used. */
 dictType setDictType = {
@@ -77,11 +77,51 @@ dictType zsetDictType = {
     NULL                       /* val destructor */
 };
 
+dictType setDictTypeFast = {
+    dictSdsFastHash,           /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
+dictType zsetDictTypeFast = {
+    dictSdsFastHash,           /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    NULL,                      /* Note: SDS string shared & freed by skiplist */
+    NULL                       /* val destructor */
+};
+
+/* Set while the calling thread works on a DB using the fast hash function,
+ * so that the hash tables created for its values use it as well. */
+static __thread int value_fast_hash = 0;
+
+/* Returns the previous setting, so that it can be restored. */
+int setValueFastHash(int on) {
+    int old = value_fast_hash;
+    value_fast_hash = on;
+    return old;
+}
+
+/* Return the dict type to use for a new hash, set or sorted set hash
+ * table: 'type' itself, or its fast hash twin if the DB wants it. */
+dictType *valueDictType(dictType *type) {
+    if (!value_fast_hash) return type;
+    if (type == &hashDictType) return &hashDictTypeFast;
+    if (type == &setDictType) return &setDictTypeFast;
+    if (type == &zsetDictType) return &zsetDictTypeFast;
+    return type;
+}
+
 /* ===================== Creation and parsing of objects ==================== */
 
 robj *createObject(int type, void *ptr) {
     robj *o = zmalloc(sizeof(*o));
     o->type = type;
+    o->embkey = 0;
     o->encoding = OBJ_ENCODING_RAW;
     o->ptr = ptr;
     o->refcount = 1;
@@ -127,6 +167,7 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     struct sdshdr8 *sh = (void*)(o+1);
 
     o->type = OBJ_STRING;
+    o->embkey = 0;
     o->encoding = OBJ_ENCODING_EMBSTR;
     o->ptr = sh+1;
     o->refcount = 1;
@@ -216,6 +257,72 @@ robj *dupStringObject(const robj *o) {
     }
 }
 
+/* Create a copy of the string object 'val' to be stored in the keyspace
+ * under 'key', with the key allocated in the same chunk of the object, and
+ * the value too when it is small enough for the EMBSTR encoding, so that
+ * the key costs a single allocation. The keyspace uses the embedded key
+ * as its own, see objectGetEmbeddedKey().
+ *
+ * Keys that don't fit a type 8 sds header are not embedded, and a plain
+ * copy of 'val' is returned. */
+#define OBJ_EMBKEY_MAX_LEN 255
+robj *createStringObjectWithKey(sds key, const robj *val) {
+    size_t klen = sdslen(key), vlen = 0;
+    size_t size = sizeof(robj)+sizeof(struct sdshdr8)+klen+1;
+    struct sdshdr8 *kh, *vh;
+    int embval = 0;
+    robj *o;
+
+    assert(val->type == OBJ_STRING);
+    if (klen > OBJ_EMBKEY_MAX_LEN) return dupStringObject(val);
+    if (sdsEncodedObject(val)) {
+        vlen = sdslen(val->ptr);
+        embval = vlen <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT;
+        if (embval) size += sizeof(struct sdshdr8)+vlen+1;
+    }
+
+    o = zmalloc(size);
+    o->type = OBJ_STRING;
+    o->embkey = 1;
+    o->refcount = 1;
+    if (g_db_config.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+        o->lru = (LFUGetTimeInMinutes()<<8) | LFU_INIT_VAL;
+    } else {
+        o->lru = LRU_CLOCK();
+    }
+
+    kh = (void*)(o+1);
+    kh->len = klen;
+    kh->alloc = klen;
+    kh->flags = OBJ_EMBKEY_SDS_FLAGS;
+    memcpy(kh->buf,key,klen+1);
+
+    if (embval) {
+        vh = (void*)(kh->buf+klen+1);
+        vh->len = vlen;
+        vh->alloc = vlen;
+        vh->flags = SDS_TYPE_8;
+        memcpy(vh->buf,val->ptr,vlen+1);
+        o->encoding = OBJ_ENCODING_EMBSTR;
+        o->ptr = vh->buf;
+    } else if (val->encoding == OBJ_ENCODING_INT) {
+        o->encoding = OBJ_ENCODING_INT;
+        o->ptr = val->ptr;
+    } else {
+        o->encoding = OBJ_ENCODING_RAW;
+        o->ptr = sdsnewlen(val->ptr,vlen);
+    }
+    return o;
+}
+
+/* Return the key embedded in the object by createStringObjectWithKey(), or
+ * NULL. The key lives as long as the object: it must not be modified nor
+ * freed with sdsfree(). */
+sds objectGetEmbeddedKey(const robj *o) {
+    if (!o->embkey) return NULL;
+    return ((struct sdshdr8*)(o+1))->buf;
+}
+
 robj *createQuicklistObject(void) {
     quicklist *l = quicklistCreate();
     robj *o = createObject(OBJ_LIST,l);
@@ -223,15 +330,8 @@ robj *createQuicklistObject(void) {
     return o;
 }
 
-robj *createZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_LIST,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
-    return o;
-}
-
 robj *createSetObject(void) {
-    dict *d = dictCreate(&setDictType,NULL);
+    dict *d = dictCreate(valueDictType(&setDictType),NULL);
     robj *o = createObject(OBJ_SET,d);
     o->encoding = OBJ_ENCODING_HT;
     return o;
@@ -245,9 +345,9 @@ robj *createIntsetObject(void) {
 }
 
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
+    unsigned char *zl = lpNew();
     robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -255,17 +355,17 @@ robj *createZsetObject(void) {
     zset *zs = zmalloc(sizeof(*zs));
     robj *o;
 
-    zs->dict = dictCreate(&zsetDictType,NULL);
+    zs->dict = dictCreate(valueDictType(&zsetDictType),NULL);
     zs->zsl = zslCreate();
     o = createObject(OBJ_ZSET,zs);
     o->encoding = OBJ_ENCODING_SKIPLIST;
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
+robj *createZsetListpackObject(void) {
+    unsigned char *zl = lpNew();
     robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -313,8 +413,8 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         break;
@@ -327,8 +427,8 @@ void freeHashObject(robj *o) {
     case OBJ_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         // serverPanic("Unknown hash encoding type");
@@ -733,7 +833,7 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_INT: return "int";
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
-    case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
     case OBJ_ENCODING_EMBSTR: return "embstr";
@@ -741,6 +841,110 @@ char *strEncoding(int encoding) {
     }
 }
 
+/* Fetch the listpack encoding limits of a type from its two config fields.
+ * A zero config means the default, a negative one disables the encoding:
+ * 'max_entries' is then 0. */
+void getListpackLimits(int *entries_config, int *value_config,
+                       int default_entries, int default_value,
+                       size_t *max_entries, size_t *max_value) {
+    int entries, value;
+
+    atomicGet(*entries_config,entries);
+    atomicGet(*value_config,value);
+    if (entries == 0) entries = default_entries;
+    if (value == 0) value = default_value;
+    if (entries < 0 || value < 0) entries = value = 0;
+    *max_entries = entries;
+    *max_value = value;
+}
+
+/* ======================= The MEMORY USAGE estimate ======================== */
+
+/* This is an helper function with the goal of estimating the memory
+ * size of a radix tree, list, set, sorted set or hash object. Aggregated
+ * values are estimated sampling 'sample_size' of their elements, and
+ * multiplying the average element size by the number of elements. */
+size_t objectComputeSize(robj *o, size_t sample_size) {
+    sds ele, ele2;
+    dict *d;
+    dictIterator *di;
+    struct dictEntry *de;
+    size_t asize = 0, elesize = 0, samples = 0;
+
+    if (o->type == OBJ_STRING) {
+        if(o->encoding == OBJ_ENCODING_INT) {
+            asize = sizeof(*o);
+        } else if(o->encoding == OBJ_ENCODING_RAW) {
+            asize = sdsAllocSize(o->ptr)+sizeof(*o);
+        } else if(o->encoding == OBJ_ENCODING_EMBSTR) {
+            asize = sdslen(o->ptr)+2+sizeof(*o);
+        }
+    } else if (o->type == OBJ_LIST) {
+        if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
+            asize = sizeof(*o)+sizeof(quicklist);
+            while (node && samples < sample_size) {
+                elesize += sizeof(quicklistNode)+(quicklistNodeIsCompressed(node) ?
+                    ((quicklistLZF*)node->zl)->sz : node->sz);
+                samples++;
+                node = node->next;
+            }
+            if (samples) asize += (double)elesize/samples*ql->len;
+        }
+    } else if (o->type == OBJ_SET) {
+        if (o->encoding == OBJ_ENCODING_HT) {
+            d = o->ptr;
+            di = dictGetIterator(d);
+            asize = sizeof(*o)+sizeof(dict)+(sizeof(struct dictEntry*)*dictSlots(d));
+            while((de = dictNext(di)) != NULL && samples < sample_size) {
+                ele = dictGetKey(de);
+                elesize += sizeof(struct dictEntry) + sdsAllocSize(ele);
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else if (o->encoding == OBJ_ENCODING_INTSET) {
+            intset *is = o->ptr;
+            asize = sizeof(*o)+sizeof(*is)+is->encoding*is->length;
+        }
+    } else if (o->type == OBJ_ZSET) {
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
+        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+            d = ((zset*)o->ptr)->dict;
+            zskiplist *zsl = ((zset*)o->ptr)->zsl;
+            zskiplistNode *znode = zsl->header->level[0].forward;
+            asize = sizeof(*o)+sizeof(zset)+(sizeof(struct dictEntry*)*dictSlots(d));
+            while(znode != NULL && samples < sample_size) {
+                elesize += sdsAllocSize(znode->ele);
+                elesize += sizeof(struct dictEntry) + zmalloc_size(znode);
+                samples++;
+                znode = znode->level[0].forward;
+            }
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        }
+    } else if (o->type == OBJ_HASH) {
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
+        } else if (o->encoding == OBJ_ENCODING_HT) {
+            d = o->ptr;
+            di = dictGetIterator(d);
+            asize = sizeof(*o)+sizeof(dict)+(sizeof(struct dictEntry*)*dictSlots(d));
+            while((de = dictNext(di)) != NULL && samples < sample_size) {
+                ele = dictGetKey(de);
+                ele2 = dictGetVal(de);
+                elesize += sdsAllocSize(ele) + sdsAllocSize(ele2);
+                elesize += sizeof(struct dictEntry);
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples) asize += (double)elesize/samples*dictSize(d);
+        }
+    }
+    return asize;
+}
+
 int convertObjectToSds(robj *obj, sds *val)
 {
     if (sdsEncodedObject(obj)) {
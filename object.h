@@ -35,7 +35,9 @@
 #include "sds.h"
 
 typedef struct redisObject {
-    unsigned type:4;
+    unsigned type:3;
+    unsigned embkey:1; /* The keyspace key is stored after the object,
+                        * see createStringObjectWithKey(). */
     unsigned encoding:4;
     unsigned lru:LRU_BITS; /* LRU time (relative to global lru_clock) or
                             * LFU data (least significant 8 bits frequency
@@ -49,6 +51,8 @@ robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
 robj *dupStringObject(const robj *o);
+robj *createStringObjectWithKey(sds key, const robj *val);
+sds objectGetEmbeddedKey(const robj *o);
 int isSdsRepresentableAsLongLong(sds s, long long *llval);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
 robj *getDecodedObject(robj *o);
@@ -56,22 +60,29 @@ size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
-robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 int checkType(robj *o, int type);
 int getDoubleFromObject(const robj *o, double *target);
 int getLongLongFromObject(robj *o, long long *target);
 int getLongFromObject(robj *o, long *target);
 int getLongDoubleFromObject(robj *o, long double *target);
 char *strEncoding(int encoding);
+void getListpackLimits(int *entries_config, int *value_config,
+                       int default_entries, int default_value,
+                       size_t *max_entries, size_t *max_value);
 int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *o, size_t sample_size);
+/* Flags byte of the sds header of a key embedded in its value object. */
+#define OBJ_EMBKEY_SDS_FLAGS (SDS_TYPE_8|(1<<SDS_TYPE_BITS))
+#define sdsIsEmbeddedKey(s) ((unsigned char)(s)[-1] == OBJ_EMBKEY_SDS_FLAGS)
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
 void incrRefCount(robj *o);
@@ -79,4 +90,8 @@ void decrRefCount(robj *o);
 
 int convertObjectToSds(robj *obj, sds *val);
 
+struct dictType;
+int setValueFastHash(int on);
+struct dictType *valueDictType(struct dictType *type);
+
 #endif
@@ -1,4 +1,4 @@
-/* quicklist.c - A doubly linked list of ziplists
+/* quicklist.c - A doubly linked list of listpacks
  *
  * Copyright (c) 2014, Matt Stancliff <matt@genges.com>
  * All rights reserved.
@@ -31,9 +31,10 @@
 #include <string.h> /* for memcpy */
 #include "quicklist.h"
 #include "zmalloc.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "util.h" /* for ll2string */
 #include "lzf.h"
+#include "lzfast.h"
 
 #if defined(REDIS_TEST) || defined(REDIS_TEST_VERBOSE)
 #include <stdio.h> /* for printf (debug printing), snprintf (genstr) */
@@ -46,11 +47,11 @@
 /* Optimization levels for size-based filling */
 static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
 
-/* Maximum size in bytes of any multi-element ziplist.
- * Larger values will live in their own isolated ziplists. */
+/* Maximum size in bytes of any multi-element listpack.
+ * Larger values will live in their own isolated listpacks. */
 #define SIZE_SAFETY_LIMIT 8192
 
-/* Minimum ziplist size in bytes for attempting compression. */
+/* Minimum listpack size in bytes for attempting compression. */
 #define MIN_COMPRESS_BYTES 48
 
 /* Minimum size reduction in bytes to store compressed quicklistNode data.
@@ -100,10 +101,11 @@ quicklist *quicklistCreate(void) {
     quicklist->count = 0;
     quicklist->compress = 0;
     quicklist->fill = -2;
+    quicklist->codec = QUICKLIST_CODEC_LZF;
     return quicklist;
 }
 
-#define COMPRESS_MAX (1 << 16)
+#define COMPRESS_MAX ((1 << 16) - 1)
 void quicklistSetCompressDepth(quicklist *quicklist, int compress) {
     if (compress > COMPRESS_MAX) {
         compress = COMPRESS_MAX;
@@ -113,7 +115,7 @@ void quicklistSetCompressDepth(quicklist *quicklist, int compress) {
     quicklist->compress = compress;
 }
 
-#define FILL_MAX (1 << 15)
+#define FILL_MAX ((1 << 15) - 1)
 void quicklistSetFill(quicklist *quicklist, int fill) {
     if (fill > FILL_MAX) {
         fill = FILL_MAX;
@@ -128,6 +130,14 @@ void quicklistSetOptions(quicklist *quicklist, int fill, int depth) {
     quicklistSetCompressDepth(quicklist, depth);
 }
 
+/* Set the codec used from now on to compress the nodes. Nodes already
+ * compressed keep their codec: every node records it in its encoding. */
+void quicklistSetCodec(quicklist *quicklist, int codec) {
+    if (codec != QUICKLIST_CODEC_LZFAST && codec != QUICKLIST_CODEC_LZFAST_HIGH)
+        codec = QUICKLIST_CODEC_LZF;
+    quicklist->codec = codec;
+}
+
 /* Create a new quicklist with some default parameters. */
 quicklist *quicklistNew(int fill, int compress) {
     quicklist *quicklist = quicklistCreate();
@@ -143,7 +153,7 @@ REDIS_STATIC quicklistNode *quicklistCreateNode(void) {
     node->sz = 0;
     node->next = node->prev = NULL;
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
-    node->container = QUICKLIST_NODE_CONTAINER_ZIPLIST;
+    node->container = QUICKLIST_NODE_CONTAINER_PACKED;
     node->recompress = 0;
     return node;
 }
@@ -172,10 +182,14 @@ void quicklistRelease(quicklist *quicklist) {
     zfree(quicklist);
 }
 
-/* Compress the ziplist in 'node' and update encoding details.
- * Returns 1 if ziplist compressed successfully.
- * Returns 0 if compression failed or if ziplist too small to compress. */
-REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
+/* Compress the listpack in 'node' with the codec of 'quicklist' and update
+ * encoding details.
+ * Returns 1 if listpack compressed successfully.
+ * Returns 0 if compression failed or if listpack too small to compress. */
+REDIS_STATIC int __quicklistCompressNode(const quicklist *quicklist,
+                                         quicklistNode *node) {
+    int encoding = QUICKLIST_NODE_ENCODING_LZF;
+
 #ifdef REDIS_TEST
     node->attempted_compress = 1;
 #endif
@@ -186,10 +200,17 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
 
     quicklistLZF *lzf = zmalloc(sizeof(*lzf) + node->sz);
 
+    if (quicklist->codec == QUICKLIST_CODEC_LZF) {
+        lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed, node->sz);
+    } else {
+        lzf->sz = lzfast_compress(node->zl, node->sz, lzf->compressed, node->sz,
+                                  quicklist->codec == QUICKLIST_CODEC_LZFAST_HIGH ?
+                                  LZFAST_LEVEL_HIGH : LZFAST_LEVEL_FAST);
+        encoding = QUICKLIST_NODE_ENCODING_LZFAST;
+    }
+
     /* Cancel if compression fails or doesn't compress small enough */
-    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed,
-                                 node->sz)) == 0) ||
-        lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+    if (lzf->sz == 0 || lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
         /* lzf_compress aborts/rejects compression if value not compressable. */
         zfree(lzf);
         return 0;
@@ -197,20 +218,20 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
     lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
     zfree(node->zl);
     node->zl = (unsigned char *)lzf;
-    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    node->encoding = encoding;
     node->recompress = 0;
     return 1;
 }
 
 /* Compress only uncompressed nodes. */
-#define quicklistCompressNode(_node)                                           \
+#define quicklistCompressNode(_ql, _node)                                      \
     do {                                                                       \
         if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) {     \
-            __quicklistCompressNode((_node));                                  \
+            __quicklistCompressNode((_ql), (_node));                           \
         }                                                                      \
     } while (0)
 
-/* Uncompress the ziplist in 'node' and update encoding details.
+/* Uncompress the listpack in 'node' and update encoding details.
  * Returns 1 on successful decode, 0 on failure to decode. */
 REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 #ifdef REDIS_TEST
@@ -219,7 +240,13 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 
     void *decompressed = zmalloc(node->sz);
     quicklistLZF *lzf = (quicklistLZF *)node->zl;
-    if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+    unsigned int sz;
+
+    if (node->encoding == QUICKLIST_NODE_ENCODING_LZFAST)
+        sz = lzfast_decompress(lzf->compressed, lzf->sz, decompressed, node->sz);
+    else
+        sz = lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz);
+    if (sz == 0) {
         /* Someone requested decompress, but we can't decompress.  Not good. */
         zfree(decompressed);
         return 0;
@@ -233,7 +260,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 /* Decompress only compressed nodes. */
 #define quicklistDecompressNode(_node)                                         \
     do {                                                                       \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+        if ((_node) && quicklistNodeIsCompressed(_node)) {                     \
             __quicklistDecompressNode((_node));                                \
         }                                                                      \
     } while (0)
@@ -241,15 +268,16 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 /* Force node to not be immediately re-compresable */
 #define quicklistDecompressNodeForUse(_node)                                   \
     do {                                                                       \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+        if ((_node) && quicklistNodeIsCompressed(_node)) {                     \
             __quicklistDecompressNode((_node));                                \
             (_node)->recompress = 1;                                           \
         }                                                                      \
     } while (0)
 
-/* Extract the raw LZF data from this quicklistNode.
- * Pointer to LZF data is assigned to '*data'.
- * Return value is the length of compressed LZF data. */
+/* Extract the raw compressed data from this quicklistNode, in the format
+ * of node->encoding.
+ * Pointer to compressed data is assigned to '*data'.
+ * Return value is the length of compressed data. */
 size_t quicklistGetLzf(const quicklistNode *node, void **data) {
     quicklistLZF *lzf = (quicklistLZF *)node->zl;
     *data = lzf->compressed;
@@ -261,15 +289,18 @@ size_t quicklistGetLzf(const quicklistNode *node, void **data) {
 /* Force 'quicklist' to meet compression guidelines set by compress depth.
  * The only way to guarantee interior nodes get compressed is to iterate
  * to our "interior" compress depth then compress the next node we find.
- * If compress depth is larger than the entire list, we return immediately. */
+ * If compress depth is larger than the entire list, all the nodes are
+ * left uncompressed: nodes compressed before the list shrank are
+ * decompressed, so the head and the tail are never compressed. */
 REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
                                       quicklistNode *node) {
-    /* If length is less than our compress depth (from both sides),
-     * we can't compress anything. */
-    if (!quicklistAllowsCompression(quicklist) ||
-        quicklist->len < (unsigned int)(quicklist->compress * 2))
+    if (!quicklistAllowsCompression(quicklist) || quicklist->len == 0)
         return;
 
+    /* Whatever happens below, 'node' no longer needs a recompress. */
+    if (node)
+        node->recompress = 0;
+
 #if 0
     /* Optimized cases for small depth counts */
     if (quicklist->compress == 1) {
@@ -277,7 +308,7 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
         quicklistDecompressNode(h);
         quicklistDecompressNode(t);
         if (h != node && t != node)
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         return;
     } else if (quicklist->compress == 2) {
         quicklistNode *h = quicklist->head, *hn = h->next, *hnn = hn->next;
@@ -287,13 +318,13 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
         quicklistDecompressNode(t);
         quicklistDecompressNode(tp);
         if (h != node && hn != node && t != node && tp != node) {
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         }
         if (hnn != t) {
-            quicklistCompressNode(hnn);
+            quicklistCompressNode(quicklist, hnn);
         }
         if (tpp != h) {
-            quicklistCompressNode(tpp);
+            quicklistCompressNode(quicklist, tpp);
         }
         return;
     }
@@ -313,7 +344,9 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
         if (forward == node || reverse == node)
             in_depth = 1;
 
-        if (forward == reverse)
+        /* We passed into compress depth of opposite side of the quicklist
+         * so there's no need to compress anything and we can exit. */
+        if (forward == reverse || forward->next == reverse)
             return;
 
         forward = forward->next;
@@ -321,28 +354,26 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
     }
 
     if (!in_depth)
-        quicklistCompressNode(node);
+        quicklistCompressNode(quicklist, node);
 
-    if (depth > 2) {
-        /* At this point, forward and reverse are one node beyond depth */
-        quicklistCompressNode(forward);
-        quicklistCompressNode(reverse);
-    }
+    /* At this point, forward and reverse are one node beyond depth */
+    quicklistCompressNode(quicklist, forward);
+    quicklistCompressNode(quicklist, reverse);
 }
 
+/* Nodes decompressed for use are compressed again only if they are still
+ * out of the compress depth: splits, merges and deletions may have moved
+ * them to the head or the tail in the meantime. */
 #define quicklistCompress(_ql, _node)                                          \
     do {                                                                       \
-        if ((_node)->recompress)                                               \
-            quicklistCompressNode((_node));                                    \
-        else                                                                   \
-            __quicklistCompress((_ql), (_node));                               \
+        __quicklistCompress((_ql), (_node));                                   \
     } while (0)
 
 /* If we previously used quicklistDecompressNodeForUse(), just recompress. */
 #define quicklistRecompressOnly(_ql, _node)                                    \
     do {                                                                       \
         if ((_node)->recompress)                                               \
-            quicklistCompressNode((_node));                                    \
+            __quicklistCompress((_ql), (_node));                               \
     } while (0)
 
 /* Insert 'new_node' after 'old_node' if 'after' is 1.
@@ -378,10 +409,15 @@ REDIS_STATIC void __quicklistInsertNode(quicklist *quicklist,
         quicklist->head = quicklist->tail = new_node;
     }
 
+    /* Update len first, so in __quicklistCompress we know exactly len */
+    quicklist->len++;
+
     if (old_node)
         quicklistCompress(quicklist, old_node);
 
-    quicklist->len++;
+    /* Nodes inserted in the middle may be out of compress depth too. */
+    if (new_node != quicklist->head && new_node != quicklist->tail)
+        quicklistCompress(quicklist, new_node);
 }
 
 /* Wrappers for node inserting around existing node. */
@@ -422,23 +458,25 @@ REDIS_STATIC int _quicklistNodeAllowInsert(const quicklistNode *node,
     if (unlikely(!node))
         return 0;
 
-    int ziplist_overhead;
-    /* size of previous offset */
-    if (sz < 254)
-        ziplist_overhead = 1;
+    int listpack_overhead;
+    /* size of the encoding header */
+    if (sz < 64)
+        listpack_overhead = 1;
+    else if (likely(sz < 4096))
+        listpack_overhead = 2;
     else
-        ziplist_overhead = 5;
+        listpack_overhead = 5;
 
-    /* size of forward offset */
-    if (sz < 64)
-        ziplist_overhead += 1;
-    else if (likely(sz < 16384))
-        ziplist_overhead += 2;
+    /* size of the backlen */
+    if (sz + listpack_overhead <= 127)
+        listpack_overhead += 1;
+    else if (likely(sz + listpack_overhead < 16383))
+        listpack_overhead += 2;
     else
-        ziplist_overhead += 5;
+        listpack_overhead += 5;
 
     /* new_sz overestimates if 'sz' encodes to an integer type */
-    unsigned int new_sz = node->sz + sz + ziplist_overhead;
+    unsigned int new_sz = node->sz + sz + listpack_overhead;
     if (likely(_quicklistNodeSizeMeetsOptimizationRequirement(new_sz, fill)))
         return 1;
     else if (!sizeMeetsSafetyLimit(new_sz))
@@ -455,9 +493,9 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a,
     if (!a || !b)
         return 0;
 
-    /* approximate merged ziplist size (- 11 to remove one ziplist
+    /* approximate merged listpack size (- 7 to remove one listpack
      * header/trailer) */
-    unsigned int merge_sz = a->sz + b->sz - 11;
+    unsigned int merge_sz = a->sz + b->sz - 7;
     if (likely(_quicklistNodeSizeMeetsOptimizationRequirement(merge_sz, fill)))
         return 1;
     else if (!sizeMeetsSafetyLimit(merge_sz))
@@ -470,7 +508,7 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a,
 
 #define quicklistNodeUpdateSz(node)                                            \
     do {                                                                       \
-        (node)->sz = ziplistBlobLen((node)->zl);                               \
+        (node)->sz = lpBytes((node)->zl);                                      \
     } while (0)
 
 /* Add new entry to head node of quicklist.
@@ -481,12 +519,11 @@ int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
     quicklistNode *orig_head = quicklist->head;
     if (likely(
             _quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz))) {
-        quicklist->head->zl =
-            ziplistPush(quicklist->head->zl, value, sz, ZIPLIST_HEAD);
+        quicklist->head->zl = lpPrepend(quicklist->head->zl, value, sz);
         quicklistNodeUpdateSz(quicklist->head);
     } else {
         quicklistNode *node = quicklistCreateNode();
-        node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        node->zl = lpPrepend(lpNew(), value, sz);
 
         quicklistNodeUpdateSz(node);
         _quicklistInsertNodeBefore(quicklist, quicklist->head, node);
@@ -504,12 +541,11 @@ int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
     quicklistNode *orig_tail = quicklist->tail;
     if (likely(
             _quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz))) {
-        quicklist->tail->zl =
-            ziplistPush(quicklist->tail->zl, value, sz, ZIPLIST_TAIL);
+        quicklist->tail->zl = lpAppend(quicklist->tail->zl, value, sz);
         quicklistNodeUpdateSz(quicklist->tail);
     } else {
         quicklistNode *node = quicklistCreateNode();
-        node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_TAIL);
+        node->zl = lpAppend(lpNew(), value, sz);
 
         quicklistNodeUpdateSz(node);
         _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
@@ -519,53 +555,55 @@ int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
     return (orig_tail != quicklist->tail);
 }
 
-/* Create new node consisting of a pre-formed ziplist.
- * Used for loading RDBs where entire ziplists have been stored
+/* Create new node consisting of a pre-formed listpack.
+ * Used for loading RDBs where entire listpacks have been stored
  * to be retrieved later. */
-void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl) {
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *zl) {
     quicklistNode *node = quicklistCreateNode();
 
     node->zl = zl;
-    node->count = ziplistLen(node->zl);
-    node->sz = ziplistBlobLen(zl);
+    node->count = lpLength(node->zl);
+    node->sz = lpBytes(zl);
 
     _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
     quicklist->count += node->count;
 }
 
-/* Append all values of ziplist 'zl' individually into 'quicklist'.
+/* Append all values of listpack 'zl' individually into 'quicklist'.
  *
- * This allows us to restore old RDB ziplists into new quicklists
- * with smaller ziplist sizes than the saved RDB ziplist.
+ * This allows us to restore old RDB listpacks into new quicklists
+ * with smaller listpack sizes than the saved RDB listpack.
  *
- * Returns 'quicklist' argument. Frees passed-in ziplist 'zl' */
-quicklist *quicklistAppendValuesFromZiplist(quicklist *quicklist,
-                                            unsigned char *zl) {
+ * Returns 'quicklist' argument. Frees passed-in listpack 'zl' */
+quicklist *quicklistAppendValuesFromListpack(quicklist *quicklist,
+                                             unsigned char *zl) {
     unsigned char *value;
     unsigned int sz;
     long long longval;
     char longstr[32] = {0};
 
-    unsigned char *p = ziplistIndex(zl, 0);
-    while (ziplistGet(p, &value, &sz, &longval)) {
+    unsigned char *p = lpFirst(zl);
+    while (p) {
+        value = lpGetValue(p, &sz, &longval);
         if (!value) {
             /* Write the longval as a string so we can re-add it */
             sz = ll2string(longstr, sizeof(longstr), longval);
             value = (unsigned char *)longstr;
         }
         quicklistPushTail(quicklist, value, sz);
-        p = ziplistNext(zl, p);
+        p = lpNext(zl, p);
     }
-    zfree(zl);
+    lpFree(zl);
     return quicklist;
 }
 
-/* Create new (potentially multi-node) quicklist from a single existing ziplist.
+/* Create new (potentially multi-node) quicklist from a single existing
+ * listpack.
  *
- * Returns new quicklist.  Frees passed-in ziplist 'zl'. */
-quicklist *quicklistCreateFromZiplist(int fill, int compress,
-                                      unsigned char *zl) {
-    return quicklistAppendValuesFromZiplist(quicklistNew(fill, compress), zl);
+ * Returns new quicklist.  Frees passed-in listpack 'zl'. */
+quicklist *quicklistCreateFromListpack(int fill, int compress,
+                                       unsigned char *zl) {
+    return quicklistAppendValuesFromListpack(quicklistNew(fill, compress), zl);
 }
 
 #define quicklistDeleteIfEmpty(ql, n)                                          \
@@ -591,15 +629,16 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
         quicklist->head = node->next;
     }
 
+    /* Update len first, so in __quicklistCompress we know exactly len */
+    quicklist->len--;
+    quicklist->count -= node->count;
+
     /* If we deleted a node within our compress depth, we
      * now have compressed nodes needing to be decompressed. */
     __quicklistCompress(quicklist, NULL);
 
-    quicklist->count -= node->count;
-
     zfree(node->zl);
     zfree(node);
-    quicklist->len--;
 }
 
 /* Delete one entry from list given the node for the entry and a pointer
@@ -609,12 +648,12 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
  *       already had to get *p from an uncompressed node somewhere.
  *
  * Returns 1 if the entire node was deleted, 0 if node still exists.
- * Also updates in/out param 'p' with the next offset in the ziplist. */
+ * Also updates in/out param 'p' with the next offset in the listpack. */
 REDIS_STATIC int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
                                    unsigned char **p) {
     int gone = 0;
 
-    node->zl = ziplistDelete(node->zl, p);
+    node->zl = lpDelete(node->zl, *p, p);
     node->count--;
     if (node->count == 0) {
         gone = 1;
@@ -630,7 +669,7 @@ REDIS_STATIC int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
 /* Delete one element represented by 'entry'
  *
  * 'entry' stores enough metadata to delete the proper position in
- * the correct ziplist in the correct quicklist node. */
+ * the correct listpack in the correct quicklist node. */
 void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
     quicklistNode *prev = entry->node->prev;
     quicklistNode *next = entry->node->next;
@@ -656,7 +695,7 @@ void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
      *   - [1, 2, 3] => delete offset 1 => [1, 3]: next element still offset 1
      *   - [1, 2, 3] => delete offset 0 => [2, 3]: next element still offset 0
      *  if we deleted the last element at offet N and now
-     *  length of this ziplist is N-1, the next call into
+     *  length of this listpack is N-1, the next call into
      *  quicklistNext() will jump to the next node. */
 }
 
@@ -669,8 +708,8 @@ int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
     quicklistEntry entry;
     if (likely(quicklistIndex(quicklist, index, &entry))) {
         /* quicklistIndex provides an uncompressed node */
-        entry.node->zl = ziplistDelete(entry.node->zl, &entry.zi);
-        entry.node->zl = ziplistInsert(entry.node->zl, entry.zi, data, sz);
+        entry.node->zl = lpInsert(entry.node->zl, data, sz, entry.zi,
+                                  LP_REPLACE, NULL);
         quicklistNodeUpdateSz(entry.node);
         quicklistCompress(quicklist, entry.node);
         return 1;
@@ -679,9 +718,9 @@ int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
     }
 }
 
-/* Given two nodes, try to merge their ziplists.
+/* Given two nodes, try to merge their listpacks.
  *
- * This helps us not have a quicklist with 3 element ziplists if
+ * This helps us not have a quicklist with 3 element listpacks if
  * our fill factor can handle much higher levels.
  *
  * Note: 'a' must be to the LEFT of 'b'.
@@ -692,15 +731,15 @@ int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
  *
  * Returns the input node picked to merge against or NULL if
  * merging was not possible. */
-REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist,
+REDIS_STATIC quicklistNode *_quicklistListpackMerge(quicklist *quicklist,
                                                    quicklistNode *a,
                                                    quicklistNode *b) {
     D("Requested merge (a,b) (%u, %u)", a->count, b->count);
 
     quicklistDecompressNode(a);
     quicklistDecompressNode(b);
-    if ((ziplistMerge(&a->zl, &b->zl))) {
-        /* We merged ziplists! Now remove the unused quicklistNode. */
+    if ((lpMerge(&a->zl, &b->zl))) {
+        /* We merged listpacks! Now remove the unused quicklistNode. */
         quicklistNode *keep = NULL, *nokeep = NULL;
         if (!a->zl) {
             nokeep = a;
@@ -709,7 +748,7 @@ REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist,
             nokeep = b;
             keep = a;
         }
-        keep->count = ziplistLen(keep->zl);
+        keep->count = lpLength(keep->zl);
         quicklistNodeUpdateSz(keep);
 
         nokeep->count = 0;
@@ -722,7 +761,7 @@ REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist,
     }
 }
 
-/* Attempt to merge ziplists within two nodes on either side of 'center'.
+/* Attempt to merge listpacks within two nodes on either side of 'center'.
  *
  * We attempt to merge:
  *   - (center->prev->prev, center->prev)
@@ -750,19 +789,19 @@ REDIS_STATIC void _quicklistMergeNodes(quicklist *quicklist,
 
     /* Try to merge prev_prev and prev */
     if (_quicklistNodeAllowMerge(prev, prev_prev, fill)) {
-        _quicklistZiplistMerge(quicklist, prev_prev, prev);
+        _quicklistListpackMerge(quicklist, prev_prev, prev);
         prev_prev = prev = NULL; /* they could have moved, invalidate them. */
     }
 
     /* Try to merge next and next_next */
     if (_quicklistNodeAllowMerge(next, next_next, fill)) {
-        _quicklistZiplistMerge(quicklist, next, next_next);
+        _quicklistListpackMerge(quicklist, next, next_next);
         next = next_next = NULL; /* they could have moved, invalidate them. */
     }
 
     /* Try to merge center node and previous node */
     if (_quicklistNodeAllowMerge(center, center->prev, fill)) {
-        target = _quicklistZiplistMerge(quicklist, center->prev, center);
+        target = _quicklistListpackMerge(quicklist, center->prev, center);
         center = NULL; /* center could have been deleted, invalidate it. */
     } else {
         /* else, we didn't merge here, but target needs to be valid below. */
@@ -771,7 +810,7 @@ REDIS_STATIC void _quicklistMergeNodes(quicklist *quicklist,
 
     /* Use result of center merge (or original) to merge with next node. */
     if (_quicklistNodeAllowMerge(target, target->next, fill)) {
-        _quicklistZiplistMerge(quicklist, target, target->next);
+        _quicklistListpackMerge(quicklist, target, target->next);
     }
 }
 
@@ -801,7 +840,7 @@ REDIS_STATIC quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
     quicklistNode *new_node = quicklistCreateNode();
     new_node->zl = zmalloc(zl_sz);
 
-    /* Copy original ziplist so we can split it */
+    /* Copy original listpack so we can split it */
     memcpy(new_node->zl, node->zl, zl_sz);
 
     /* -1 here means "continue deleting until the list ends" */
@@ -813,12 +852,12 @@ REDIS_STATIC quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
     D("After %d (%d); ranges: [%d, %d], [%d, %d]", after, offset, orig_start,
       orig_extent, new_start, new_extent);
 
-    node->zl = ziplistDeleteRange(node->zl, orig_start, orig_extent);
-    node->count = ziplistLen(node->zl);
+    node->zl = lpDeleteRange(node->zl, orig_start, orig_extent);
+    node->count = lpLength(node->zl);
     quicklistNodeUpdateSz(node);
 
-    new_node->zl = ziplistDeleteRange(new_node->zl, new_start, new_extent);
-    new_node->count = ziplistLen(new_node->zl);
+    new_node->zl = lpDeleteRange(new_node->zl, new_start, new_extent);
+    new_node->count = lpLength(new_node->zl);
     quicklistNodeUpdateSz(new_node);
 
     D("After split lengths: orig (%d), new (%d)", node->count, new_node->count);
@@ -840,7 +879,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         /* we have no reference node, so let's create only node in the list */
         D("No node given!");
         new_node = quicklistCreateNode();
-        new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        new_node->zl = lpPrepend(lpNew(), value, sz);
         __quicklistInsertNode(quicklist, NULL, new_node, after);
         new_node->count++;
         quicklist->count++;
@@ -855,7 +894,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     }
 
     if (after && (entry->offset == node->count)) {
-        D("At Tail of current ziplist");
+        D("At Tail of current listpack");
         at_tail = 1;
         if (!_quicklistNodeAllowInsert(node->next, fill, sz)) {
             D("Next node is full too.");
@@ -876,19 +915,14 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     if (!full && after) {
         D("Not full, inserting after current position.");
         quicklistDecompressNodeForUse(node);
-        unsigned char *next = ziplistNext(node->zl, entry->zi);
-        if (next == NULL) {
-            node->zl = ziplistPush(node->zl, value, sz, ZIPLIST_TAIL);
-        } else {
-            node->zl = ziplistInsert(node->zl, next, value, sz);
-        }
+        node->zl = lpInsert(node->zl, value, sz, entry->zi, LP_AFTER, NULL);
         node->count++;
         quicklistNodeUpdateSz(node);
         quicklistRecompressOnly(quicklist, node);
     } else if (!full && !after) {
         D("Not full, inserting before current position.");
         quicklistDecompressNodeForUse(node);
-        node->zl = ziplistInsert(node->zl, entry->zi, value, sz);
+        node->zl = lpInsert(node->zl, value, sz, entry->zi, LP_BEFORE, NULL);
         node->count++;
         quicklistNodeUpdateSz(node);
         quicklistRecompressOnly(quicklist, node);
@@ -898,7 +932,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         D("Full and tail, but next isn't full; inserting next node head");
         new_node = node->next;
         quicklistDecompressNodeForUse(new_node);
-        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_HEAD);
+        new_node->zl = lpPrepend(new_node->zl, value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
         quicklistRecompressOnly(quicklist, new_node);
@@ -908,7 +942,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         D("Full and head, but prev isn't full, inserting prev node tail");
         new_node = node->prev;
         quicklistDecompressNodeForUse(new_node);
-        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_TAIL);
+        new_node->zl = lpAppend(new_node->zl, value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
         quicklistRecompressOnly(quicklist, new_node);
@@ -918,7 +952,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
          *   - create new node and attach to quicklist */
         D("\tprovisioning new node...");
         new_node = quicklistCreateNode();
-        new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        new_node->zl = lpPrepend(lpNew(), value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
         __quicklistInsertNode(quicklist, node, new_node, after);
@@ -928,8 +962,10 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         D("\tsplitting node...");
         quicklistDecompressNodeForUse(node);
         new_node = _quicklistSplitNode(node, entry->offset, after);
-        new_node->zl = ziplistPush(new_node->zl, value, sz,
-                                   after ? ZIPLIST_HEAD : ZIPLIST_TAIL);
+        if (after)
+            new_node->zl = lpPrepend(new_node->zl, value, sz);
+        else
+            new_node->zl = lpAppend(new_node->zl, value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
         __quicklistInsertNode(quicklist, node, new_node, after);
@@ -986,10 +1022,10 @@ int quicklistDelRange(quicklist *quicklist, const long start,
         int delete_entire_node = 0;
         if (entry.offset == 0 && extent >= node->count) {
             /* If we are deleting more than the count of this node, we
-             * can just delete the entire node without ziplist math. */
+             * can just delete the entire node without listpack math. */
             delete_entire_node = 1;
             del = node->count;
-        } else if (entry.offset >= 0 && extent >= node->count) {
+        } else if (entry.offset >= 0 && extent + entry.offset >= node->count) {
             /* If deleting more nodes after this one, calculate delete based
              * on size of current node. */
             del = node->count - entry.offset;
@@ -1020,7 +1056,7 @@ int quicklistDelRange(quicklist *quicklist, const long start,
             __quicklistDelNode(quicklist, node);
         } else {
             quicklistDecompressNodeForUse(node);
-            node->zl = ziplistDeleteRange(node->zl, entry.offset, del);
+            node->zl = lpDeleteRange(node->zl, entry.offset, del);
             quicklistNodeUpdateSz(node);
             node->count -= del;
             quicklist->count -= del;
@@ -1038,9 +1074,9 @@ int quicklistDelRange(quicklist *quicklist, const long start,
     return 1;
 }
 
-/* Passthrough to ziplistCompare() */
+/* Passthrough to lpCompare() */
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len) {
-    return ziplistCompare(p1, p2, p2_len);
+    return lpCompare(p1, p2, p2_len);
 }
 
 /* Returns a quicklist iterator 'iter'. After the initialization every
@@ -1136,14 +1172,14 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
     if (!iter->zi) {
         /* If !zi, use current index. */
         quicklistDecompressNodeForUse(iter->current);
-        iter->zi = ziplistIndex(iter->current->zl, iter->offset);
+        iter->zi = lpSeek(iter->current->zl, iter->offset);
     } else {
         /* else, use existing iterator offset and get prev/next as necessary. */
         if (iter->direction == AL_START_HEAD) {
-            nextFn = ziplistNext;
+            nextFn = lpNext;
             offset_update = 1;
         } else if (iter->direction == AL_START_TAIL) {
-            nextFn = ziplistPrev;
+            nextFn = lpPrev;
             offset_update = -1;
         }
         iter->zi = nextFn(iter->current->zl, iter->zi);
@@ -1154,11 +1190,11 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
     entry->offset = iter->offset;
 
     if (iter->zi) {
-        /* Populate value from existing ziplist position */
-        ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+        /* Populate value from existing listpack position */
+        entry->value = lpGetValue(entry->zi, &entry->sz, &entry->longval);
         return 1;
     } else {
-        /* We ran out of ziplist entries.
+        /* We ran out of listpack entries.
          * Pick next node, update offset, then re-run retrieval. */
         quicklistCompress(iter->quicklist, iter->current);
         if (iter->direction == AL_START_HEAD) {
@@ -1187,12 +1223,13 @@ quicklist *quicklistDup(quicklist *orig) {
     quicklist *copy;
 
     copy = quicklistNew(orig->fill, orig->compress);
+    copy->codec = orig->codec;
 
     for (quicklistNode *current = orig->head; current;
          current = current->next) {
         quicklistNode *node = quicklistCreateNode();
 
-        if (current->encoding == QUICKLIST_NODE_ENCODING_LZF) {
+        if (quicklistNodeIsCompressed(current)) {
             quicklistLZF *lzf = (quicklistLZF *)current->zl;
             size_t lzf_sz = sizeof(*lzf) + lzf->sz;
             node->zl = zmalloc(lzf_sz);
@@ -1271,8 +1308,8 @@ int quicklistIndex(const quicklist *quicklist, const long long idx,
     }
 
     quicklistDecompressNodeForUse(entry->node);
-    entry->zi = ziplistIndex(entry->node->zl, entry->offset);
-    ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+    entry->zi = lpSeek(entry->node->zl, entry->offset);
+    entry->value = lpGetValue(entry->zi, &entry->sz, &entry->longval);
     /* The caller will use our result, so we don't re-compress here.
      * The caller can recompress or delete the node as needed. */
     return 1;
@@ -1284,28 +1321,37 @@ void quicklistRotate(quicklist *quicklist) {
         return;
 
     /* First, get the tail entry */
-    unsigned char *p = ziplistIndex(quicklist->tail->zl, -1);
-    unsigned char *value;
+    unsigned char *p = lpSeek(quicklist->tail->zl, -1);
+    unsigned char *value, *tmp;
     long long longval;
     unsigned int sz;
     char longstr[32] = {0};
-    ziplistGet(p, &value, &sz, &longval);
+    tmp = lpGetValue(p, &sz, &longval);
 
-    /* If value found is NULL, then ziplistGet populated longval instead */
-    if (!value) {
+    /* If value found is NULL, then lpGetValue populated longval instead */
+    if (!tmp) {
         /* Write the longval as a string so we can re-add it */
         sz = ll2string(longstr, sizeof(longstr), longval);
         value = (unsigned char *)longstr;
+    } else if (quicklist->len == 1) {
+        /* Copy the value: prepending it to the same listpack may realloc
+         * the memory it points into. */
+        value = zmalloc(sz);
+        memcpy(value, tmp, sz);
+    } else {
+        value = tmp;
     }
 
     /* Add tail entry to head (must happen before tail is deleted). */
     quicklistPushHead(quicklist, value, sz);
+    if (value != tmp && value != (unsigned char *)longstr)
+        zfree(value);
 
-    /* If quicklist has only one node, the head ziplist is also the
-     * tail ziplist and PushHead() could have reallocated our single ziplist,
+    /* If quicklist has only one node, the head listpack is also the
+     * tail listpack and PushHead() could have reallocated our single listpack,
      * which would make our pre-existing 'p' unusable. */
     if (quicklist->len == 1) {
-        p = ziplistIndex(quicklist->tail->zl, -1);
+        p = lpSeek(quicklist->tail->zl, -1);
     }
 
     /* Remove tail entry. */
@@ -1349,8 +1395,9 @@ int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
         return 0;
     }
 
-    p = ziplistIndex(node->zl, pos);
-    if (ziplistGet(p, &vstr, &vlen, &vlong)) {
+    p = lpSeek(node->zl, pos);
+    if (p) {
+        vstr = lpGetValue(p, &vlen, &vlong);
         if (vstr) {
             if (data)
                 *data = saver(vstr, vlen);
@@ -1413,7 +1460,9 @@ void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
 /* The rest of this file is test cases and test helpers. */
 #ifdef REDIS_TEST
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #define assert(_e)                                                             \
     do {                                                                       \
@@ -1452,9 +1501,9 @@ static void ql_info(quicklist *ql) {
     printf("Container length: %lu\n", ql->len);
     printf("Container size: %lu\n", ql->count);
     if (ql->head)
-        printf("\t(zsize head: %d)\n", ziplistLen(ql->head->zl));
+        printf("\t(zsize head: %d)\n", lpLength(ql->head->zl));
     if (ql->tail)
-        printf("\t(zsize tail: %d)\n", ziplistLen(ql->tail->zl));
+        printf("\t(zsize tail: %d)\n", lpLength(ql->tail->zl));
     printf("\n");
 #else
     UNUSED(ql);
@@ -1552,18 +1601,18 @@ static int _ql_verify(quicklist *ql, uint32_t len, uint32_t count,
     }
 
     if (ql->head && head_count != ql->head->count &&
-        head_count != ziplistLen(ql->head->zl)) {
+        head_count != lpLength(ql->head->zl)) {
         yell("quicklist head count wrong: expected %d, "
              "got cached %d vs. actual %d",
-             head_count, ql->head->count, ziplistLen(ql->head->zl));
+             head_count, ql->head->count, lpLength(ql->head->zl));
         errors++;
     }
 
     if (ql->tail && tail_count != ql->tail->count &&
-        tail_count != ziplistLen(ql->tail->zl)) {
+        tail_count != lpLength(ql->tail->zl)) {
         yell("quicklist tail count wrong: expected %d, "
              "got cached %u vs. actual %d",
-             tail_count, ql->tail->count, ziplistLen(ql->tail->zl));
+             tail_count, ql->tail->count, lpLength(ql->tail->zl));
         errors++;
     }
 
@@ -1583,7 +1632,7 @@ static int _ql_verify(quicklist *ql, uint32_t len, uint32_t count,
                     errors++;
                 }
             } else {
-                if (node->encoding != QUICKLIST_NODE_ENCODING_LZF &&
+                if (!quicklistNodeIsCompressed(node) &&
                     !node->attempted_compress) {
                     yell("Incorrect non-compression: node %d is NOT "
                          "compressed at depth %d ((%u, %u); total "
@@ -1608,6 +1657,238 @@ static char *genstr(char *prefix, int i) {
     return result;
 }
 
+/* Randomized model test: every operation is applied both to a quicklist and
+ * to a plain array of strings, then the two are compared. */
+typedef struct qlModel {
+    char **val;
+    size_t *len;
+    long count;
+} qlModel;
+
+static void qlModelInsert(qlModel *m, long idx, char *v, size_t len) {
+    m->val = zrealloc(m->val, sizeof(char *) * (m->count + 1));
+    m->len = zrealloc(m->len, sizeof(size_t) * (m->count + 1));
+    memmove(m->val + idx + 1, m->val + idx, sizeof(char *) * (m->count - idx));
+    memmove(m->len + idx + 1, m->len + idx, sizeof(size_t) * (m->count - idx));
+    m->val[idx] = zmalloc(len);
+    memcpy(m->val[idx], v, len);
+    m->len[idx] = len;
+    m->count++;
+}
+
+static void qlModelDelete(qlModel *m, long idx, long n) {
+    for (long i = idx; i < idx + n; i++)
+        zfree(m->val[i]);
+    memmove(m->val + idx, m->val + idx + n,
+            sizeof(char *) * (m->count - idx - n));
+    memmove(m->len + idx, m->len + idx + n,
+            sizeof(size_t) * (m->count - idx - n));
+    m->count -= n;
+}
+
+/* Fill 'buf' with a random value: integers, that listpack stores encoded,
+ * and strings repetitive enough for the nodes to compress, now and then
+ * larger than SIZE_SAFETY_LIMIT. */
+static size_t qlModelRandomValue(char *buf, size_t size) {
+    int r = rand() % 100;
+    size_t len;
+
+    if (r < 20)
+        return snprintf(buf, size, "%d", rand() - RAND_MAX / 2);
+    len = r < 98 ? 1 + rand() % 120 : SIZE_SAFETY_LIMIT + rand() % 1000;
+    if (len > size)
+        len = size;
+    for (size_t i = 0; i < len; i++)
+        buf[i] = "quicklist"[(i + r) % 9];
+    buf[0] = 'v';
+    return len;
+}
+
+static int qlModelEntryEqual(quicklistEntry *entry, char *v, size_t len) {
+    char num[32];
+
+    if (entry->value)
+        return entry->sz == len && memcmp(entry->value, v, len) == 0;
+    return (size_t)ll2string(num, sizeof(num), entry->longval) == len &&
+           memcmp(num, v, len) == 0;
+}
+
+/* Compare 'ql' with the model, and check that the head and the tail are
+ * never compressed, and that every node out of the compress depth is,
+ * unless quicklistIndex() left it decompressed for use. */
+static int qlModelVerify(quicklist *ql, qlModel *m) {
+    quicklistIter *iter;
+    quicklistEntry entry;
+    quicklistNode *node;
+    unsigned long len = 0, count = 0;
+    long i = 0;
+    int errors = 0;
+
+    if ((long)ql->count != m->count) {
+        yell("model count wrong: expected %ld, got %lu", m->count, ql->count);
+        return 1;
+    }
+
+    for (node = ql->head; node; node = node->next, len++) {
+        count += node->count;
+        if (node->count == 0) {
+            yell("node %lu of %lu is empty", len, ql->len);
+            errors++;
+        }
+        if (quicklistNodeIsCompressed(node) &&
+            (len < ql->compress || len >= ql->len - ql->compress ||
+             !quicklistAllowsCompression(ql))) {
+            yell("node %lu of %lu is compressed at depth %d", len, ql->len,
+                 ql->compress);
+            errors++;
+        } else if (!quicklistNodeIsCompressed(node) &&
+                   !node->attempted_compress && !node->recompress &&
+                   quicklistAllowsCompression(ql) &&
+                   len >= ql->compress && len < ql->len - ql->compress) {
+            yell("node %lu of %lu is not compressed at depth %d", len, ql->len,
+                 ql->compress);
+            errors++;
+        }
+    }
+    if (len != ql->len || count != ql->count) {
+        yell("model nodes wrong: %lu nodes with %lu entries, expected %lu "
+             "nodes with %lu entries",
+             len, count, ql->len, ql->count);
+        errors++;
+    }
+
+    iter = quicklistGetIterator(ql, AL_START_HEAD);
+    while (quicklistNext(iter, &entry)) {
+        if (i >= m->count || !qlModelEntryEqual(&entry, m->val[i], m->len[i])) {
+            yell("model entry %ld differs", i);
+            errors++;
+            break;
+        }
+        i++;
+    }
+    quicklistReleaseIterator(iter);
+
+    i = m->count - 1;
+    iter = quicklistGetIterator(ql, AL_START_TAIL);
+    while (quicklistNext(iter, &entry)) {
+        if (i < 0 || !qlModelEntryEqual(&entry, m->val[i], m->len[i])) {
+            yell("model entry %ld differs iterating backward", i);
+            errors++;
+            break;
+        }
+        i--;
+    }
+    quicklistReleaseIterator(iter);
+
+    if (m->count) {
+        i = rand() % m->count;
+        if (!quicklistIndex(ql, i, &entry) ||
+            !qlModelEntryEqual(&entry, m->val[i], m->len[i])) {
+            yell("model index %ld differs", i);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/* Run 'ops' random operations on a quicklist with the given options,
+ * returning the number of errors. */
+static int qlModelRun(int fill, int depth, int codec, int ops) {
+    quicklist *ql = quicklistNew(fill, depth);
+    qlModel m = {NULL, NULL, 0};
+    char buf[SIZE_SAFETY_LIMIT + 1024];
+    quicklistIter *iter;
+    quicklistEntry entry;
+    int errors = 0;
+
+    quicklistSetCodec(ql, codec);
+    for (int op = 0; op < ops && !errors; op++) {
+        size_t len = qlModelRandomValue(buf, sizeof(buf));
+        long idx = m.count ? rand() % m.count : 0;
+        long n;
+
+        switch (rand() % 9) {
+        case 0:
+        case 1:
+            quicklistPushHead(ql, buf, len);
+            qlModelInsert(&m, 0, buf, len);
+            break;
+        case 2:
+        case 3:
+            quicklistPushTail(ql, buf, len);
+            qlModelInsert(&m, m.count, buf, len);
+            break;
+        case 4:
+            if (!m.count)
+                break;
+            quicklistIndex(ql, idx, &entry);
+            if (rand() % 2) {
+                quicklistInsertBefore(ql, &entry, buf, len);
+                qlModelInsert(&m, idx, buf, len);
+            } else {
+                quicklistInsertAfter(ql, &entry, buf, len);
+                qlModelInsert(&m, idx + 1, buf, len);
+            }
+            break;
+        case 5:
+            if (!m.count)
+                break;
+            iter = quicklistGetIteratorAtIdx(ql, AL_START_HEAD, idx);
+            quicklistNext(iter, &entry);
+            quicklistDelEntry(iter, &entry);
+            quicklistReleaseIterator(iter);
+            qlModelDelete(&m, idx, 1);
+            break;
+        case 6:
+            /* Ranges often start mid node and run past its end, or past
+             * the end of the list. */
+            if (!m.count)
+                break;
+            n = 1 + rand() % (m.count + 10);
+            if (rand() % 2) {
+                quicklistDelRange(ql, idx - m.count, n);
+            } else {
+                quicklistDelRange(ql, idx, n);
+            }
+            qlModelDelete(&m, idx, n < m.count - idx ? n : m.count - idx);
+            break;
+        case 7:
+            if (!m.count)
+                break;
+            quicklistReplaceAtIndex(ql, idx, buf, len);
+            zfree(m.val[idx]);
+            m.val[idx] = zmalloc(len);
+            memcpy(m.val[idx], buf, len);
+            m.len[idx] = len;
+            break;
+        case 8:
+            if (!m.count)
+                break;
+            if (rand() % 2) {
+                quicklistPop(ql, QUICKLIST_HEAD, (unsigned char **)&entry.value,
+                             NULL, NULL);
+                qlModelDelete(&m, 0, 1);
+            } else {
+                quicklistPop(ql, QUICKLIST_TAIL, (unsigned char **)&entry.value,
+                             NULL, NULL);
+                qlModelDelete(&m, m.count - 1, 1);
+            }
+            zfree(entry.value);
+            break;
+        }
+        errors += qlModelVerify(ql, &m);
+        if (errors)
+            yell("model test failed at op %d (fill %d, depth %d, codec %d)",
+                 op, fill, depth, codec);
+    }
+
+    qlModelDelete(&m, 0, m.count);
+    zfree(m.val);
+    zfree(m.len);
+    quicklistRelease(ql);
+    return errors;
+}
+
 /* main test, but callable from other files */
 int quicklistTest(int argc, char *argv[]) {
     UNUSED(argc);
@@ -1717,7 +1998,7 @@ int quicklistTest(int argc, char *argv[]) {
                 quicklist *ql = quicklistNew(f, options[_i]);
                 quicklistPushHead(ql, "hello", 6);
                 quicklistRotate(ql);
-                /* Ignore compression verify because ziplist is
+                /* Ignore compression verify because listpack is
                  * too small to compress. */
                 ql_verify(ql, 1, 1, 1, 1);
                 quicklistRelease(ql);
@@ -2555,22 +2836,20 @@ int quicklistTest(int argc, char *argv[]) {
         }
 
         for (int f = optimize_start; f < 72; f++) {
-            TEST_DESC("create quicklist from ziplist at fill %d at compress %d",
+            TEST_DESC("create quicklist from listpack at fill %d at compress %d",
                       f, options[_i]) {
-                unsigned char *zl = ziplistNew();
+                unsigned char *zl = lpNew();
                 long long nums[64];
                 char num[64];
                 for (int i = 0; i < 33; i++) {
                     nums[i] = -5157318210846258176 + i;
                     int sz = ll2string(num, sizeof(num), nums[i]);
-                    zl =
-                        ziplistPush(zl, (unsigned char *)num, sz, ZIPLIST_TAIL);
+                    zl = lpAppend(zl, (unsigned char *)num, sz);
                 }
                 for (int i = 0; i < 33; i++) {
-                    zl = ziplistPush(zl, (unsigned char *)genstr("hello", i),
-                                     32, ZIPLIST_TAIL);
+                    zl = lpAppend(zl, (unsigned char *)genstr("hello", i), 32);
                 }
-                quicklist *ql = quicklistCreateFromZiplist(f, options[_i], zl);
+                quicklist *ql = quicklistCreateFromListpack(f, options[_i], zl);
                 if (f == 1)
                     ql_verify(ql, 66, 66, 1, 1);
                 else if (f == 32)
@@ -2618,7 +2897,7 @@ int quicklistTest(int argc, char *argv[]) {
                                     node->sz);
                             }
                         } else {
-                            if (node->encoding != QUICKLIST_NODE_ENCODING_LZF) {
+                            if (!quicklistNodeIsCompressed(node)) {
                                 ERR("Incorrect non-compression: node %d is NOT "
                                     "compressed at depth %d ((%u, %u); total "
                                     "nodes: %u; size: %u; attempted: %d)",
@@ -2632,6 +2911,36 @@ int quicklistTest(int argc, char *argv[]) {
             }
         }
     }
+    TEST("fill and compress limits fit their bitfields") {
+        quicklist *ql = quicklistNew(FILL_MAX + 1, COMPRESS_MAX + 1);
+        if (ql->fill != FILL_MAX || ql->compress != COMPRESS_MAX)
+            ERR("limits overflowed: fill %d, compress %u", ql->fill,
+                ql->compress);
+        quicklistSetOptions(ql, FILL_MAX, COMPRESS_MAX);
+        if (ql->fill != FILL_MAX || ql->compress != COMPRESS_MAX)
+            ERR("limits overflowed: fill %d, compress %u", ql->fill,
+                ql->compress);
+        quicklistRelease(ql);
+        err += qlModelRun(FILL_MAX + 1, COMPRESS_MAX + 1, QUICKLIST_CODEC_LZF,
+                          500);
+        OK;
+    }
+
+    TEST("randomized operations against a model") {
+        int fills[] = {-5, -2, -1, 1, 2, 8, 1000};
+        unsigned int seed = time(NULL);
+        printf("model test seed: %u\n", seed);
+        srand(seed);
+        for (size_t f = 0; f < sizeof(fills) / sizeof(*fills); f++) {
+            for (int depth = 0; depth < 8; depth++) {
+                for (int codec = QUICKLIST_CODEC_LZF;
+                     codec <= QUICKLIST_CODEC_LZFAST_HIGH; codec++)
+                    err += qlModelRun(fills[f], depth, codec, 1000);
+            }
+        }
+        OK;
+    }
+
     long long stop = mstime();
 
     printf("\n");
@@ -7,12 +7,19 @@
 #include "atomicvar.h"
 #include "zmalloc.h"
 #include "db.h"
+#include "lazyfree.h"
 #include "object.h"
 #include "sds.h"
 #include "dict.h"
+#include "adlist.h"
+#include "util.h"
 
 db_config g_db_config;
-db_status g_db_status;
+
+/* All the live handles, so that the process wide hit/miss counters can be
+ * computed summing up the per handle stats. */
+static list *g_handles = NULL;
+static pthread_mutex_t g_handles_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* This is the generic command implementation for EXPIRE, PEXPIRE, EXPIREAT
  * and PEXPIREAT. Because the commad second argument may be relative or absolute
@@ -56,36 +63,178 @@ void RcSetConfig(db_config* cfg)
     atomicSet(g_db_config.maxmemory,cfg->maxmemory);
     atomicSet(g_db_config.maxmemory_policy,cfg->maxmemory_policy);
     atomicSet(g_db_config.maxmemory_samples,cfg->maxmemory_samples);
+    atomicSet(g_db_config.maxmemory_eviction_pool,cfg->maxmemory_eviction_pool);
     atomicSet(g_db_config.lfu_decay_time,cfg->lfu_decay_time);
+    atomicSet(g_db_config.evict_high_watermark,cfg->evict_high_watermark);
+    atomicSet(g_db_config.evict_low_watermark,cfg->evict_low_watermark);
+    atomicSet(g_db_config.lazyfree_lazy_eviction,cfg->lazyfree_lazy_eviction);
+    atomicSet(g_db_config.lazyfree_lazy_expire,cfg->lazyfree_lazy_expire);
+    atomicSet(g_db_config.lazyfree_lazy_server_del,cfg->lazyfree_lazy_server_del);
+    atomicSet(g_db_config.active_expire_stale_perc,cfg->active_expire_stale_perc);
+    atomicSet(g_db_config.zset_max_listpack_entries,cfg->zset_max_listpack_entries);
+    atomicSet(g_db_config.zset_max_listpack_value,cfg->zset_max_listpack_value);
+    atomicSet(g_db_config.hash_max_listpack_entries,cfg->hash_max_listpack_entries);
+    atomicSet(g_db_config.hash_max_listpack_value,cfg->hash_max_listpack_value);
+    atomicSet(g_db_config.set_max_intset_entries,cfg->set_max_intset_entries);
+    atomicSet(g_db_config.list_max_listpack_size,cfg->list_max_listpack_size);
+    atomicSet(g_db_config.list_compress_depth,cfg->list_compress_depth);
+    atomicSet(g_db_config.list_compress_codec,cfg->list_compress_codec);
+}
+
+static redisCache registerCacheHandle(cacheHandle *handle)
+{
+    if (NULL == handle) return NULL;
+
+    pthread_mutex_lock(&g_handles_mutex);
+    if (NULL == g_handles) g_handles = listCreate();
+    listAddNodeTail(g_handles, handle);
+    pthread_mutex_unlock(&g_handles_mutex);
+    return handle;
 }
 
 redisCache RcCreateCacheHandle(void)
 {
-    return createRedisDb();
+    return registerCacheHandle(createCacheHandle(1, 0));
+}
+
+redisCache RcCreateShardedCacheHandle(unsigned int shard_num)
+{
+    if (0 == shard_num) return NULL;
+
+    return registerCacheHandle(createCacheHandle(shard_num, CACHE_HANDLE_THREAD_SAFE));
+}
+
+redisCache RcCreateCacheHandleWithFlags(unsigned int shard_num, int flags)
+{
+    if (0 == shard_num) return NULL;
+
+    return registerCacheHandle(createCacheHandle(shard_num, flags));
 }
 
 void RcDestroyCacheHandle(redisCache cache)
 {
     if (cache) {
-        redisDb *redis_db = (redisDb*)cache;
-        closeRedisDb(redis_db);
+        pthread_mutex_lock(&g_handles_mutex);
+        listNode *ln = listSearchKey(g_handles, cache);
+        if (ln) listDelNode(g_handles, ln);
+        pthread_mutex_unlock(&g_handles_mutex);
+        closeCacheHandle((cacheHandle*)cache);
     }
 }
 
-int RcFreeMemoryIfNeeded(redisCache cache)
+int RcSetHandleConfig(redisCache cache, db_config *cfg)
+{
+    if (NULL == cache || NULL == cfg) return REDIS_INVALID_ARG;
+
+    setCacheHandleConfig((cacheHandle*)cache, cfg);
+    return C_OK;
+}
+
+int RcSetKeyEventCallback(redisCache cache, keyEventProc *proc, void *privdata)
 {
     if (NULL == cache) return REDIS_INVALID_ARG;
 
-    redisDb *redis_db = (redisDb*)cache;
-    return freeMemoryIfNeeded(redis_db);
+    setCacheHandleKeyEventProc((cacheHandle*)cache, proc, privdata);
+    return C_OK;
+}
+
+int RcGetHandleStats(redisCache cache, db_status *stats)
+{
+    if (NULL == cache || NULL == stats) return REDIS_INVALID_ARG;
+
+    getCacheHandleStats((cacheHandle*)cache, stats);
+    return C_OK;
 }
 
-int RcActiveExpireCycle(redisCache cache)
+/* The shards are visited starting from a different one at every call,
+ * each evicting its keys until the handle is back under its maxmemory.
+ * C_ERR is returned if all the shards ran out of keys to evict first. */
+int RcFreeMemoryIfNeeded(redisCache cache)
 {
     if (NULL == cache) return REDIS_INVALID_ARG;
 
-    redisDb *redis_db = (redisDb*)cache;
-    return activeExpireCycle(redis_db);
+    cacheHandle *handle = (cacheHandle*)cache;
+    unsigned int i, start;
+    int retval = C_ERR;
+    atomicGetIncr(handle->next_shard, start, 1);
+    for (i = 0; i < handle->shard_num && retval != C_OK; i++) {
+        redisDb *redis_db = lockShard(handle, start+i);
+        retval = freeMemoryIfNeeded(redis_db);
+        unlockShard(redis_db);
+    }
+
+    return retval;
+}
+
+/* Same budget sharing of RcIncrementalRehash(). */
+int RcEvictStep(redisCache cache, long long budget_us)
+{
+    if (NULL == cache || budget_us <= 0) return REDIS_INVALID_ARG;
+
+    cacheHandle *handle = (cacheHandle*)cache;
+    unsigned int i;
+    int evicted = 0;
+    long long deadline = ustime() + budget_us;
+    for (i = 0; i < handle->shard_num; i++) {
+        long long left = deadline - ustime();
+        if (left <= 0) break;
+
+        redisDb *redis_db = lockShard(handle, i);
+        evicted += evictionStep(redis_db, left / (handle->shard_num - i));
+        unlockShard(redis_db);
+    }
+
+    return evicted;
+}
+
+/* Same budget sharing of RcIncrementalRehash(), but starting from a
+ * different shard at every call: every shard does at least one round of
+ * sampling, the first ones also use the time the others don't need. */
+int RcActiveExpireCycle(redisCache cache, long long budget_us)
+{
+    if (NULL == cache || budget_us <= 0) return REDIS_INVALID_ARG;
+
+    cacheHandle *handle = (cacheHandle*)cache;
+    unsigned int i, start;
+    int expired = 0;
+    long long deadline = ustime() + budget_us;
+    atomicGetIncr(handle->next_shard, start, 1);
+    for (i = 0; i < handle->shard_num; i++) {
+        long long left = deadline - ustime();
+
+        redisDb *redis_db = lockShard(handle, start+i);
+        expired += activeExpireCycle(redis_db, left > 0 ? left / (handle->shard_num - i) : 0);
+        unlockShard(redis_db);
+    }
+
+    return expired;
+}
+
+/* The budget is shared among the shards: every shard gets an equal part of
+ * what is left, so the time a shard does not need goes to the next ones. */
+int RcIncrementalRehash(redisCache cache, long long budget_us)
+{
+    if (NULL == cache || budget_us <= 0) return REDIS_INVALID_ARG;
+
+    cacheHandle *handle = (cacheHandle*)cache;
+    unsigned int i;
+    int rehashes = 0;
+    long long deadline = ustime() + budget_us;
+    for (i = 0; i < handle->shard_num; i++) {
+        long long left = deadline - ustime();
+        if (left <= 0) break;
+
+        redisDb *redis_db = lockShard(handle, i);
+        rehashes += incrementallyRehash(redis_db, left / (handle->shard_num - i));
+        unlockShard(redis_db);
+    }
+
+    return rehashes;
+}
+
+void RcUpdateClock(void)
+{
+    updateCachedClock();
 }
 
 size_t RcGetUsedMemory(void)
@@ -93,16 +242,46 @@ size_t RcGetUsedMemory(void)
     return zmalloc_used_memory();
 }
 
+int RcGetHandleUsedMemory(redisCache cache, size_t *used)
+{
+    if (NULL == cache || NULL == used) return REDIS_INVALID_ARG;
+
+    *used = getCacheHandleUsedMemory((cacheHandle*)cache);
+    return C_OK;
+}
+
 void RcGetHitAndMissNum(long long *hits, long long *misses)
 {
-    atomicGet(g_db_status.stat_keyspace_hits, *hits);
-    atomicGet(g_db_status.stat_keyspace_misses, *misses);
+    listIter li;
+    listNode *ln;
+    db_status stats;
+
+    *hits = *misses = 0;
+    pthread_mutex_lock(&g_handles_mutex);
+    if (g_handles) {
+        listRewind(g_handles, &li);
+        while ((ln = listNext(&li)) != NULL) {
+            getCacheHandleStats(listNodeValue(ln), &stats);
+            *hits += stats.stat_keyspace_hits;
+            *misses += stats.stat_keyspace_misses;
+        }
+    }
+    pthread_mutex_unlock(&g_handles_mutex);
 }
 
 void RcResetHitAndMissNum(void)
 {
-    atomicSet(g_db_status.stat_keyspace_hits, 0);
-    atomicSet(g_db_status.stat_keyspace_misses, 0);
+    listIter li;
+    listNode *ln;
+
+    pthread_mutex_lock(&g_handles_mutex);
+    if (g_handles) {
+        listRewind(g_handles, &li);
+        while ((ln = listNext(&li)) != NULL) {
+            resetCacheHandleHitAndMiss(listNodeValue(ln));
+        }
+    }
+    pthread_mutex_unlock(&g_handles_mutex);
 }
 
 /*-----------------------------------------------------------------------------
@@ -113,9 +292,11 @@ int RcExpire(redisCache cache, robj *key, robj *expire)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = expireGenericCommand(redis_db, key, expire, mstime(), UNIT_SECONDS);
+    unlockShard(redis_db);
 
-    return expireGenericCommand(redis_db, key, expire, mstime(), UNIT_SECONDS);
+    return retval;
 }
 
 int RcExpireat(redisCache cache, robj *key, robj *expire)
@@ -123,18 +304,15 @@ int RcExpireat(redisCache cache, robj *key, robj *expire)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = expireGenericCommand(redis_db, key, expire, 0, UNIT_SECONDS);
+    unlockShard(redis_db);
 
-    return expireGenericCommand(redis_db, key, expire, 0, UNIT_SECONDS);
+    return retval;
 }
 
-int RcTTL(redisCache cache, robj *key, int64_t *ttl)
+static int ttlCommand(redisDb *redis_db, robj *key, int64_t *ttl)
 {
-    if (NULL == cache || NULL == key) {
-        return REDIS_INVALID_ARG;
-    }
-
-    redisDb *redis_db = (redisDb*)cache;
     if (NULL == lookupKeyRead(redis_db, key)) {
         *ttl = -2;
         return REDIS_KEY_NOT_EXIST;
@@ -150,13 +328,21 @@ int RcTTL(redisCache cache, robj *key, int64_t *ttl)
     return C_OK;
 }
 
-int RcPersist(redisCache cache, robj *key)
+int RcTTL(redisCache cache, robj *key, int64_t *ttl)
 {
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
 
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = ttlCommand(redis_db, key, ttl);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
+static int persistCommand(redisDb *redis_db, robj *key)
+{
     if (NULL == lookupKeyWrite(redis_db,key)) {
         return REDIS_KEY_NOT_EXIST;
     }
@@ -165,13 +351,20 @@ int RcPersist(redisCache cache, robj *key)
     return C_OK;
 }
 
-int RcType(redisCache cache, robj *key, sds *val)
+int RcPersist(redisCache cache, robj *key)
 {
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = persistCommand(redis_db, key);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int typeCommand(redisDb *redis_db, robj *key, sds *val)
+{
     char *type;
     robj *o = lookupKeyRead(redis_db,key);
     if (o == NULL) {
@@ -192,16 +385,63 @@ int RcType(redisCache cache, robj *key, sds *val)
     return C_OK;
 }
 
+int RcType(redisCache cache, robj *key, sds *val)
+{
+    if (NULL == cache || NULL == key) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = typeCommand(redis_db, key, val);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
 int RcDel(redisCache cache, robj *key)
 {
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int deleted = dbDelete(redis_db, key);
+    unlockShard(redis_db);
 
-    if (!dbDelete(redis_db, key)) {
-        return REDIS_KEY_NOT_EXIST;
+    return deleted ? C_OK : REDIS_KEY_NOT_EXIST;
+}
+
+int RcUnlink(redisCache cache, robj *key)
+{
+    if (NULL == cache || NULL == key) {
+        return REDIS_INVALID_ARG;
     }
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int deleted = dbAsyncDelete(redis_db, key);
+    unlockShard(redis_db);
+
+    return deleted ? C_OK : REDIS_KEY_NOT_EXIST;
+}
+
+static void mdelKeyProc(redisDb *redis_db, robj *key, uint64_t hash, size_t idx, void *privdata)
+{
+    unsigned long *deleted = privdata;
+
+    UNUSED(hash);
+    UNUSED(idx);
+    *deleted += dbDelete(redis_db, key);
+}
+
+int RcMDel(redisCache cache, robj *keys[], unsigned long keys_size, unsigned long *deleted)
+{
+    unsigned long i;
+
+    if (NULL == cache || NULL == keys || NULL == deleted) {
+        return REDIS_INVALID_ARG;
+    }
+    for (i = 0; i < keys_size; i++) {
+        if (NULL == keys[i]) return REDIS_INVALID_ARG;
+    }
+    *deleted = 0;
+    processKeyBatch(cache, keys, keys_size, mdelKeyProc, deleted);
 
     return C_OK;
 }
@@ -211,9 +451,11 @@ int RcExists(redisCache cache, robj *key)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = dbExists(redis_db, key);
+    unlockShard(redis_db);
 
-    return dbExists(redis_db, key);
+    return retval;
 }
 
 int RcCacheSize(redisCache cache, long long *dbsize)
@@ -221,9 +463,15 @@ int RcCacheSize(redisCache cache, long long *dbsize)
     if (NULL == cache) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
-
-    *dbsize = dictSize(redis_db->dict);
+    cacheHandle *handle = (cacheHandle*)cache;
+
+    unsigned int i;
+    *dbsize = 0;
+    for (i = 0; i < handle->shard_num; i++) {
+        redisDb *redis_db = lockShard(handle, i);
+        *dbsize += dictSize(redis_db->dict);
+        unlockShard(redis_db);
+    }
 
     return C_OK;
 }
@@ -233,22 +481,97 @@ int RcFlushCache(redisCache cache)
     if (NULL == cache) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
+    cacheHandle *handle = (cacheHandle*)cache;
 
-    emptyDb(redis_db, NULL);
+    unsigned int i;
+    for (i = 0; i < handle->shard_num; i++) {
+        redisDb *redis_db = lockShard(handle, i);
+        emptyDb(redis_db, NULL);
+        unlockShard(redis_db);
+    }
 
     return C_OK;
 }
 
-int RcRandomkey(redisCache cache, sds *key)
+int RcFlushCacheAsync(redisCache cache, void (*callback)(void *privdata), void *privdata)
 {
     if (NULL == cache) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)cache;
+    cacheHandle *handle = (cacheHandle*)cache;
+
+    unsigned int i;
+    for (i = 0; i < handle->shard_num; i++) {
+        redisDb *redis_db = lockShard(handle, i);
+        emptyDbAsync(redis_db);
+        unlockShard(redis_db);
+    }
+    if (callback) lazyfreeCallWhenDone(callback, privdata);
+
+    return C_OK;
+}
+
+int RcMemoryUsage(redisCache cache, robj *key, size_t samples, size_t *bytes)
+{
+    if (NULL == cache || NULL == key || NULL == bytes) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = dbMemoryUsage(redis_db, key, samples, bytes);
+    unlockShard(redis_db);
+
+    return retval == C_OK ? C_OK : REDIS_KEY_NOT_EXIST;
+}
 
-    robj *kobj;
-    if ((kobj = dbRandomKey(redis_db)) == NULL) {
+/* The shards are scanned one after the other: the low bits of the cursor
+ * are the shard, the others the dictScan() cursor inside the shard. */
+int RcScanBigKeys(redisCache cache, unsigned long *cursor, unsigned long count,
+                  size_t min_bytes, size_t samples, bigKeyProc *proc, void *privdata)
+{
+    if (NULL == cache || NULL == cursor || NULL == proc) {
+        return REDIS_INVALID_ARG;
+    }
+    cacheHandle *handle = (cacheHandle*)cache;
+
+    unsigned int bits = 0;
+    while ((1U << bits) < handle->shard_num) bits++;
+
+    unsigned int idx = *cursor & handle->shard_mask;
+    unsigned long shard_cursor = *cursor >> bits;
+    if (count == 0) count = 1;
+    while (count) {
+        unsigned long visited = count;
+        redisDb *redis_db = lockShard(handle, idx);
+        shard_cursor = dbScanBigKeys(redis_db, shard_cursor, &visited,
+                                     min_bytes, samples, proc, privdata);
+        unlockShard(redis_db);
+        count -= visited < count ? visited : count;
+        if (shard_cursor == 0 && ++idx == handle->shard_num) {
+            *cursor = 0;
+            return C_OK;
+        }
+    }
+    *cursor = (shard_cursor << bits) | idx;
+    return C_OK;
+}
+
+/* Pick a random shard first, then a random key inside it. Empty shards are
+ * skipped so that we only fail when the whole handle is empty. */
+int RcRandomkey(redisCache cache, sds *key)
+{
+    if (NULL == cache) {
+        return REDIS_INVALID_ARG;
+    }
+    cacheHandle *handle = (cacheHandle*)cache;
+
+    robj *kobj = NULL;
+    unsigned int i, start = (unsigned int)redisRandom();
+    for (i = 0; i < handle->shard_num && NULL == kobj; i++) {
+        redisDb *redis_db = lockShard(handle, start+i);
+        kobj = dbRandomKey(redis_db);
+        unlockShard(redis_db);
+    }
+    if (NULL == kobj) {
         return REDIS_NO_KEYS;
     }
 
@@ -256,4 +579,4 @@ int RcRandomkey(redisCache cache, sds *key)
     
     decrRefCount(kobj);
     return C_OK;
-}
\ No newline at end of file
+}
@@ -31,11 +31,56 @@ typedef struct _zitem {
  * Server APIS
  *----------------------------------------------------------------------------*/
 void RcSetConfig(db_config* cfg);
+/* Per handle configuration and stats. A handle follows the process wide
+ * configuration of RcSetConfig() until RcSetHandleConfig() is called. */
+int RcSetHandleConfig(redisCache cache, db_config *cfg);
+int RcGetHandleStats(redisCache cache, db_status *stats);
+/* Have 'proc' called with 'privdata' for every key the handle removes by
+ * itself: KEY_EVENT_EVICTED for the keys evicted to honor maxmemory, and
+ * KEY_EVENT_EXPIRED for the keys found expired, by an access or by
+ * RcActiveExpireCycle(). The key is only valid during the call, and 'proc'
+ * runs with the shard locked, so it must not use the handle. Deleted and
+ * flushed keys are not reported. A NULL 'proc' removes the callback. */
+int RcSetKeyEventCallback(redisCache cache, keyEventProc *proc, void *privdata);
 redisCache RcCreateCacheHandle(void);
+/* Create a handle that can be shared by multiple threads without external
+ * locking: keys are spread by hash over 'shard_num' shards (rounded up to a
+ * power of two), each one with its own lock and eviction pool. */
+redisCache RcCreateShardedCacheHandle(unsigned int shard_num);
+/* Like the above with CACHE_HANDLE_* flags. CACHE_HANDLE_FAST_HASH trades
+ * the hash flooding resistance of SipHash for a much faster hash function:
+ * only use it when the keys and members come from trusted clients.
+ * CACHE_HANDLE_OPEN_ADDRESSING stores the keyspace in open addressing
+ * tables, that use less memory per key and less cache misses per lookup. */
+redisCache RcCreateCacheHandleWithFlags(unsigned int shard_num, int flags);
 void RcDestroyCacheHandle(redisCache cache);
 int RcFreeMemoryIfNeeded(redisCache cache);
-int RcActiveExpireCycle(redisCache cache);
+/* Cron job evicting ahead of demand: when the memory of the handle goes
+ * over evict_high_watermark percent of its maxmemory, keys are evicted from
+ * every shard, proportionally to its size, until the handle is under
+ * evict_low_watermark, for at most 'budget_us' microseconds per call.
+ * RcFreeMemoryIfNeeded() then only evicts if the cron falls behind.
+ * Returns the number of keys evicted. */
+int RcEvictStep(redisCache cache, long long budget_us);
+/* Cron job deleting the expired keys nobody accesses. Volatile keys are
+ * sampled and the expired ones deleted as long as more than
+ * active_expire_stale_perc percent of the sampled keys were expired, for
+ * at most 'budget_us' microseconds. The estimated share of expired keys
+ * left is in the stats of the handle. Returns the number of keys expired. */
+int RcActiveExpireCycle(redisCache cache, long long budget_us);
+/* Cron job completing the resize of the keyspace, expires and big values
+ * hash tables, for at most 'budget_us' microseconds. Returns the number of
+ * buckets moved. */
+int RcIncrementalRehash(redisCache cache, long long budget_us);
+/* Cron job refreshing the clock used for the LRU and LFU data of the keys,
+ * that otherwise is read from the system at every access. Once called it
+ * must be called at least once per second, e.g. together with
+ * RcActiveExpireCycle(). Expire checks keep reading the precise time. */
+void RcUpdateClock(void);
 size_t RcGetUsedMemory(void);
+/* Memory charged to the handle: its keys, values and internal structures.
+ * The handle maxmemory is checked against this, not RcGetUsedMemory(). */
+int RcGetHandleUsedMemory(redisCache cache, size_t *used);
 void RcGetHitAndMissNum(long long *hits, long long *misses);
 void RcResetHitAndMissNum(void);
 
@@ -48,10 +93,35 @@ int RcTTL(redisCache cache, robj *key, int64_t *ttl);
 int RcPersist(redisCache cache, robj *key);
 int RcType(redisCache cache, robj *key, sds *val);
 int RcDel(redisCache cache, robj *key);
+/* Like RcDel(), but a big value is freed by a background thread, so that
+ * the call returns in constant time. */
+int RcUnlink(redisCache cache, robj *key);
+/* Delete many keys at once, '*deleted' is set to the number of keys that
+ * existed. */
+int RcMDel(redisCache cache, robj *keys[], unsigned long keys_size, unsigned long *deleted);
 int RcExists(redisCache cache, robj *key);
 int RcCacheSize(redisCache cache, long long *dbsize);
 int RcFlushCache(redisCache cache);
+/* Like RcFlushCache(), but the keys are released by a background thread and
+ * the call takes constant time. The handle is empty as soon as the call
+ * returns, the memory is freed later: 'callback', if not NULL, is called
+ * from the background thread with 'privdata' once it has been released.
+ * Until then the memory still counts in RcGetHandleUsedMemory(), but not
+ * against the maxmemory of the handle. */
+int RcFlushCacheAsync(redisCache cache, void (*callback)(void *privdata), void *privdata);
 int RcRandomkey(redisCache cache, sds *key);
+/* Set '*bytes' to the memory used by the key: its name, its value and its
+ * keyspace entry. Up to 'samples' elements of aggregate values are sampled
+ * and the result extrapolated, 0 means all the elements. */
+int RcMemoryUsage(redisCache cache, robj *key, size_t samples, size_t *bytes);
+/* Incremental big keys scanner: call 'proc' with 'privdata' for every key
+ * whose RcMemoryUsage() with 'samples' is 'min_bytes' or more. Start with
+ * '*cursor' set to 0, and call again with the updated cursor until it is 0.
+ * Every call visits about 'count' keys, so the handle is never blocked for
+ * long. Like SCAN, keys present for the whole scan are reported at least
+ * once. 'proc' runs with a shard locked, so it must not use the handle. */
+int RcScanBigKeys(redisCache cache, unsigned long *cursor, unsigned long count,
+                  size_t min_bytes, size_t samples, bigKeyProc *proc, void *privdata);
 
 /*-----------------------------------------------------------------------------
  * String Commands
@@ -59,7 +129,16 @@ int RcRandomkey(redisCache cache, sds *key);
 int RcSet(redisCache cache, robj *key, robj *val, robj *expire);
 int RcSetnx(redisCache cache, robj *key, robj *val, robj *expire);
 int RcSetxx(redisCache cache, robj *key, robj *val, robj *expire);
+/* '*val' is a copy of the value owned by the caller, whatever the handle,
+ * that must be released with decrRefCount(). */
 int RcGet(redisCache cache, robj *key, robj **val);
+/* Multi key versions of RcGet() and RcSet(), much faster than a loop of
+ * single key calls: the keys are hashed once and their buckets are
+ * prefetched before they are looked up. vals[i] is set to the value of
+ * keys[i] like with RcGet(), or to NULL if the key does not exist or does
+ * not hold a string. */
+int RcMGet(redisCache cache, robj *keys[], unsigned long keys_size, robj *vals[]);
+int RcMSet(redisCache cache, robj *keys[], robj *vals[], unsigned long keys_size);
 int RcIncr(redisCache cache, robj *key, long long *ret);
 int RcDecr(redisCache cache, robj *key, long long *ret);
 int RcIncrBy(redisCache cache, robj *key, long long incr, long long *ret);
@@ -111,6 +190,7 @@ int RcRPushx(redisCache cache, robj *key, robj *vals[], unsigned long vals_size)
 int RcSAdd(redisCache cache, robj *key, robj *members[], unsigned long members_size);
 int RcSCard(redisCache cache, robj *key, unsigned long *len);
 int RcSIsmember(redisCache cache, robj *key, robj *member, int *is_member);
+int RcSMIsmember(redisCache cache, robj *key, robj *members[], unsigned long members_size, int *is_member);
 int RcSMembers(redisCache cache, robj *key, sds **members, unsigned long *members_size);
 int RcSRem(redisCache cache, robj *key, robj *members[], unsigned long members_size);
 int RcSRandmember(redisCache cache, robj *key, long l, sds **members, unsigned long *members_size);
@@ -7,8 +7,9 @@
 #include "commonfunc.h"
 #include "object.h"
 #include "zmalloc.h"
+#include "atomicvar.h"
 #include "db.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "util.h"
 
 extern dictType hashDictType;
@@ -42,22 +43,18 @@ sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what) {
 }
 
 /* Get the field or value at iterator cursor, for an iterator on a hash value
- * encoded as a ziplist. Prototype is similar to `hashTypeGetFromZiplist`. */
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll)
+ * encoded as a listpack. Prototype is similar to `hashTypeGetFromListpack`. */
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll)
 {
-    int ret;
-
-    assert(hi->encoding == OBJ_ENCODING_ZIPLIST);
+    assert(hi->encoding == OBJ_ENCODING_LISTPACK);
 
     if (what & OBJ_HASH_KEY) {
-        ret = ziplistGet(hi->fptr, vstr, vlen, vll);
-        assert(ret);
+        *vstr = lpGetValue(hi->fptr, vlen, vll);
     } else {
-        ret = ziplistGet(hi->vptr, vstr, vlen, vll);
-        assert(ret);
+        *vstr = lpGetValue(hi->vptr, vlen, vll);
     }
 }
 
@@ -72,9 +69,8 @@ void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
  * can always check the function return by checking the return value
  * type checking if vstr == NULL. */
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
-        *vstr = NULL;
-        hashTypeCurrentFromZiplist(hi, what, vstr, vlen, vll);
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
+        hashTypeCurrentFromListpack(hi, what, vstr, vlen, vll);
     } else if (hi->encoding == OBJ_ENCODING_HT) {
         sds ele = hashTypeCurrentFromHashTable(hi, what);
         *vstr = (unsigned char*) ele;
@@ -99,7 +95,7 @@ sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what) {
 /* Move to the next entry in the hash. Return C_OK when the next entry
  * could be found and C_ERR when the iterator reaches the end. */
 int hashTypeNext(hashTypeIterator *hi) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl;
         unsigned char *fptr, *vptr;
 
@@ -110,16 +106,16 @@ int hashTypeNext(hashTypeIterator *hi) {
         if (fptr == NULL) {
             /* Initialize cursor */
             assert(vptr == NULL);
-            fptr = ziplistIndex(zl, 0);
+            fptr = lpFirst(zl);
         } else {
             /* Advance cursor */
             assert(vptr != NULL);
-            fptr = ziplistNext(zl, vptr);
+            fptr = lpNext(zl, vptr);
         }
         if (fptr == NULL) return C_ERR;
 
         /* Grab pointer to the value (fptr points to the field) */
-        vptr = ziplistNext(zl, fptr);
+        vptr = lpNext(zl, fptr);
         assert(vptr != NULL);
 
         /* fptr, vptr now point to the first or next pair */
@@ -138,7 +134,7 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
     hi->subject = subject;
     hi->encoding = subject->encoding;
 
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         hi->fptr = NULL;
         hi->vptr = NULL;
     } else if (hi->encoding == OBJ_ENCODING_HT) {
@@ -155,11 +151,11 @@ void hashTypeReleaseIterator(hashTypeIterator *hi) {
     zfree(hi);
 }
 
-void hashTypeConvertZiplist(robj *o, int enc) {
+void hashTypeConvertListpack(robj *o, int enc) {
 
-    assert(o->encoding == OBJ_ENCODING_ZIPLIST);
+    assert(o->encoding == OBJ_ENCODING_LISTPACK);
 
-    if (enc == OBJ_ENCODING_ZIPLIST) {
+    if (enc == OBJ_ENCODING_LISTPACK) {
         /* Nothing to do... */
 
     } else if (enc == OBJ_ENCODING_HT) {
@@ -168,7 +164,7 @@ void hashTypeConvertZiplist(robj *o, int enc) {
         int ret;
 
         hi = hashTypeInitIterator(o);
-        dict = dictCreate(&hashDictType, NULL);
+        dict = dictCreate(valueDictType(&hashDictType), NULL);
 
         while (hashTypeNext(hi) != C_ERR) {
             sds key, value;
@@ -177,13 +173,13 @@ void hashTypeConvertZiplist(robj *o, int enc) {
             value = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_VALUE);
             ret = dictAdd(dict, key, value);
             if (ret != DICT_OK) {
-                // serverLogHexDump(LL_WARNING,"ziplist with dup elements dump",
-                //     o->ptr,ziplistBlobLen(o->ptr));
-                // serverPanic("Ziplist corruption detected");
+                // serverLogHexDump(LL_WARNING,"listpack with dup elements dump",
+                //     o->ptr,lpBytes(o->ptr));
+                // serverPanic("Listpack corruption detected");
             }
         }
         hashTypeReleaseIterator(hi);
-        zfree(o->ptr);
+        lpFree(o->ptr);
         o->encoding = OBJ_ENCODING_HT;
         o->ptr = dict;
     } else {
@@ -192,8 +188,8 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 }
 
 void hashTypeConvert(robj *o, int enc) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-        hashTypeConvertZiplist(o, enc);
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        hashTypeConvertListpack(o, enc);
     } else if (o->encoding == OBJ_ENCODING_HT) {
         // serverPanic("Not implemented");
     } else {
@@ -206,16 +202,16 @@ void hashTypeConvert(robj *o, int enc) {
 int hashTypeDelete(robj *o, sds field) {
     int deleted = 0;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl, *fptr;
 
         zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        fptr = lpFirst(zl);
         if (fptr != NULL) {
-            fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+            fptr = lpFind(fptr, (unsigned char*)field, sdslen(field), 1);
             if (fptr != NULL) {
-                zl = ziplistDelete(zl,&fptr); /* Delete the key. */
-                zl = ziplistDelete(zl,&fptr); /* Delete the value. */
+                /* Delete both the key and the value. */
+                zl = lpDeleteRangeWithEntry(zl,&fptr,2);
                 o->ptr = zl;
                 deleted = 1;
             }
@@ -238,8 +234,8 @@ int hashTypeDelete(robj *o, sds field) {
 unsigned long hashTypeLength(const robj *o) {
     unsigned long length = ULONG_MAX;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-        length = ziplistLen(o->ptr) / 2;
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        length = lpLength(o->ptr) / 2;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         length = dictSize((const dict*)o->ptr);
     } else {
@@ -248,32 +244,30 @@ unsigned long hashTypeLength(const robj *o) {
     return length;
 }
 
-/* Get the value from a ziplist encoded hash, identified by field.
+/* Get the value from a listpack encoded hash, identified by field.
  * Returns -1 when the field cannot be found. */
-int hashTypeGetFromZiplist(robj *o, sds field,
-                           unsigned char **vstr,
-                           unsigned int *vlen,
-                           long long *vll)
+int hashTypeGetFromListpack(robj *o, sds field,
+                            unsigned char **vstr,
+                            unsigned int *vlen,
+                            long long *vll)
 {
     unsigned char *zl, *fptr = NULL, *vptr = NULL;
-    int ret;
 
-    assert(o->encoding == OBJ_ENCODING_ZIPLIST);
+    assert(o->encoding == OBJ_ENCODING_LISTPACK);
 
     zl = o->ptr;
-    fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+    fptr = lpFirst(zl);
     if (fptr != NULL) {
-        fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+        fptr = lpFind(fptr, (unsigned char*)field, sdslen(field), 1);
         if (fptr != NULL) {
             /* Grab pointer to the value (fptr points to the field) */
-            vptr = ziplistNext(zl, fptr);
+            vptr = lpNext(zl, fptr);
             assert(vptr != NULL);
         }
     }
 
     if (vptr != NULL) {
-        ret = ziplistGet(vptr, vstr, vlen, vll);
-        assert(ret);
+        *vstr = lpGetValue(vptr, vlen, vll);
         return 0;
     }
 
@@ -303,9 +297,9 @@ sds hashTypeGetFromHashTable(robj *o, sds field) {
  * can always check the function return by checking the return value
  * for C_OK and checking if vll (or vstr) is NULL. */
 int hashTypeGetValue(robj *o, sds field, unsigned char **vstr, unsigned int *vlen, long long *vll) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         *vstr = NULL;
-        if (hashTypeGetFromZiplist(o, field, vstr, vlen, vll) == 0)
+        if (hashTypeGetFromListpack(o, field, vstr, vlen, vll) == 0)
             return C_OK;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         sds value;
@@ -325,12 +319,12 @@ int hashTypeGetValue(robj *o, sds field, unsigned char **vstr, unsigned int *vle
  * exist. */
 size_t hashTypeGetValueLength(robj *o, sds field) {
     size_t len = 0;
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0)
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0)
             len = vstr ? vlen : sdigits10(vll);
     } else if (o->encoding == OBJ_ENCODING_HT) {
         sds aux;
@@ -346,12 +340,12 @@ size_t hashTypeGetValueLength(robj *o, sds field) {
 /* Test if the specified field exists in the given hash. Returns 1 if the field
  * exists, and 0 when it doesn't. */
 int hashTypeExists(robj *o, sds field) {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) return 1;
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) return 1;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         if (hashTypeGetFromHashTable(o, field) != NULL) return 1;
     } else {
@@ -377,46 +371,53 @@ int hashTypeExists(robj *o, sds field) {
  * HASH_SET_COPY corresponds to no flags passed, and means the default
  * semantics of copying the values if needed.
  *
+ * A listpack encoded hash is converted to a hash table when the field or
+ * the value are too long, or when it has too many fields, according to
+ * the limits of 'config'.
  */
 #define HASH_SET_TAKE_FIELD (1<<0)
 #define HASH_SET_TAKE_VALUE (1<<1)
 #define HASH_SET_COPY 0
-int hashTypeSet(robj *o, sds field, sds value, int flags) {
+int hashTypeSet(robj *o, sds field, sds value, int flags, db_config *config) {
+    size_t max_entries, max_value;
     int update = 0;
 
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    getListpackLimits(&config->hash_max_listpack_entries,&config->hash_max_listpack_value,
+                      OBJ_HASH_MAX_ZIPLIST_ENTRIES,OBJ_HASH_MAX_ZIPLIST_VALUE,
+                      &max_entries,&max_value);
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
+        if (sdslen(field) > max_value || sdslen(value) > max_value)
+            hashTypeConvert(o, OBJ_ENCODING_HT);
+    }
+
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl, *fptr, *vptr;
 
         zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        fptr = lpFirst(zl);
         if (fptr != NULL) {
-            fptr = ziplistFind(fptr, (unsigned char*)field, sdslen(field), 1);
+            fptr = lpFind(fptr, (unsigned char*)field, sdslen(field), 1);
             if (fptr != NULL) {
                 /* Grab pointer to the value (fptr points to the field) */
-                vptr = ziplistNext(zl, fptr);
+                vptr = lpNext(zl, fptr);
                 assert(vptr != NULL);
                 update = 1;
 
-                /* Delete value */
-                zl = ziplistDelete(zl, &vptr);
-
-                /* Insert new value */
-                zl = ziplistInsert(zl, vptr, (unsigned char*)value,
-                        sdslen(value));
+                /* Replace the value in place */
+                zl = lpInsert(zl, (unsigned char*)value, sdslen(value),
+                        vptr, LP_REPLACE, NULL);
             }
         }
 
         if (!update) {
-            /* Push new field/value pair onto the tail of the ziplist */
-            zl = ziplistPush(zl, (unsigned char*)field, sdslen(field),
-                    ZIPLIST_TAIL);
-            zl = ziplistPush(zl, (unsigned char*)value, sdslen(value),
-                    ZIPLIST_TAIL);
+            /* Push new field/value pair onto the tail of the listpack */
+            zl = lpAppend(zl, (unsigned char*)field, sdslen(field));
+            zl = lpAppend(zl, (unsigned char*)value, sdslen(value));
         }
         o->ptr = zl;
 
-        /* Check if the ziplist needs to be converted to a hash table */
-        if (hashTypeLength(o) > OBJ_ZSET_MAX_ZIPLIST_ENTRIES)
+        /* Check if the listpack needs to be converted to a hash table */
+        if (hashTypeLength(o) > max_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
     } else if (o->encoding == OBJ_ENCODING_HT) {
         dictEntry *de = dictFind(o->ptr,field);
@@ -457,16 +458,20 @@ int hashTypeSet(robj *o, sds field, sds value, int flags) {
 }
 
 /* Check the length of a number of objects to see if we need to convert a
- * ziplist to a real hash. Note that we only check string encoded objects
+ * listpack to a real hash. Note that we only check string encoded objects
  * as their string length can be queried in constant time. */
-void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
+void hashTypeTryConversion(robj *o, robj **argv, int start, int end, db_config *config) {
+    size_t max_entries, max_value;
     int i;
 
-    if (o->encoding != OBJ_ENCODING_ZIPLIST) return;
+    if (o->encoding != OBJ_ENCODING_LISTPACK) return;
 
+    getListpackLimits(&config->hash_max_listpack_entries,&config->hash_max_listpack_value,
+                      OBJ_HASH_MAX_ZIPLIST_ENTRIES,OBJ_HASH_MAX_ZIPLIST_VALUE,
+                      &max_entries,&max_value);
     for (i = start; i <= end; i++) {
         if (sdsEncodedObject(argv[i]) &&
-            sdslen(argv[i]->ptr) > OBJ_HASH_MAX_ZIPLIST_VALUE)
+            sdslen(argv[i]->ptr) > max_value)
         {
             hashTypeConvert(o, OBJ_ENCODING_HT);
             break;
@@ -478,7 +483,14 @@ robj *hashTypeLookupWriteOrCreate(redisDb *redis_db, robj *key)
 {
     robj *o = lookupKeyWrite(redis_db,key);
     if (o == NULL) {
+        size_t max_entries, max_value;
+
         o = createHashObject();
+        getListpackLimits(&redis_db->config->hash_max_listpack_entries,
+                          &redis_db->config->hash_max_listpack_value,
+                          OBJ_HASH_MAX_ZIPLIST_ENTRIES,OBJ_HASH_MAX_ZIPLIST_VALUE,
+                          &max_entries,&max_value);
+        if (max_entries == 0) hashTypeConvert(o, OBJ_ENCODING_HT);
         dbAdd(redis_db,key,o);
     } else {
         if (o->type != OBJ_HASH) {
@@ -496,8 +508,8 @@ static int HSet(redisDb *redis_db, robj *kobj, robj *fobj, robj *vobj)
     robj *argv[2];
     argv[0] = fobj;
     argv[1] = vobj;
-    hashTypeTryConversion(o,argv,0,1);
-    hashTypeSet(o, argv[0]->ptr,argv[1]->ptr,HASH_SET_COPY);
+    hashTypeTryConversion(o,argv,0,1,redis_db->config);
+    hashTypeSet(o, argv[0]->ptr,argv[1]->ptr,HASH_SET_COPY,redis_db->config);
     return C_OK;
 }
 
@@ -506,11 +518,11 @@ static int HMSet(redisDb *redis_db, robj *kobj, robj *items[], unsigned long ite
     robj *o;
     if ((o = hashTypeLookupWriteOrCreate(redis_db,kobj)) == NULL) return C_ERR;
 
-    hashTypeTryConversion(o,items,0,items_size-1);
+    hashTypeTryConversion(o,items,0,items_size-1,redis_db->config);
 
     unsigned long i;
     for (i = 0; i < items_size; i += 2)
-        hashTypeSet(o,items[i]->ptr,items[i+1]->ptr,HASH_SET_COPY);
+        hashTypeSet(o,items[i]->ptr,items[i+1]->ptr,HASH_SET_COPY,redis_db->config);
 
     return C_OK;
 }
@@ -523,9 +535,9 @@ static int HSetnx(redisDb *redis_db, robj *kobj, robj *fobj, robj *vobj)
     robj *argv[2];
     argv[0] = fobj;
     argv[1] = vobj;
-    hashTypeTryConversion(o,argv,0,1);
+    hashTypeTryConversion(o,argv,0,1,redis_db->config);
     if (!hashTypeExists(o,argv[0]->ptr)) {
-        hashTypeSet(o,argv[0]->ptr,argv[1]->ptr,HASH_SET_COPY);
+        hashTypeSet(o,argv[0]->ptr,argv[1]->ptr,HASH_SET_COPY,redis_db->config);
     }
 
     return C_OK;
@@ -533,12 +545,12 @@ static int HSetnx(redisDb *redis_db, robj *kobj, robj *fobj, robj *vobj)
 
 static int GetHashFieldValue(robj *o, sds field, sds *val)
 {
-    if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (o->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (0 > hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll)) {
+        if (0 > hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll)) {
             return REDIS_ITEM_NOT_EXIST;
         } else {
             if (vstr) {
@@ -562,12 +574,12 @@ static int GetHashFieldValue(robj *o, sds field, sds *val)
 }
 
 static void addHashIteratorCursorToReply(hashTypeIterator *hi, int what, sds *out) {
-    if (hi->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (hi->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr) {
             *out = sdsnewlen(vstr, vlen);
         } else {
@@ -610,13 +622,8 @@ static int genericHgetall(redisDb *redis_db, robj *kobj, hitem **items, unsigned
     return C_OK;
 }
 
-int RcHDel(redisCache db, robj *key, robj *fields[], unsigned long fields_size, unsigned long *ret)
+static int hdelCommand(redisDb *redis_db, robj *key, robj *fields[], unsigned long fields_size, unsigned long *ret)
 {
-    if (NULL == db || NULL == key || NULL == fields) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_HASH)) {
         return REDIS_KEY_NOT_EXIST;
@@ -637,14 +644,28 @@ int RcHDel(redisCache db, robj *key, robj *fields[], unsigned long fields_size,
     return C_OK;
 }
 
+int RcHDel(redisCache db, robj *key, robj *fields[], unsigned long fields_size, unsigned long *ret)
+{
+    if (NULL == db || NULL == key || NULL == fields) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hdelCommand(redis_db, key, fields, fields_size, ret);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
 int RcHSet(redisCache db, robj *key, robj *field, robj *val)
 {
     if (NULL == db || NULL == key || NULL == field || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = HSet(redis_db, key, field, val);
+    unlockShard(redis_db);
 
-    return HSet(redis_db, key, field, val);
+    return retval;
 }
 
 int RcHSetnx(redisCache db, robj *key, robj *field, robj *val)
@@ -652,9 +673,11 @@ int RcHSetnx(redisCache db, robj *key, robj *field, robj *val)
     if (NULL == db || NULL == key || NULL == field || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = HSetnx(redis_db, key, field, val);
+    unlockShard(redis_db);
 
-    return HSetnx(redis_db, key, field, val);
+    return retval;
 }
 
 int RcHMSet(redisCache db, robj *key, robj *items[], unsigned long items_size)
@@ -662,18 +685,15 @@ int RcHMSet(redisCache db, robj *key, robj *items[], unsigned long items_size)
     if (NULL == db || NULL == key || NULL == items) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = HMSet(redis_db, key, items, items_size);
+    unlockShard(redis_db);
 
-    return HMSet(redis_db, key, items, items_size);
+    return retval;
 }
 
-int RcHGet(redisCache db, robj *key, robj *field, sds *val)
+static int hgetCommand(redisDb *redis_db, robj *key, robj *field, sds *val)
 {
-    if (NULL == db || NULL == key || NULL == field) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_HASH)) {
         return REDIS_KEY_NOT_EXIST;
@@ -682,13 +702,20 @@ int RcHGet(redisCache db, robj *key, robj *field, sds *val)
     return GetHashFieldValue(o, field->ptr, val);
 }
 
-int RcHMGet(redisCache db, robj *key, hitem *items, unsigned long items_size)
+int RcHGet(redisCache db, robj *key, robj *field, sds *val)
 {
-    if (NULL == db || NULL == key || NULL == items) {
+    if (NULL == db || NULL == key || NULL == field) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hgetCommand(redis_db, key, field, val);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int hmgetCommand(redisDb *redis_db, robj *key, hitem *items, unsigned long items_size)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_HASH)) {
         return REDIS_KEY_NOT_EXIST;
@@ -702,14 +729,28 @@ int RcHMGet(redisCache db, robj *key, hitem *items, unsigned long items_size)
     return C_OK;
 }
 
+int RcHMGet(redisCache db, robj *key, hitem *items, unsigned long items_size)
+{
+    if (NULL == db || NULL == key || NULL == items) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hmgetCommand(redis_db, key, items, items_size);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
 int RcHGetAll(redisCache db, robj *key, hitem **items, unsigned long *items_size)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = genericHgetall(redis_db, key, items, items_size, OBJ_HASH_KEY|OBJ_HASH_VALUE);
+    unlockShard(redis_db);
 
-    return genericHgetall(redis_db, key, items, items_size, OBJ_HASH_KEY|OBJ_HASH_VALUE);
+    return retval;
 }
 
 int RcHKeys(redisCache db, robj *key, hitem **items, unsigned long *items_size)
@@ -717,9 +758,11 @@ int RcHKeys(redisCache db, robj *key, hitem **items, unsigned long *items_size)
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = genericHgetall(redis_db, key, items, items_size, OBJ_HASH_KEY);
+    unlockShard(redis_db);
 
-    return genericHgetall(redis_db, key, items, items_size, OBJ_HASH_KEY);
+    return retval;
 }
 
 int RcHVals(redisCache db, robj *key, hitem **items, unsigned long *items_size)
@@ -727,18 +770,15 @@ int RcHVals(redisCache db, robj *key, hitem **items, unsigned long *items_size)
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = genericHgetall(redis_db, key, items, items_size, OBJ_HASH_VALUE);
+    unlockShard(redis_db);
 
-    return genericHgetall(redis_db, key, items, items_size, OBJ_HASH_VALUE);
+    return retval;
 }
 
-int RcHExists(redisCache db, robj *key, robj *field, int *is_exist)
+static int hexistsCommand(redisDb *redis_db, robj *key, robj *field, int *is_exist)
 {
-    if (NULL == db || NULL == key || NULL == field) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_HASH)) {
         return REDIS_KEY_NOT_EXIST;
@@ -749,13 +789,20 @@ int RcHExists(redisCache db, robj *key, robj *field, int *is_exist)
     return C_OK;
 }
 
-int RcHIncrby(redisCache db, robj *key, robj *field, long long val, long long *ret)
+int RcHExists(redisCache db, robj *key, robj *field, int *is_exist)
 {
     if (NULL == db || NULL == key || NULL == field) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hexistsCommand(redis_db, key, field, is_exist);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int hincrbyCommand(redisDb *redis_db, robj *key, robj *field, long long val, long long *ret)
+{
     long long value, oldvalue;
     robj *o;
     sds new;
@@ -785,18 +832,25 @@ int RcHIncrby(redisCache db, robj *key, robj *field, long long val, long long *r
     *ret = value;
 
     new = sdsfromlonglong(value);
-    hashTypeSet(o,field->ptr,new,HASH_SET_TAKE_VALUE);
+    hashTypeSet(o,field->ptr,new,HASH_SET_TAKE_VALUE,redis_db->config);
 
     return C_OK;
 }
 
-int RcHIncrbyfloat(redisCache db, robj *key, robj *field, long double val, long double *ret)
+int RcHIncrby(redisCache db, robj *key, robj *field, long long val, long long *ret)
 {
     if (NULL == db || NULL == key || NULL == field) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hincrbyCommand(redis_db, key, field, val, ret);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int hincrbyfloatCommand(redisDb *redis_db, robj *key, robj *field, long double val, long double *ret)
+{
     long double value;
     long long ll;
     robj *o;
@@ -825,18 +879,25 @@ int RcHIncrbyfloat(redisCache db, robj *key, robj *field, long double val, long
     char buf[MAX_LONG_DOUBLE_CHARS];
     int len = ld2string(buf,sizeof(buf),value,1);
     new = sdsnewlen(buf,len);
-    hashTypeSet(o,field->ptr,new,HASH_SET_TAKE_VALUE);
+    hashTypeSet(o,field->ptr,new,HASH_SET_TAKE_VALUE,redis_db->config);
 
     return C_OK;
 }
 
-int RcHlen(redisCache db, robj *key, unsigned long *len)
+int RcHIncrbyfloat(redisCache db, robj *key, robj *field, long double val, long double *ret)
 {
-    if (NULL == db || NULL == key) {
+    if (NULL == db || NULL == key || NULL == field) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hincrbyfloatCommand(redis_db, key, field, val, ret);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int hlenCommand(redisDb *redis_db, robj *key, unsigned long *len)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_HASH)) {
         return REDIS_KEY_NOT_EXIST;
@@ -847,13 +908,20 @@ int RcHlen(redisCache db, robj *key, unsigned long *len)
     return C_OK;
 }
 
-int RcHStrlen(redisCache db, robj *key, robj *field, unsigned long *len)
+int RcHlen(redisCache db, robj *key, unsigned long *len)
 {
-    if (NULL == db || NULL == key || NULL == field) {
+    if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hlenCommand(redis_db, key, len);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int hstrlenCommand(redisDb *redis_db, robj *key, robj *field, unsigned long *len)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_HASH)) {
         return REDIS_KEY_NOT_EXIST;
@@ -863,3 +931,15 @@ int RcHStrlen(redisCache db, robj *key, robj *field, unsigned long *len)
 
     return C_OK;
 }
+
+int RcHStrlen(redisCache db, robj *key, robj *field, unsigned long *len)
+{
+    if (NULL == db || NULL == key || NULL == field) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = hstrlenCommand(redis_db, key, field, len);
+    unlockShard(redis_db);
+
+    return retval;
+}
@@ -7,6 +7,7 @@
 #include "commonfunc.h"
 #include "object.h"
 #include "zmalloc.h"
+#include "atomicvar.h"
 #include "db.h"
 #include "util.h"
 #include "quicklist.h"
@@ -166,9 +167,15 @@ static int pushGenericCommand(redisDb *redis_db, robj *kobj, robj *vals[], unsig
     unsigned long i;
     for (i = 0; i < vals_size; i++) {
         if (!lobj) {
+            int fill, depth, codec;
+
+            atomicGet(redis_db->config->list_max_listpack_size,fill);
+            atomicGet(redis_db->config->list_compress_depth,depth);
+            atomicGet(redis_db->config->list_compress_codec,codec);
+            if (fill == 0) fill = OBJ_LIST_MAX_ZIPLIST_SIZE;
             lobj = createQuicklistObject();
-            quicklistSetOptions(lobj->ptr, OBJ_LIST_MAX_ZIPLIST_SIZE,
-                                OBJ_LIST_COMPRESS_DEPTH);
+            quicklistSetOptions(lobj->ptr, fill, depth);
+            quicklistSetCodec(lobj->ptr, codec);
             dbAdd(redis_db,kobj,lobj);
         }
         listTypePush(lobj,vals[i],where);
@@ -212,13 +219,8 @@ static int popGenericCommand(redisDb *redis_db, robj *kobj, sds *element, int wh
     }
 }
 
-int RcLIndex(redisCache db, robj *key, long index, sds *element)
+static int lindexCommand(redisDb *redis_db, robj *key, long index, sds *element)
 {
-    if (NULL == db || NULL == key) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_LIST)) {
         return REDIS_KEY_NOT_EXIST;
@@ -226,13 +228,18 @@ int RcLIndex(redisCache db, robj *key, long index, sds *element)
 
     if (o->encoding == OBJ_ENCODING_QUICKLIST) {
         quicklistEntry entry;
-        if (quicklistIndex(o->ptr, index, &entry)) {
+        /* Use an iterator, that compresses the node again when released,
+         * instead of leaving it decompressed after quicklistIndex(). */
+        quicklistIter *iter = quicklistGetIteratorAtIdx(o->ptr, AL_START_TAIL, index);
+        if (iter && quicklistNext(iter, &entry)) {
             if (entry.value) {
                 *element = sdsnewlen(entry.value, entry.sz);
             } else {
                 *element = sdsfromlonglong(entry.longval);
             }
+            quicklistReleaseIterator(iter);
         } else {
+            if (iter) quicklistReleaseIterator(iter);
             return REDIS_ITEM_NOT_EXIST;
         }
     } else {
@@ -242,13 +249,20 @@ int RcLIndex(redisCache db, robj *key, long index, sds *element)
     return C_OK;
 }
 
-int RcLInsert(redisCache db, robj *key, int where, robj *pivot, robj *val)
+int RcLIndex(redisCache db, robj *key, long index, sds *element)
 {
-    if (NULL == db || NULL == key || NULL == pivot || NULL == val) {
+    if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = lindexCommand(redis_db, key, index, element);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int linsertCommand(redisDb *redis_db, robj *key, int where, robj *pivot, robj *val)
+{
     robj *subject;
     if ((subject = lookupKeyWrite(redis_db,key)) == NULL || checkType(subject,OBJ_LIST)) {
         return REDIS_KEY_NOT_EXIST;
@@ -268,13 +282,20 @@ int RcLInsert(redisCache db, robj *key, int where, robj *pivot, robj *val)
     return C_OK;
 }
 
-int RcLLen(redisCache db, robj *key, unsigned long *len)
+int RcLInsert(redisCache db, robj *key, int where, robj *pivot, robj *val)
 {
-    if (NULL == db || NULL == key) {
+    if (NULL == db || NULL == key || NULL == pivot || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = linsertCommand(redis_db, key, where, pivot, val);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int llenCommand(redisDb *redis_db, robj *key, unsigned long *len)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_LIST)) {
         return REDIS_KEY_NOT_EXIST;
@@ -285,43 +306,56 @@ int RcLLen(redisCache db, robj *key, unsigned long *len)
     return C_OK;
 }
 
-int RcLPop(redisCache db, robj *key, sds *element)
+int RcLLen(redisCache db, robj *key, unsigned long *len)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = llenCommand(redis_db, key, len);
+    unlockShard(redis_db);
 
-    return popGenericCommand(redis_db, key, element, REDIS_LIST_HEAD);
+    return retval;
 }
 
-int RcLPush(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
+int RcLPop(redisCache db, robj *key, sds *element)
 {
-    if (NULL == db || NULL == key || NULL == vals) {
+    if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = popGenericCommand(redis_db, key, element, REDIS_LIST_HEAD);
+    unlockShard(redis_db);
 
-    return pushGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_HEAD);
+    return retval;
 }
 
-int RcLPushx(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
+int RcLPush(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
 {
     if (NULL == db || NULL == key || NULL == vals) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = pushGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_HEAD);
+    unlockShard(redis_db);
 
-    return pushxGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_HEAD);
+    return retval;
 }
 
-int RcLRange(redisCache db, robj *key, long start, long end, sds **vals, unsigned long *vals_size)
+int RcLPushx(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
 {
     if (NULL == db || NULL == key || NULL == vals) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = pushxGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_HEAD);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int lrangeCommand(redisDb *redis_db, robj *key, long start, long end, sds **vals, unsigned long *vals_size)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_LIST)) {
         return REDIS_KEY_NOT_EXIST;
@@ -371,13 +405,20 @@ int RcLRange(redisCache db, robj *key, long start, long end, sds **vals, unsigne
     return C_OK;
 }
 
-int RcLRem(redisCache db, robj *key, long count, robj *val)
+int RcLRange(redisCache db, robj *key, long start, long end, sds **vals, unsigned long *vals_size)
 {
-    if (NULL == db || NULL == key || NULL == val) {
+    if (NULL == db || NULL == key || NULL == vals) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = lrangeCommand(redis_db, key, start, end, vals, vals_size);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int lremCommand(redisDb *redis_db, robj *key, long count, robj *val)
+{
     robj *subject;
     if ((subject = lookupKeyWrite(redis_db,key)) == NULL || checkType(subject,OBJ_LIST)) {
         return REDIS_KEY_NOT_EXIST;
@@ -409,13 +450,20 @@ int RcLRem(redisCache db, robj *key, long count, robj *val)
     return C_OK;
 }
 
-int RcLSet(redisCache db, robj *key, long index, robj *val)
+int RcLRem(redisCache db, robj *key, long count, robj *val)
 {
     if (NULL == db || NULL == key || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = lremCommand(redis_db, key, count, val);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int lsetCommand(redisDb *redis_db, robj *key, long index, robj *val)
+{
     robj *o;
     if ((o = lookupKeyWrite(redis_db,key)) == NULL || checkType(o,OBJ_LIST)) {
         return REDIS_KEY_NOT_EXIST;
@@ -435,13 +483,20 @@ int RcLSet(redisCache db, robj *key, long index, robj *val)
     return C_OK;
 }
 
-int RcLTrim(redisCache db, robj *key, long start, long end)
+int RcLSet(redisCache db, robj *key, long index, robj *val)
 {
-    if (NULL == db || NULL == key) {
+    if (NULL == db || NULL == key || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = lsetCommand(redis_db, key, index, val);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int ltrimCommand(redisDb *redis_db, robj *key, long start, long end)
+{
     robj *o;
     if ((o = lookupKeyWrite(redis_db,key)) == NULL || checkType(o,OBJ_LIST)) {
         return REDIS_KEY_NOT_EXIST;
@@ -481,14 +536,28 @@ int RcLTrim(redisCache db, robj *key, long start, long end)
     return C_OK;
 }
 
+int RcLTrim(redisCache db, robj *key, long start, long end)
+{
+    if (NULL == db || NULL == key) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = ltrimCommand(redis_db, key, start, end);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
 int RcRPop(redisCache db, robj *key, sds *element)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = popGenericCommand(redis_db, key, element, REDIS_LIST_TAIL);
+    unlockShard(redis_db);
 
-    return popGenericCommand(redis_db, key, element, REDIS_LIST_TAIL);
+    return retval;
 }
 
 int RcRPush(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
@@ -496,9 +565,11 @@ int RcRPush(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
     if (NULL == db || NULL == key || NULL == vals) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = pushGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_TAIL);
+    unlockShard(redis_db);
 
-    return pushGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_TAIL);
+    return retval;
 }
 
 int RcRPushx(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
@@ -506,7 +577,9 @@ int RcRPushx(redisCache db, robj *key, robj *vals[], unsigned long vals_size)
     if (NULL == db || NULL == key || NULL == vals) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = pushxGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_TAIL);
+    unlockShard(redis_db);
 
-    return pushxGenericCommand(redis_db, key, vals, vals_size, REDIS_LIST_TAIL);
+    return retval;
 }
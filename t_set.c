@@ -8,6 +8,7 @@
 #include "commonfunc.h"
 #include "object.h"
 #include "zmalloc.h"
+#include "atomicvar.h"
 #include "db.h"
 #include "util.h"
 #include "intset.h"
@@ -24,11 +25,22 @@ typedef struct {
 } setTypeIterator;
 
 
+/* Return the max number of members of an intset encoded set. A zero config
+ * means the default, a negative one disables the encoding. */
+static size_t setTypeMaxIntsetEntries(db_config *config) {
+    int entries;
+
+    atomicGet(config->set_max_intset_entries,entries);
+    if (entries == 0) entries = OBJ_SET_MAX_INTSET_ENTRIES;
+    return entries < 0 ? 0 : entries;
+}
+
 /* Factory method to return a set that *can* hold "value". When the object has
  * an integer-encodable value, an intset will be returned. Otherwise a regular
  * hash table. */
-robj *setTypeCreate(sds value) {
-    if (isSdsRepresentableAsLongLong(value,NULL) == C_OK)
+robj *setTypeCreate(sds value, db_config *config) {
+    if (setTypeMaxIntsetEntries(config) > 0 &&
+        isSdsRepresentableAsLongLong(value,NULL) == C_OK)
         return createIntsetObject();
     return createSetObject();
 }
@@ -91,7 +103,7 @@ void setTypeConvert(robj *setobj, int enc) {
 
     if (enc == OBJ_ENCODING_HT) {
         int64_t intele;
-        dict *d = dictCreate(&setDictType,NULL);
+        dict *d = dictCreate(valueDictType(&setDictType),NULL);
         sds element;
 
         /* Presize the dict to avoid rehashing */
@@ -117,7 +129,7 @@ void setTypeConvert(robj *setobj, int enc) {
  *
  * If the value was already member of the set, nothing is done and 0 is
  * returned, otherwise the new element is added and 1 is returned. */
-int setTypeAdd(robj *subject, sds value) {
+int setTypeAdd(robj *subject, sds value, db_config *config) {
     long long llval;
     if (subject->encoding == OBJ_ENCODING_HT) {
         dict *ht = subject->ptr;
@@ -134,7 +146,7 @@ int setTypeAdd(robj *subject, sds value) {
             if (success) {
                 /* Convert to regular set when the intset contains
                  * too many entries. */
-                if (intsetLen(subject->ptr) > OBJ_SET_MAX_INTSET_ENTRIES)
+                if (intsetLen(subject->ptr) > setTypeMaxIntsetEntries(config))
                     setTypeConvert(subject,OBJ_ENCODING_HT);
                 return 1;
             }
@@ -167,6 +179,45 @@ int setTypeIsMember(robj *subject, sds value) {
     return 0;
 }
 
+/* Like setTypeIsMember() for each of the "count" members, storing the results
+ * in "is_member". When the integer members come in ascending order, an intset
+ * is probed in a single pass over the set with intsetFindSorted(). */
+static void setTypeIsMemberMany(robj *subject, robj *members[], unsigned long count, int *is_member) {
+    unsigned long j, n = 0, *idx;
+    long long llval;
+    int64_t *values;
+    uint8_t *found;
+    int sorted = 1;
+
+    if (subject->encoding != OBJ_ENCODING_INTSET || count < 2) {
+        for (j = 0; j < count; j++)
+            is_member[j] = setTypeIsMember(subject,members[j]->ptr);
+        return;
+    }
+
+    values = zmalloc(sizeof(int64_t)*count);
+    idx = zmalloc(sizeof(unsigned long)*count);
+    for (j = 0; j < count; j++) {
+        is_member[j] = 0;
+        if (isSdsRepresentableAsLongLong(members[j]->ptr,&llval) != C_OK) continue;
+        if (n && llval < values[n-1]) sorted = 0;
+        values[n] = llval;
+        idx[n++] = j;
+    }
+
+    if (sorted && n <= UINT32_MAX) {
+        found = zmalloc(n);
+        intsetFindSorted(subject->ptr,values,n,found);
+        for (j = 0; j < n; j++) is_member[idx[j]] = found[j];
+        zfree(found);
+    } else {
+        for (j = 0; j < n; j++)
+            is_member[idx[j]] = intsetFind(subject->ptr,values[j]);
+    }
+    zfree(values);
+    zfree(idx);
+}
+
 int setTypeRemove(robj *setobj, sds value) {
     long long llval;
     if (setobj->encoding == OBJ_ENCODING_HT) {
@@ -250,16 +301,11 @@ static void SMembers(robj *subject,
     setTypeReleaseIterator(si);
 }
 
-int RcSAdd(redisCache db, robj *key, robj *members[], unsigned long members_size)
+static int saddCommand(redisDb *redis_db, robj *key, robj *members[], unsigned long members_size)
 {
-    if (NULL == db || NULL == key || NULL == members) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *set = lookupKeyWrite(redis_db,key);
     if (set == NULL) {
-        set = setTypeCreate(members[0]->ptr);
+        set = setTypeCreate(members[0]->ptr,redis_db->config);
         dbAdd(redis_db,key,set);
     } else {
         if (set->type != OBJ_SET) {
@@ -269,19 +315,26 @@ int RcSAdd(redisCache db, robj *key, robj *members[], unsigned long members_size
 
     unsigned long j;
     for (j = 0; j < members_size; j++) {
-        setTypeAdd(set,members[j]->ptr);
+        setTypeAdd(set,members[j]->ptr,redis_db->config);
     }
 
     return C_OK;
 }
 
-int RcSCard(redisCache db, robj *key, unsigned long *len)
+int RcSAdd(redisCache db, robj *key, robj *members[], unsigned long members_size)
 {
-    if (NULL == db || NULL == key) {
+    if (NULL == db || NULL == key || NULL == members) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = saddCommand(redis_db, key, members, members_size);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int scardCommand(redisDb *redis_db, robj *key, unsigned long *len)
+{
     robj *o;
     if ((o = lookupKeyRead(redis_db,key)) == NULL || checkType(o,OBJ_SET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -292,30 +345,68 @@ int RcSCard(redisCache db, robj *key, unsigned long *len)
     return C_OK;
 }
 
+int RcSCard(redisCache db, robj *key, unsigned long *len)
+{
+    if (NULL == db || NULL == key) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = scardCommand(redis_db, key, len);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
+static int sismemberCommand(redisDb *redis_db, robj *key, robj *member, int *is_member)
+{
+    robj *set;
+    if ((set = lookupKeyRead(redis_db,key)) == NULL || checkType(set,OBJ_SET)) {
+        return REDIS_KEY_NOT_EXIST;
+    }
+
+    *is_member = setTypeIsMember(set,member->ptr);
+
+    return C_OK;
+}
+
 int RcSIsmember(redisCache db, robj *key, robj *member, int *is_member)
 {
     if (NULL == db || NULL == key || NULL == member) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = sismemberCommand(redis_db, key, member, is_member);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int smismemberCommand(redisDb *redis_db, robj *key, robj *members[], unsigned long members_size, int *is_member)
+{
     robj *set;
     if ((set = lookupKeyRead(redis_db,key)) == NULL || checkType(set,OBJ_SET)) {
         return REDIS_KEY_NOT_EXIST;
     }
 
-    *is_member = setTypeIsMember(set,member->ptr);
+    setTypeIsMemberMany(set,members,members_size,is_member);
 
     return C_OK;
 }
 
-int RcSMembers(redisCache db, robj *key, sds **members, unsigned long *members_size)
+int RcSMIsmember(redisCache db, robj *key, robj *members[], unsigned long members_size, int *is_member)
 {
-    if (NULL == db || NULL == key || NULL == members) {
+    if (NULL == db || NULL == key || NULL == members || NULL == is_member) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = smismemberCommand(redis_db, key, members, members_size, is_member);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int smembersCommand(redisDb *redis_db, robj *key, sds **members, unsigned long *members_size)
+{
     robj *subject;
     if ((subject = lookupKeyRead(redis_db,key)) == NULL || checkType(subject,OBJ_SET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -326,13 +417,20 @@ int RcSMembers(redisCache db, robj *key, sds **members, unsigned long *members_s
     return C_OK;
 }
 
-int RcSRem(redisCache db, robj *key, robj *members[], unsigned long members_size)
+int RcSMembers(redisCache db, robj *key, sds **members, unsigned long *members_size)
 {
     if (NULL == db || NULL == key || NULL == members) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = smembersCommand(redis_db, key, members, members_size);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int sremCommand(redisDb *redis_db, robj *key, robj *members[], unsigned long members_size)
+{
     robj *set;
     if ((set = lookupKeyWrite(redis_db,key)) == NULL || checkType(set,OBJ_SET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -351,13 +449,20 @@ int RcSRem(redisCache db, robj *key, robj *members[], unsigned long members_size
     return C_ERR;
 }
 
-int RcSRandmember(redisCache db, robj *key, long l, sds **members, unsigned long *members_size)
+int RcSRem(redisCache db, robj *key, robj *members[], unsigned long members_size)
 {
     if (NULL == db || NULL == key || NULL == members) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = sremCommand(redis_db, key, members, members_size);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int srandmemberCommand(redisDb *redis_db, robj *key, long l, sds **members, unsigned long *members_size)
+{
     robj *subject;
     if ((subject = lookupKeyRead(redis_db,key)) == NULL || checkType(subject,OBJ_SET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -504,3 +609,15 @@ int RcSRandmember(redisCache db, robj *key, long l, sds **members, unsigned long
 
     return C_OK;
 }
+
+int RcSRandmember(redisCache db, robj *key, long l, sds **members, unsigned long *members_size)
+{
+    if (NULL == db || NULL == key || NULL == members) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = srandmemberCommand(redis_db, key, l, members, members_size);
+    unlockShard(redis_db);
+
+    return retval;
+}
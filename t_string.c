@@ -44,7 +44,7 @@ static int checkStringLength(long long size)
 #define OBJ_SET_EX (1<<2)     /* Set if time in seconds is given */
 #define OBJ_SET_PX (1<<3)     /* Set if time in ms in given */
 
-static int setGenericCommand(redisCache *redis_cache, robj *kobj, robj *vobj, robj *expire, int unit, int flags) {
+static int setGenericCommand(redisDb *redis_db, robj *kobj, robj *vobj, robj *expire, int unit, int flags) {
     long long milliseconds = 0; /* initialized to avoid any harmness warning */
 
     if (expire) {
@@ -56,22 +56,25 @@ static int setGenericCommand(redisCache *redis_cache, robj *kobj, robj *vobj, ro
         if (unit == UNIT_SECONDS) milliseconds *= 1000;
     }
 
-    if ((flags & OBJ_SET_NX && lookupKeyWrite(redis_cache,kobj) != NULL) ||
-        (flags & OBJ_SET_XX && lookupKeyWrite(redis_cache,kobj) == NULL)) {
+    if ((flags & OBJ_SET_NX && lookupKeyWrite(redis_db,kobj) != NULL) ||
+        (flags & OBJ_SET_XX && lookupKeyWrite(redis_db,kobj) == NULL)) {
         return C_ERR;
     }
-    setKey(redis_cache, kobj, vobj);
-
-    if (expire) setExpire(redis_cache, kobj, mstime()+milliseconds);
+    /* Store a private copy, so that the value is charged to this DB and
+     * the caller is free to release its object at any time. The copy also
+     * holds the key, saving the keyspace its own allocation. */
+    vobj = createStringObjectWithKey(kobj->ptr,vobj);
+    setKeyWithExpire(redis_db, kobj, vobj, expire ? mstime()+milliseconds : -1);
+    decrRefCount(vobj);
 
     return C_OK;
 }
 
-static int incrDecrCommand(redisCache *redis_cache, robj *kobj, long long incr, long long *ret) {
+static int incrDecrCommand(redisDb *redis_db, robj *kobj, long long incr, long long *ret) {
     long long value, oldvalue;
     robj *o, *new;
 
-    o = lookupKeyWrite(redis_cache,kobj);
+    o = lookupKeyWrite(redis_db,kobj);
     if (o != NULL && checkType(o,OBJ_STRING)) return REDIS_INVALID_TYPE;
     if (getLongLongFromObject(o,&value) != C_OK) return REDIS_INVALID_TYPE;
 
@@ -92,21 +95,21 @@ static int incrDecrCommand(redisCache *redis_cache, robj *kobj, long long incr,
     } else {
         new = createStringObjectFromLongLong(value);
         if (o) {
-            dbOverwrite(redis_cache,kobj,new);
+            dbOverwrite(redis_db,kobj,new);
         } else {
-            dbAdd(redis_cache,kobj,new);
+            dbAdd(redis_db,kobj,new);
         }
     }
 
     return C_OK;
 }
 
-static int incrbyfloatCommand(redisCache *redis_cache, robj *kobj, long double incr, long double *ret)
+static int incrbyfloatCommand(redisDb *redis_db, robj *kobj, long double incr, long double *ret)
 {
     long double value;
     robj *o, *new;
 
-    o = lookupKeyWrite(redis_cache,kobj);
+    o = lookupKeyWrite(redis_db,kobj);
     if (o != NULL && checkType(o,OBJ_STRING)) return REDIS_INVALID_TYPE;
     if (getLongDoubleFromObject(o,&value) != C_OK) return REDIS_INVALID_TYPE;
 
@@ -118,24 +121,24 @@ static int incrbyfloatCommand(redisCache *redis_cache, robj *kobj, long double i
     new = createStringObjectFromLongDouble(value, 1);
 
     if (o)
-        dbOverwrite(redis_cache,kobj,new);
+        dbOverwrite(redis_db,kobj,new);
     else
-        dbAdd(redis_cache,kobj,new);
+        dbAdd(redis_db,kobj,new);
 
     return C_OK;
 }
 
-static int appendCommand(redisCache *redis_cache, robj *kobj, robj *vobj, unsigned long *ret)
+static int appendCommand(redisDb *redis_db, robj *kobj, robj *vobj, unsigned long *ret)
 {
     size_t totlen;
     robj *o, *append;
 
-    o = lookupKeyWrite(redis_cache,kobj);
+    o = lookupKeyWrite(redis_db,kobj);
     if (o == NULL) {
         /* Create the key */
         // c->argv[2] = tryObjectEncoding(c->argv[2]);
-        dbAdd(redis_cache,kobj,vobj);
-        incrRefCount(vobj);
+        vobj = dupStringObject(vobj);
+        dbAdd(redis_db,kobj,vobj);
         totlen = stringObjectLen(vobj);
     } else {
         /* Key exists, check type */
@@ -149,7 +152,7 @@ static int appendCommand(redisCache *redis_cache, robj *kobj, robj *vobj, unsign
             return REDIS_OVERFLOW;
 
         /* Append the value */
-        o = dbUnshareStringValue(redis_cache,kobj,o);
+        o = dbUnshareStringValue(redis_db,kobj,o);
         o->ptr = sdscatlen(o->ptr,append->ptr,sdslen(append->ptr));
         totlen = sdslen(o->ptr);
     }
@@ -159,7 +162,7 @@ static int appendCommand(redisCache *redis_cache, robj *kobj, robj *vobj, unsign
     return C_OK;
 }
 
-static int getrangeCommand(redisCache *redis_cache,
+static int getrangeCommand(redisDb *redis_db,
                            robj *kobj,
                            long start,
                            long end,
@@ -169,7 +172,7 @@ static int getrangeCommand(redisCache *redis_cache,
     char *str, llbuf[32];
     size_t strlen;
 
-    if ((o = lookupKeyRead(redis_cache, kobj)) == NULL) return REDIS_KEY_NOT_EXIST;
+    if ((o = lookupKeyRead(redis_db, kobj)) == NULL) return REDIS_KEY_NOT_EXIST;
     if (checkType(o,OBJ_STRING)) return REDIS_INVALID_TYPE;
 
     if (o->encoding == OBJ_ENCODING_INT) {
@@ -203,14 +206,14 @@ static int getrangeCommand(redisCache *redis_cache,
     return C_OK;
 }
 
-static int setrangeCommand(redisCache *redis_cache, robj *kobj, long offset, robj *vobj, unsigned long *ret)
+static int setrangeCommand(redisDb *redis_db, robj *kobj, long offset, robj *vobj, unsigned long *ret)
 {
     robj *o;
     sds value = vobj->ptr;
 
     if (offset < 0) return REDIS_INVALID_ARG;
 
-    o = lookupKeyWrite(redis_cache,kobj);
+    o = lookupKeyWrite(redis_db,kobj);
     if (o == NULL) {
         /* Return 0 when setting nothing on a non-existing string */
         if (sdslen(value) == 0) {
@@ -222,7 +225,7 @@ static int setrangeCommand(redisCache *redis_cache, robj *kobj, long offset, rob
         if (checkStringLength(offset+sdslen(value)) != C_OK) return REDIS_OVERFLOW;
 
         o = createObject(OBJ_STRING,sdsempty());
-        dbAdd(redis_cache,kobj,o);
+        dbAdd(redis_db,kobj,o);
     } else {
 
         /* Key exists, check type */
@@ -238,7 +241,7 @@ static int setrangeCommand(redisCache *redis_cache, robj *kobj, long offset, rob
         if (checkStringLength(offset+sdslen(value)) != C_OK) return REDIS_OVERFLOW;
 
         /* Create a copy when the object is shared or encoded. */
-        o = dbUnshareStringValue(redis_cache,kobj,o);
+        o = dbUnshareStringValue(redis_db,kobj,o);
     }
 
     if (sdslen(value) > 0) {
@@ -255,9 +258,11 @@ int RcSet(redisCache cache, robj *key, robj *val, robj *expire)
     if (NULL == cache || NULL == key || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = setGenericCommand(redis_db, key, val, expire, UNIT_SECONDS, OBJ_SET_NO_FLAGS);
+    unlockShard(redis_db);
 
-    return setGenericCommand(redis_cache, key, val, expire, UNIT_SECONDS, OBJ_SET_NO_FLAGS);
+    return retval;
 }
 
 int RcSetnx(redisCache cache, robj *key, robj *val, robj *expire)
@@ -265,9 +270,11 @@ int RcSetnx(redisCache cache, robj *key, robj *val, robj *expire)
     if (NULL == cache || NULL == key || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = setGenericCommand(redis_db, key, val, expire, UNIT_SECONDS, OBJ_SET_NX);
+    unlockShard(redis_db);
 
-    return setGenericCommand(redis_cache, key, val, expire, UNIT_SECONDS, OBJ_SET_NX);;
+    return retval;
 }
 
 int RcSetxx(redisCache cache, robj *key, robj *val, robj *expire)
@@ -275,23 +282,83 @@ int RcSetxx(redisCache cache, robj *key, robj *val, robj *expire)
     if (NULL == cache || NULL == key || NULL == val) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = setGenericCommand(redis_db, key, val, expire, UNIT_SECONDS, OBJ_SET_XX);
+    unlockShard(redis_db);
 
-    return setGenericCommand(redis_cache, key, val, expire, UNIT_SECONDS, OBJ_SET_XX);;
+    return retval;
 }
 
+/* The stored value can't be shared with the caller: its reference count
+ * is not atomic, and the value may be released by another thread, holding
+ * the shard lock, or by the lazy free thread after RcFlushCacheAsync(). So
+ * '*val' is always a private copy. */
 int RcGet(redisCache cache, robj *key, robj **val)
 {
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
 
-    robj *vobj = lookupKeyRead(redis_cache, key);
+    robj *vobj = lookupKeyRead(redis_db, key);
     if (NULL == vobj || OBJ_STRING != vobj->type) {
+        unlockShard(redis_db);
         return REDIS_KEY_NOT_EXIST;
     }
-    *val = vobj;
+    *val = dupStringObject(vobj);
+    unlockShard(redis_db);
+
+    return C_OK;
+}
+
+static void mgetKeyProc(redisDb *redis_db, robj *key, uint64_t hash, size_t idx, void *privdata)
+{
+    robj **vals = privdata;
+    robj *vobj = lookupKeyReadWithHash(redis_db, key, hash);
+
+    if (NULL == vobj || OBJ_STRING != vobj->type) {
+        vals[idx] = NULL;
+    } else {
+        vals[idx] = dupStringObject(vobj);
+    }
+}
+
+/* vals[i] is set to the value of keys[i], or NULL if the key does not exist
+ * or does not hold a string. The values follow the same rules of RcGet(). */
+int RcMGet(redisCache cache, robj *keys[], unsigned long keys_size, robj *vals[])
+{
+    unsigned long i;
+
+    if (NULL == cache || NULL == keys || NULL == vals) {
+        return REDIS_INVALID_ARG;
+    }
+    for (i = 0; i < keys_size; i++) {
+        if (NULL == keys[i]) return REDIS_INVALID_ARG;
+    }
+    processKeyBatch(cache, keys, keys_size, mgetKeyProc, vals);
+
+    return C_OK;
+}
+
+static void msetKeyProc(redisDb *redis_db, robj *key, uint64_t hash, size_t idx, void *privdata)
+{
+    robj **vals = privdata;
+
+    UNUSED(hash);
+    setGenericCommand(redis_db, key, vals[idx], NULL, UNIT_SECONDS, OBJ_SET_NO_FLAGS);
+}
+
+int RcMSet(redisCache cache, robj *keys[], robj *vals[], unsigned long keys_size)
+{
+    unsigned long i;
+
+    if (NULL == cache || NULL == keys || NULL == vals) {
+        return REDIS_INVALID_ARG;
+    }
+    for (i = 0; i < keys_size; i++) {
+        if (NULL == keys[i] || NULL == vals[i]) return REDIS_INVALID_ARG;
+    }
+    processKeyBatch(cache, keys, keys_size, msetKeyProc, vals);
 
     return C_OK;
 }
@@ -301,9 +368,11 @@ int RcIncr(redisCache cache, robj *key, long long *ret)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = incrDecrCommand(redis_db, key, 1, ret);
+    unlockShard(redis_db);
 
-    return incrDecrCommand(redis_cache, key, 1, ret);
+    return retval;
 }
 
 int RcDecr(redisCache cache, robj *key, long long *ret)
@@ -311,9 +380,11 @@ int RcDecr(redisCache cache, robj *key, long long *ret)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = incrDecrCommand(redis_db, key, -1, ret);
+    unlockShard(redis_db);
 
-    return incrDecrCommand(redis_cache, key, -1, ret);
+    return retval;
 }
 
 int RcIncrBy(redisCache cache, robj *key, long long incr, long long *ret)
@@ -321,9 +392,11 @@ int RcIncrBy(redisCache cache, robj *key, long long incr, long long *ret)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = incrDecrCommand(redis_db, key, incr, ret);
+    unlockShard(redis_db);
 
-    return incrDecrCommand(redis_cache, key, incr, ret);
+    return retval;
 }
 
 int RcDecrBy(redisCache cache, robj *key, long long incr, long long *ret)
@@ -331,9 +404,11 @@ int RcDecrBy(redisCache cache, robj *key, long long incr, long long *ret)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = incrDecrCommand(redis_db, key, incr * (-1), ret);
+    unlockShard(redis_db);
 
-    return incrDecrCommand(redis_cache, key, incr * (-1), ret);
+    return retval;
 }
 
 int RcIncrByFloat(redisCache cache, robj *key, long double incr, long double *ret)
@@ -341,9 +416,11 @@ int RcIncrByFloat(redisCache cache, robj *key, long double incr, long double *re
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = incrbyfloatCommand(redis_db, key, incr, ret);
+    unlockShard(redis_db);
 
-    return incrbyfloatCommand(redis_cache, key, incr, ret);
+    return retval;
 }
 
 int RcAppend(redisCache cache, robj *key, robj *val, unsigned long *ret)
@@ -351,9 +428,11 @@ int RcAppend(redisCache cache, robj *key, robj *val, unsigned long *ret)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = appendCommand(redis_db, key, val, ret);
+    unlockShard(redis_db);
 
-    return appendCommand(redis_cache, key, val, ret);
+    return retval;
 }
 
 int RcGetRange(redisCache cache, robj *key, long start, long end, sds *val)
@@ -361,9 +440,11 @@ int RcGetRange(redisCache cache, robj *key, long start, long end, sds *val)
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = getrangeCommand(redis_db, key, start, end, val);
+    unlockShard(redis_db);
 
-    return getrangeCommand(redis_cache, key, start, end, val);
+    return retval;
 }
 
 int RcSetRange(redisCache cache, robj *key, long start, robj *val, unsigned long *ret)
@@ -371,19 +452,16 @@ int RcSetRange(redisCache cache, robj *key, long start, robj *val, unsigned long
     if (NULL == cache || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisCache *redis_cache = (redisCache*)cache;
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = setrangeCommand(redis_db, key, start, val, ret);
+    unlockShard(redis_db);
 
-    return setrangeCommand(redis_cache, key, start, val, ret);
+    return retval;
 }
 
-int RcStrlen(redisCache cache, robj *key, int *val_len)
+static int strlenCommand(redisDb *redis_db, robj *key, int *val_len)
 {
-    if (NULL == cache || NULL == key) {
-        return REDIS_INVALID_ARG;
-    }
-    redisCache *redis_cache = (redisCache*)cache;
-
-    robj *vobj = lookupKeyRead(redis_cache, key);
+    robj *vobj = lookupKeyRead(redis_db, key);
     if (NULL == vobj || OBJ_STRING != vobj->type) {
         return REDIS_KEY_NOT_EXIST;
     }
@@ -391,3 +469,15 @@ int RcStrlen(redisCache cache, robj *key, int *val_len)
 
     return C_OK;
 }
+
+int RcStrlen(redisCache cache, robj *key, int *val_len)
+{
+    if (NULL == cache || NULL == key) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(cache,key);
+    int retval = strlenCommand(redis_db, key, val_len);
+    unlockShard(redis_db);
+
+    return retval;
+}
@@ -9,7 +9,7 @@
 #include "zmalloc.h"
 #include "db.h"
 #include "zset.h"
-#include "ziplist.h"
+#include "listpack.h"
 #include "util.h"
 #include "solarisfixes.h"
 
@@ -66,13 +66,7 @@ static int zaddGenericCommand(redisDb *redis_db,
             zfree(scores);
             return C_ERR; /* No key + XX option: nothing to do. */
         }
-        if (OBJ_ZSET_MAX_ZIPLIST_ENTRIES == 0 ||
-            OBJ_ZSET_MAX_ZIPLIST_VALUE < sdslen(items[scoreidx+1]->ptr))
-        {
-            zobj = createZsetObject();
-        } else {
-            zobj = createZsetZiplistObject();
-        }
+        zobj = zsetTypeCreate(sdslen(items[scoreidx+1]->ptr),redis_db->config);
         dbAdd(redis_db,kobj,zobj);
     } else {
         if (zobj->type != OBJ_ZSET) {
@@ -96,7 +90,7 @@ static int zaddGenericCommand(redisDb *redis_db,
         int retflags = flags;
 
         ele = items[scoreidx+1+j*2]->ptr;
-        int retval = zsetAdd(zobj, score, ele, &retflags, &newscore);
+        int retval = zsetAdd(zobj, score, ele, &retflags, &newscore, redis_db->config);
         if (retval == 0) {
             zfree(scores);
             return C_ERR;
@@ -144,7 +138,7 @@ static int zrangeGenericCommand(redisDb *redis_db,
     *items_size = rangelen;
     *items = (zitem*)zcallocate(sizeof(zitem) * (*items_size));
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -153,16 +147,16 @@ static int zrangeGenericCommand(redisDb *redis_db,
         unsigned long i = 0;
 
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(zl,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(zl,2*start);
 
         assert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         while (rangelen--) {
             assert(eptr != NULL && sptr != NULL);
-            assert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 (*items+i)->member = sdsfromlonglong(vlong);
             else
@@ -249,7 +243,7 @@ static int genericZrangebyscoreCommand(redisDb *redis_db,
     int withscores = 1;
     unsigned long rangelen = 0;
     unsigned long i = 0;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -272,7 +266,7 @@ static int genericZrangebyscoreCommand(redisDb *redis_db,
 
         /* Get score pointer for the first element. */
         assert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
@@ -294,8 +288,8 @@ static int genericZrangebyscoreCommand(redisDb *redis_db,
                 if (!zslValueLteMax(score,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always succeed */
-            assert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+            /* We know the element exists, so lpGetValue always succeeds. */
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -415,7 +409,7 @@ static int genericZrangebylexCommand(redisDb *redis_db,
     long offset = 0, limit = -1;
     unsigned long rangelen = 0;
     unsigned long i = 0;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -438,7 +432,7 @@ static int genericZrangebylexCommand(redisDb *redis_db,
 
         /* Get score pointer for the first element. */
         assert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
@@ -458,9 +452,8 @@ static int genericZrangebylexCommand(redisDb *redis_db,
                 if (!zzlLexValueLteMax(eptr,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
-             * succeed. */
-            assert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+            /* We know the element exists, so lpGetValue always succeeds. */
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -587,7 +580,7 @@ static int zremrangeGenericCommand(redisDb *redis_db, robj *kobj,
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->ptr = zzlDeleteRangeByRank(zobj->ptr,start+1,end+1,&deleted);
@@ -648,18 +641,15 @@ int RcZAdd(redisCache db, robj *key, robj *items[], unsigned long items_size)
     if (NULL == db || NULL == key || NULL == items) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zaddGenericCommand(redis_db, key, items, items_size, ZADD_NONE);
+    unlockShard(redis_db);
 
-    return zaddGenericCommand(redis_db, key, items, items_size, ZADD_NONE);
+    return retval;
 }
 
-int RcZCard(redisCache db, robj *key, unsigned long *len)
+static int zcardCommand(redisDb *redis_db, robj *key, unsigned long *len)
 {
-    if (NULL == db || NULL == key) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *zobj;
     if ((zobj = lookupKeyRead(redis_db,key)) == NULL || checkType(zobj,OBJ_ZSET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -670,13 +660,20 @@ int RcZCard(redisCache db, robj *key, unsigned long *len)
     return C_OK;
 }
 
-int RcZCount(redisCache db, robj *key, robj *min, robj *max, unsigned long *len)
+int RcZCard(redisCache db, robj *key, unsigned long *len)
 {
-    if (NULL == db || NULL == key || NULL == min || NULL == max) {
+    if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zcardCommand(redis_db, key, len);
+    unlockShard(redis_db);
+
+    return retval;
+}
 
+static int zcountCommand(redisDb *redis_db, robj *key, robj *min, robj *max, unsigned long *len)
+{
     robj *zobj;
     if ((zobj = lookupKeyRead(redis_db,key)) == NULL || checkType(zobj,OBJ_ZSET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -689,7 +686,7 @@ int RcZCount(redisCache db, robj *key, robj *min, robj *max, unsigned long *len)
     }
 
     unsigned long count = 0;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         double score;
@@ -704,7 +701,7 @@ int RcZCount(redisCache db, robj *key, robj *min, robj *max, unsigned long *len)
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         score = zzlGetScore(sptr);
         assert(zslValueLteMax(score,&range));
 
@@ -752,14 +749,28 @@ int RcZCount(redisCache db, robj *key, robj *min, robj *max, unsigned long *len)
     return C_OK;
 }
 
+int RcZCount(redisCache db, robj *key, robj *min, robj *max, unsigned long *len)
+{
+    if (NULL == db || NULL == key || NULL == min || NULL == max) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zcountCommand(redis_db, key, min, max, len);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
 int RcZIncrby(redisCache db, robj *key, robj *items[], unsigned long items_size)
 {
     if (NULL == db || NULL == key || NULL == items) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zaddGenericCommand(redis_db, key, items, items_size, ZADD_INCR);
+    unlockShard(redis_db);
 
-    return zaddGenericCommand(redis_db, key, items, items_size, ZADD_INCR);
+    return retval;
 }
 
 int RcZrange(redisCache db, robj *key, long start, long end, zitem **items, unsigned long *items_size)
@@ -767,9 +778,11 @@ int RcZrange(redisCache db, robj *key, long start, long end, zitem **items, unsi
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zrangeGenericCommand(redis_db, key, start, end, items, items_size, 0);
+    unlockShard(redis_db);
 
-    return zrangeGenericCommand(redis_db, key, start, end, items, items_size, 0);
+    return retval;
 }
 
 int RcZRangebyscore(redisCache db, robj *key,
@@ -780,9 +793,11 @@ int RcZRangebyscore(redisCache db, robj *key,
     if (NULL == db || NULL == key || NULL == min || NULL == max) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = genericZrangebyscoreCommand(redis_db, key, min, max, items, items_size, 0, offset, count);
+    unlockShard(redis_db);
 
-    return genericZrangebyscoreCommand(redis_db, key, min, max, items, items_size, 0, offset, count);
+    return retval;
 }
 
 int RcZRank(redisCache db, robj *key, robj *member, long *rank)
@@ -790,18 +805,15 @@ int RcZRank(redisCache db, robj *key, robj *member, long *rank)
     if (NULL == db || NULL == key || NULL == member) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zrankGenericCommand(redis_db, key, member, rank, 0);
+    unlockShard(redis_db);
 
-    return zrankGenericCommand(redis_db, key, member, rank, 0);
+    return retval;
 }
 
-int RcZRem(redisCache db, robj *key, robj *members[], unsigned long members_size)
+static int zremCommand(redisDb *redis_db, robj *key, robj *members[], unsigned long members_size)
 {
-    if (NULL == db || NULL == key || NULL == members) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *zobj;
     if ((zobj = lookupKeyWrite(redis_db,key)) == NULL || checkType(zobj,OBJ_ZSET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -819,14 +831,28 @@ int RcZRem(redisCache db, robj *key, robj *members[], unsigned long members_size
     return C_OK;
 }
 
+int RcZRem(redisCache db, robj *key, robj *members[], unsigned long members_size)
+{
+    if (NULL == db || NULL == key || NULL == members) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zremCommand(redis_db, key, members, members_size);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
 int RcZRemrangebyrank(redisCache db, robj *key, robj *min, robj *max)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zremrangeGenericCommand(redis_db, key, min, max, ZRANGE_RANK);
+    unlockShard(redis_db);
 
-    return zremrangeGenericCommand(redis_db, key, min, max, ZRANGE_RANK);
+    return retval;
 }
 
 int RcZRemrangebyscore(redisCache db, robj *key, robj *min, robj *max)
@@ -834,9 +860,11 @@ int RcZRemrangebyscore(redisCache db, robj *key, robj *min, robj *max)
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zremrangeGenericCommand(redis_db, key, min, max, ZRANGE_SCORE);
+    unlockShard(redis_db);
 
-    return zremrangeGenericCommand(redis_db, key, min, max, ZRANGE_SCORE);
+    return retval;
 }
 
 int RcZRevrange(redisCache db, robj *key,
@@ -846,9 +874,11 @@ int RcZRevrange(redisCache db, robj *key,
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zrangeGenericCommand(redis_db, key, start, end, items, items_size, 1);
+    unlockShard(redis_db);
 
-    return zrangeGenericCommand(redis_db, key, start, end, items, items_size, 1);
+    return retval;
 }
 
 int RcZRevrangebyscore(redisCache db, robj *key,
@@ -859,9 +889,11 @@ int RcZRevrangebyscore(redisCache db, robj *key,
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = genericZrangebyscoreCommand(redis_db, key, min, max, items, items_size, 1, offset, count);
+    unlockShard(redis_db);
 
-    return genericZrangebyscoreCommand(redis_db, key, min, max, items, items_size, 1, offset, count);
+    return retval;
 }
 
 int RcZRevrangebylex(redisCache db, robj *key,
@@ -871,9 +903,11 @@ int RcZRevrangebylex(redisCache db, robj *key,
     if (NULL == db || NULL == key || NULL == min || NULL == max) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = genericZrangebylexCommand(redis_db, key, min, max, members, members_size, 1);
+    unlockShard(redis_db);
 
-    return genericZrangebylexCommand(redis_db, key, min, max, members, members_size, 1);
+    return retval;
 }
 
 int RcZRevrank(redisCache db, robj *key, robj *member, long *rank)
@@ -881,18 +915,15 @@ int RcZRevrank(redisCache db, robj *key, robj *member, long *rank)
     if (NULL == db || NULL == key || NULL == member) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zrankGenericCommand(redis_db, key, member, rank, 1);
+    unlockShard(redis_db);
 
-    return zrankGenericCommand(redis_db, key, member, rank, 1);
+    return retval;
 }
 
-int RcZScore(redisCache db, robj *key, robj *member, double *score)
+static int zscoreCommand(redisDb *redis_db, robj *key, robj *member, double *score)
 {
-    if (NULL == db || NULL == key || NULL == member) {
-        return REDIS_INVALID_ARG;
-    }
-    redisDb *redis_db = (redisDb*)db;
-
     robj *zobj;
     if ((zobj = lookupKeyRead(redis_db,key)) == NULL || checkType(zobj,OBJ_ZSET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -905,25 +936,34 @@ int RcZScore(redisCache db, robj *key, robj *member, double *score)
     return C_OK;
 }
 
-int RcZRangebylex(redisCache db, robj *key,
-                  robj *min, robj *max,
-                  sds **members, unsigned long *members_size)
+int RcZScore(redisCache db, robj *key, robj *member, double *score)
 {
-    if (NULL == db || NULL == key || NULL == min || NULL == max) {
+    if (NULL == db || NULL == key || NULL == member) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zscoreCommand(redis_db, key, member, score);
+    unlockShard(redis_db);
 
-    return genericZrangebylexCommand(redis_db, key, min, max, members, members_size, 0);
+    return retval;
 }
 
-int RcZLexcount(redisCache db, robj *key, robj *min, robj *max, unsigned long *len)
+int RcZRangebylex(redisCache db, robj *key,
+                  robj *min, robj *max,
+                  sds **members, unsigned long *members_size)
 {
     if (NULL == db || NULL == key || NULL == min || NULL == max) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = genericZrangebylexCommand(redis_db, key, min, max, members, members_size, 0);
+    unlockShard(redis_db);
 
+    return retval;
+}
+
+static int zlexcountCommand(redisDb *redis_db, robj *key, robj *min, robj *max, unsigned long *len)
+{
     robj *zobj;
     if ((zobj = lookupKeyRead(redis_db,key)) == NULL || checkType(zobj,OBJ_ZSET)) {
         return REDIS_KEY_NOT_EXIST;
@@ -936,7 +976,7 @@ int RcZLexcount(redisCache db, robj *key, robj *min, robj *max, unsigned long *l
     }
 
     int count = 0;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
@@ -951,7 +991,7 @@ int RcZLexcount(redisCache db, robj *key, robj *min, robj *max, unsigned long *l
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         assert(zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -998,12 +1038,26 @@ int RcZLexcount(redisCache db, robj *key, robj *min, robj *max, unsigned long *l
     return C_OK;
 }
 
+int RcZLexcount(redisCache db, robj *key, robj *min, robj *max, unsigned long *len)
+{
+    if (NULL == db || NULL == key || NULL == min || NULL == max) {
+        return REDIS_INVALID_ARG;
+    }
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zlexcountCommand(redis_db, key, min, max, len);
+    unlockShard(redis_db);
+
+    return retval;
+}
+
 int RcZRemrangebylex(redisCache db, robj *key, robj *min, robj *max)
 {
     if (NULL == db || NULL == key) {
         return REDIS_INVALID_ARG;
     }
-    redisDb *redis_db = (redisDb*)db;
+    redisDb *redis_db = lockKeyShard(db,key);
+    int retval = zremrangeGenericCommand(redis_db, key, min, max, ZRANGE_LEX);
+    unlockShard(redis_db);
 
-    return zremrangeGenericCommand(redis_db, key, min, max, ZRANGE_LEX);
+    return retval;
 }
@@ -0,0 +1,20 @@
+/* Test driver: runs the REDIS_TEST section of a module, like the
+ * "redis-server test <name>" entry point of Redis. */
+#include <stdio.h>
+#include <strings.h>
+
+#include "../intset.h"
+#include "../lzfast.h"
+#include "../quicklist.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <intset|lzfast|quicklist>\n", argv[0]);
+        return 1;
+    }
+    if (!strcasecmp(argv[1], "intset")) return intsetTest(argc, argv);
+    if (!strcasecmp(argv[1], "lzfast")) return lzfastTest(argc, argv);
+    if (!strcasecmp(argv[1], "quicklist")) return quicklistTest(argc, argv);
+    fprintf(stderr, "Unknown test: %s\n", argv[1]);
+    return 1;
+}
@@ -613,6 +613,38 @@ void getRandomHexChars(char *p, unsigned int len) {
     }
 }
 
+/* State of redisRandom(), every thread has its own, seeded on first use. */
+static __thread uint64_t random_state = 0;
+
+static uint64_t redisRandomSeed(void) {
+    struct timeval tv;
+    uint64_t z;
+
+    /* The address of the state is different in every thread. */
+    gettimeofday(&tv,NULL);
+    z = ((uint64_t)tv.tv_sec*1000000+tv.tv_usec) ^ (uint64_t)(uintptr_t)&random_state;
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+/* Fast pseudo random number generator (xorshift64*) used to sample keys and
+ * elements, and by the probabilistic counters. Unlike rand() and random()
+ * it takes no lock, so threads don't serialize on it. The output is not
+ * meant to be unpredictable. */
+uint64_t redisRandom(void) {
+    uint64_t x = random_state;
+
+    if (x == 0) x = redisRandomSeed();
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    random_state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
 /* Given the filename, return the absolute path as an SDS string, or NULL
  * if it fails for some reason. Note that "filename" may be an absolute path
  * already, this will be detected and handled correctly.
@@ -51,6 +51,7 @@ int d2string(char *buf, size_t len, double value);
 int ld2string(char *buf, size_t len, long double value, int humanfriendly);
 sds getAbsolutePath(char *filename);
 int pathIsBaseName(char *path);
+uint64_t redisRandom(void);
 
 #ifdef REDIS_TEST
 int utilTest(int argc, char **argv);
@@ -39,20 +39,17 @@ void zlibc_free(void *ptr) {
     free(ptr);
 }
 
+#include <stdint.h>
 #include <string.h>
 #include <pthread.h>
 #include "config.h"
 #include "zmalloc.h"
 #include "atomicvar.h"
 
-#ifdef HAVE_MALLOC_SIZE
-#define PREFIX_SIZE (0)
-#else
 #if defined(__sun) || defined(__sparc) || defined(__sparc__)
-#define PREFIX_SIZE (sizeof(long long))
+#define PREFIX_WORD_SIZE (sizeof(long long))
 #else
-#define PREFIX_SIZE (sizeof(size_t))
-#endif
+#define PREFIX_WORD_SIZE (sizeof(size_t))
 #endif
 
 /* Explicitly override malloc/free etc when using tcmalloc. */
@@ -70,6 +67,55 @@ void zlibc_free(void *ptr) {
 #define dallocx(ptr,flags) je_dallocx(ptr,flags)
 #endif
 
+/* Besides the process wide counter, memory is accounted to an "owner", so
+ * that every cache handle can be budgeted on its own. The owner is taken
+ * from the thread local 'current_owner' at allocation time. When the
+ * allocator does not give us the allocation size we already keep a header
+ * in front of every allocation, and the owner is stored in its high bits,
+ * so that the memory is given back to the right owner whatever thread or
+ * context frees it. An owner can have a parent, charged for everything the
+ * owner is charged for, to budget a group of owners as a whole. Owner 0
+ * means nobody.
+ *
+ * The header has no spare bits for the owner with a 32 bit size_t, so a
+ * second word holds it. An allocator providing the allocation size
+ * (HAVE_MALLOC_SIZE) needs no size in the header, that then only holds the
+ * owner. ZMALLOC_HEADER_SIZE() is the size usable by the caller. */
+#if defined(HAVE_MALLOC_SIZE)
+#define PREFIX_SIZE PREFIX_WORD_SIZE
+#define ZMALLOC_HEADER_SET(p,size,owner) (*((size_t*)(p)) = (size_t)(owner))
+#define ZMALLOC_HEADER_SIZE(p) (zmalloc_raw_size(p)-PREFIX_SIZE)
+#define ZMALLOC_HEADER_OWNER(p) ((int)*((size_t*)(p)))
+#elif SIZE_MAX > UINT32_MAX
+#define PREFIX_SIZE PREFIX_WORD_SIZE
+#define ZMALLOC_OWNER_SHIFT 48
+#define ZMALLOC_SIZE_MASK ((((size_t)1)<<ZMALLOC_OWNER_SHIFT)-1)
+#define ZMALLOC_HEADER_SET(p,size,owner) \
+    (*((size_t*)(p)) = (size)|((size_t)(owner)<<ZMALLOC_OWNER_SHIFT))
+#define ZMALLOC_HEADER_SIZE(p) (*((size_t*)(p))&ZMALLOC_SIZE_MASK)
+#define ZMALLOC_HEADER_OWNER(p) ((int)(*((size_t*)(p))>>ZMALLOC_OWNER_SHIFT))
+#else
+#define PREFIX_SIZE (2*PREFIX_WORD_SIZE)
+#define ZMALLOC_HEADER_SET(p,size,owner) \
+    (((size_t*)(p))[0] = (size), ((size_t*)(p))[1] = (size_t)(owner))
+#define ZMALLOC_HEADER_SIZE(p) (((size_t*)(p))[0])
+#define ZMALLOC_HEADER_OWNER(p) ((int)((size_t*)(p))[1])
+#endif
+
+/* Every owner counter sits in its own cache line, so that threads working
+ * for different owners never write to the same line. */
+typedef struct zmallocOwner {
+    size_t used;
+    int in_use;
+    int parent;
+    char pad[64-sizeof(size_t)-2*sizeof(int)];
+} zmallocOwner;
+
+static zmallocOwner owners[ZMALLOC_MAX_OWNERS];
+static int next_owner = 1;
+static pthread_mutex_t owners_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int current_owner = 0;
+
 #define update_zmalloc_stat_alloc(__n) do { \
     size_t _n = (__n); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
@@ -82,6 +128,22 @@ void zlibc_free(void *ptr) {
     atomicDecr(used_memory,__n); \
 } while(0)
 
+#define update_zmalloc_owner_alloc(__owner,__n) do { \
+    if (__owner) { \
+        atomicIncr(owners[__owner].used,__n); \
+        if (owners[__owner].parent) \
+            atomicIncr(owners[owners[__owner].parent].used,__n); \
+    } \
+} while(0)
+
+#define update_zmalloc_owner_free(__owner,__n) do { \
+    if (__owner) { \
+        atomicDecr(owners[__owner].used,__n); \
+        if (owners[__owner].parent) \
+            atomicDecr(owners[owners[__owner].parent].used,__n); \
+    } \
+} while(0)
+
 static size_t used_memory = 0;
 pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -98,14 +160,11 @@ void *zmalloc(size_t size) {
     void *ptr = malloc(size+PREFIX_SIZE);
 
     if (!ptr) zmalloc_oom_handler(size);
-#ifdef HAVE_MALLOC_SIZE
-    update_zmalloc_stat_alloc(zmalloc_size(ptr));
-    return ptr;
-#else
-    *((size_t*)ptr) = size;
+    ZMALLOC_HEADER_SET(ptr,size,current_owner);
+    size = ZMALLOC_HEADER_SIZE(ptr);
     update_zmalloc_stat_alloc(size+PREFIX_SIZE);
+    update_zmalloc_owner_alloc(current_owner,size+PREFIX_SIZE);
     return (char*)ptr+PREFIX_SIZE;
-#endif
 }
 
 /* Allocation and free functions that bypass the thread cache
@@ -113,15 +172,15 @@ void *zmalloc(size_t size) {
  * Currently implemented only for jemalloc. Used for online defragmentation. */
 #ifdef HAVE_DEFRAG
 void *zmalloc_no_tcache(size_t size) {
-    void *ptr = mallocx(size+PREFIX_SIZE, MALLOCX_TCACHE_NONE);
+    void *ptr = mallocx(size, MALLOCX_TCACHE_NONE);
     if (!ptr) zmalloc_oom_handler(size);
-    update_zmalloc_stat_alloc(zmalloc_size(ptr));
+    update_zmalloc_stat_alloc(zmalloc_raw_size(ptr));
     return ptr;
 }
 
 void zfree_no_tcache(void *ptr) {
     if (ptr == NULL) return;
-    update_zmalloc_stat_free(zmalloc_size(ptr));
+    update_zmalloc_stat_free(zmalloc_raw_size(ptr));
     dallocx(ptr, MALLOCX_TCACHE_NONE);
 }
 #endif
@@ -130,75 +189,57 @@ void *zcallocate(size_t size) {
     void *ptr = calloc(1, size+PREFIX_SIZE);
 
     if (!ptr) zmalloc_oom_handler(size);
-#ifdef HAVE_MALLOC_SIZE
-    update_zmalloc_stat_alloc(zmalloc_size(ptr));
-    return ptr;
-#else
-    *((size_t*)ptr) = size;
+    ZMALLOC_HEADER_SET(ptr,size,current_owner);
+    size = ZMALLOC_HEADER_SIZE(ptr);
     update_zmalloc_stat_alloc(size+PREFIX_SIZE);
+    update_zmalloc_owner_alloc(current_owner,size+PREFIX_SIZE);
     return (char*)ptr+PREFIX_SIZE;
-#endif
 }
 
 void *zrealloc(void *ptr, size_t size) {
-#ifndef HAVE_MALLOC_SIZE
     void *realptr;
-#endif
     size_t oldsize;
     void *newptr;
+    int owner;
 
     if (ptr == NULL) return zmalloc(size);
-#ifdef HAVE_MALLOC_SIZE
-    oldsize = zmalloc_size(ptr);
-    newptr = realloc(ptr,size);
-    if (!newptr) zmalloc_oom_handler(size);
-
-    update_zmalloc_stat_free(oldsize);
-    update_zmalloc_stat_alloc(zmalloc_size(newptr));
-    return newptr;
-#else
+    /* A reallocated block stays with the owner that allocated it. */
     realptr = (char*)ptr-PREFIX_SIZE;
-    oldsize = *((size_t*)realptr);
+    oldsize = ZMALLOC_HEADER_SIZE(realptr);
+    owner = ZMALLOC_HEADER_OWNER(realptr);
     newptr = realloc(realptr,size+PREFIX_SIZE);
     if (!newptr) zmalloc_oom_handler(size);
 
-    *((size_t*)newptr) = size;
+    ZMALLOC_HEADER_SET(newptr,size,owner);
+    size = ZMALLOC_HEADER_SIZE(newptr);
     update_zmalloc_stat_free(oldsize);
     update_zmalloc_stat_alloc(size);
+    update_zmalloc_owner_free(owner,oldsize);
+    update_zmalloc_owner_alloc(owner,size);
     return (char*)newptr+PREFIX_SIZE;
-#endif
 }
 
-/* Provide zmalloc_size() for systems where this function is not provided by
- * malloc itself, given that in that case we store a header with this
- * information as the first bytes of every allocation. */
-#ifndef HAVE_MALLOC_SIZE
+/* Size of the allocation, header included, read from the allocator when it
+ * provides it, or else from the header. */
 size_t zmalloc_size(void *ptr) {
     void *realptr = (char*)ptr-PREFIX_SIZE;
-    size_t size = *((size_t*)realptr);
+    size_t size = ZMALLOC_HEADER_SIZE(realptr);
     /* Assume at least that all the allocations are padded at sizeof(long) by
      * the underlying allocator. */
     if (size&(sizeof(long)-1)) size += sizeof(long)-(size&(sizeof(long)-1));
     return size+PREFIX_SIZE;
 }
-#endif
 
 void zfree(void *ptr) {
-#ifndef HAVE_MALLOC_SIZE
     void *realptr;
     size_t oldsize;
-#endif
 
     if (ptr == NULL) return;
-#ifdef HAVE_MALLOC_SIZE
-    update_zmalloc_stat_free(zmalloc_size(ptr));
-    free(ptr);
-#else
     realptr = (char*)ptr-PREFIX_SIZE;
-    oldsize = *((size_t*)realptr);
+    oldsize = ZMALLOC_HEADER_SIZE(realptr);
     update_zmalloc_stat_free(oldsize+PREFIX_SIZE);
+    update_zmalloc_owner_free(ZMALLOC_HEADER_OWNER(realptr),oldsize+PREFIX_SIZE);
     free(realptr);
-#endif
 }
 
 char *zstrdup(const char *s) {
@@ -215,6 +256,58 @@ size_t zmalloc_used_memory(void) {
     return um;
 }
 
+/* Reserve a new accounting owner. Blocks still referenced by the user when
+ * an owner is released keep its id in their header and are given back to
+ * it when freed, so a released slot is only reused once its counter
+ * drained to zero, and slots are handed out round robin to give it time.
+ * The memory charged to the new owner is charged to 'parent' too, unless
+ * it is 0. The parent must outlive the owner. Returns 0 (nobody) when all
+ * the slots are taken. */
+int zmalloc_owner_create(int parent) {
+    int j, owner = 0;
+    size_t used;
+
+    if (parent < 0 || parent >= ZMALLOC_MAX_OWNERS) parent = 0;
+    pthread_mutex_lock(&owners_mutex);
+    for (j = 0; j < ZMALLOC_MAX_OWNERS-1; j++) {
+        int id = next_owner;
+        next_owner = (next_owner == ZMALLOC_MAX_OWNERS-1) ? 1 : next_owner+1;
+        atomicGet(owners[id].used,used);
+        if (!owners[id].in_use && used == 0) {
+            owners[id].in_use = 1;
+            owners[id].parent = parent;
+            owner = id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&owners_mutex);
+    return owner;
+}
+
+void zmalloc_owner_release(int owner) {
+    if (owner <= 0 || owner >= ZMALLOC_MAX_OWNERS) return;
+
+    pthread_mutex_lock(&owners_mutex);
+    owners[owner].in_use = 0;
+    pthread_mutex_unlock(&owners_mutex);
+}
+
+/* Charge the allocations performed by the calling thread to 'owner' from
+ * now on. Returns the previous owner so that it can be restored. */
+int zmalloc_set_owner(int owner) {
+    int old = current_owner;
+    current_owner = owner;
+    return old;
+}
+
+size_t zmalloc_owner_used_memory(int owner) {
+    size_t um;
+
+    if (owner <= 0 || owner >= ZMALLOC_MAX_OWNERS) return 0;
+    atomicGet(owners[owner].used,um);
+    return um;
+}
+
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t)) {
     zmalloc_oom_handler = oom_handler;
 }
@@ -40,7 +40,7 @@
 #include <google/tcmalloc.h>
 #if (TC_VERSION_MAJOR == 1 && TC_VERSION_MINOR >= 6) || (TC_VERSION_MAJOR > 1)
 #define HAVE_MALLOC_SIZE 1
-#define zmalloc_size(p) tc_malloc_size(p)
+#define zmalloc_raw_size(p) tc_malloc_size(p)
 #else
 #error "Newer version of tcmalloc required"
 #endif
@@ -50,7 +50,7 @@
 #include <jemalloc/jemalloc.h>
 #if (JEMALLOC_VERSION_MAJOR == 2 && JEMALLOC_VERSION_MINOR >= 1) || (JEMALLOC_VERSION_MAJOR > 2)
 #define HAVE_MALLOC_SIZE 1
-#define zmalloc_size(p) je_malloc_usable_size(p)
+#define zmalloc_raw_size(p) je_malloc_usable_size(p)
 #else
 #error "Newer version of jemalloc required"
 #endif
@@ -58,7 +58,7 @@
 #elif defined(__APPLE__)
 #include <malloc/malloc.h>
 #define HAVE_MALLOC_SIZE 1
-#define zmalloc_size(p) malloc_size(p)
+#define zmalloc_raw_size(p) malloc_size(p)
 #endif
 
 #ifndef ZMALLOC_LIB
@@ -78,6 +78,11 @@ void *zrealloc(void *ptr, size_t size);
 void zfree(void *ptr);
 char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
+#define ZMALLOC_MAX_OWNERS 4096
+int zmalloc_owner_create(int parent);
+void zmalloc_owner_release(int owner);
+int zmalloc_set_owner(int owner);
+size_t zmalloc_owner_used_memory(int owner);
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t));
 float zmalloc_get_fragmentation_ratio(size_t rss);
 size_t zmalloc_get_rss(void);
@@ -91,8 +96,6 @@ void zfree_no_tcache(void *ptr);
 void *zmalloc_no_tcache(size_t size);
 #endif
 
-#ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);
-#endif
 
 #endif /* __ZMALLOC_H */
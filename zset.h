@@ -68,7 +68,7 @@ unsigned long zslDeleteRangeByScore(zskiplist *zsl, zrangespec *range, dict *dic
 unsigned long zslDeleteRangeByLex(zskiplist *zsl, zlexrangespec *range, dict *dict);
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API
+ * Listpack-backed sorted set API
  *----------------------------------------------------------------------------*/
 unsigned char *zzlFind(unsigned char *zl, sds ele, double *score);
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr);
@@ -88,16 +88,17 @@ int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec);
 unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted);
 unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsigned long *deleted);
 unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsigned long *deleted);
-sds ziplistGetObject(unsigned char *sptr);
+sds zzlGetObject(unsigned char *sptr);
 
 /*-----------------------------------------------------------------------------
  * Common sorted set API
  *----------------------------------------------------------------------------*/
 unsigned int zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+robj *zsetTypeCreate(size_t ele_len, db_config *config);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen, db_config *config);
 int zsetScore(robj *zobj, sds member, double *score);
-int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
+int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore, db_config *config);
 long zsetRank(robj *zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
 